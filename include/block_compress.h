@@ -0,0 +1,438 @@
+#ifndef _BLOCK_COMPRESS_H
+#define _BLOCK_COMPRESS_H
+
+#include <glm/vec3.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <cfloat>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Block compression of RGB textures into the formats the GPU samples
+// directly: 4 x 4 texel blocks of 8 bytes (BC1, 565 endpoints and 2 bit
+// indices) or 16 bytes (BC7, only mode 6: one 7 bit + p-bit endpoint pair and
+// 4 bit indices). The endpoints are the extremes of the principal axis of the
+// block colors, refined once by least squares over the chosen indices. The
+// decoders read what the encoders write, for the software sampler of Close2GL,
+// which keeps recently decoded blocks in a small per thread cache.
+#define BLOCK_FORMAT_NONE 0
+#define BLOCK_FORMAT_BC1  1
+#define BLOCK_FORMAT_BC7  2
+
+#define BLOCK_COMPRESS_BLOCKS_PER_THREAD 1024 // fewer blocks than this are not worth a thread
+#define BLOCK_CACHE_ENTRIES              256  // decoded blocks kept per thread, 16 x 16 blocks
+
+struct BlockTexture {
+    int                  format; // BLOCK_FORMAT_NONE when there are no blocks
+    int                  width;
+    int                  height;
+    const unsigned char *data;   // rows of blocks, top to bottom
+    unsigned             id;     // tells the images apart in the decoded block cache
+};
+
+static int BlockBytes(int format)
+{
+    return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+static size_t BlockImageBytes(int format, int width, int height)
+{
+    return (size_t)BlockBytes(format) * ((width + 3) / 4) * ((height + 3) / 4);
+}
+
+// A new id for BlockTexture, never 0.
+static unsigned BlockTextureId()
+{
+    static unsigned next = 0;
+    return ++next;
+}
+
+// Least squares endpoints e0, e1 of the texels with weights a (0 for e0, 1 for
+// e1). Returns false when the weights do not pin down both endpoints.
+static bool BlockFitEndpoints(const unsigned char *rgb, const float *a, glm::vec3 *e0, glm::vec3 *e1)
+{
+    float     aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    glm::vec3 ax(0.0f), bx(0.0f);
+    for (int i = 0; i < 16; i++) {
+        glm::vec3 x = glm::vec3(rgb[3*i], rgb[3*i+1], rgb[3*i+2]);
+        float     b = a[i];
+        aa += (1.0f - b) * (1.0f - b);
+        ab += (1.0f - b) * b;
+        bb += b * b;
+        ax += (1.0f - b) * x;
+        bx += b * x;
+    }
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f) {
+        return false;
+    }
+    *e0 = glm::clamp((bb * ax - ab * bx) / det, 0.0f, 255.0f);
+    *e1 = glm::clamp((aa * bx - ab * ax) / det, 0.0f, 255.0f);
+    return true;
+}
+
+// Ends of the principal axis of the colors of the block, the brighter first.
+static void BlockAxisEndpoints(const unsigned char *rgb, glm::vec3 *e0, glm::vec3 *e1)
+{
+    glm::vec3 mean(0.0f);
+    for (int i = 0; i < 16; i++) {
+        mean += glm::vec3(rgb[3*i], rgb[3*i+1], rgb[3*i+2]);
+    }
+    mean /= 16.0f;
+    float cov[6] = { 0 }; // xx xy xz yy yz zz
+    for (int i = 0; i < 16; i++) {
+        glm::vec3 d = glm::vec3(rgb[3*i], rgb[3*i+1], rgb[3*i+2]) - mean;
+        cov[0] += d.x * d.x; cov[1] += d.x * d.y; cov[2] += d.x * d.z;
+        cov[3] += d.y * d.y; cov[4] += d.y * d.z; cov[5] += d.z * d.z;
+    }
+    glm::vec3 axis(1.0f, 1.0f, 1.0f);
+    for (int k = 0; k < 8; k++) {
+        glm::vec3 next = glm::vec3(cov[0] * axis.x + cov[1] * axis.y + cov[2] * axis.z,
+                                   cov[1] * axis.x + cov[3] * axis.y + cov[4] * axis.z,
+                                   cov[2] * axis.x + cov[4] * axis.y + cov[5] * axis.z);
+        float length = glm::length(next);
+        if (length < 1e-6f) {
+            break;
+        }
+        axis = next / length;
+    }
+    float lo = FLT_MAX, hi = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+        float t = glm::dot(glm::vec3(rgb[3*i], rgb[3*i+1], rgb[3*i+2]) - mean, axis);
+        lo = glm::min(lo, t);
+        hi = glm::max(hi, t);
+    }
+    if (axis.x + axis.y + axis.z < 0.0f) {
+        float t = lo;
+        lo = -hi;
+        hi = -t;
+        axis = -axis;
+    }
+    *e0 = glm::clamp(mean + axis * hi, 0.0f, 255.0f);
+    *e1 = glm::clamp(mean + axis * lo, 0.0f, 255.0f);
+}
+
+// Picks the nearest of count palette colors for each texel. Returns the sum of
+// the squared errors.
+static int BlockChooseIndices(const unsigned char *rgb, const int palette[][3], int count, unsigned char *indices)
+{
+    int total = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0, best_error = 0x7fffffff;
+        for (int p = 0; p < count; p++) {
+            int dr = rgb[3*i] - palette[p][0], dg = rgb[3*i+1] - palette[p][1], db = rgb[3*i+2] - palette[p][2];
+            int error = dr * dr + dg * dg + db * db;
+            if (error < best_error) {
+                best       = p;
+                best_error = error;
+            }
+        }
+        indices[i] = (unsigned char)best;
+        total += best_error;
+    }
+    return total;
+}
+
+// ---- BC1
+
+static unsigned short BlockPack565(glm::vec3 c)
+{
+    int r = (int)(c.r * 31.0f / 255.0f + 0.5f);
+    int g = (int)(c.g * 63.0f / 255.0f + 0.5f);
+    int b = (int)(c.b * 31.0f / 255.0f + 0.5f);
+    return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void BlockPaletteBC1(unsigned short c0, unsigned short c1, int palette[4][3])
+{
+    int r0 = c0 >> 11, g0 = (c0 >> 5) & 63, b0 = c0 & 31;
+    int r1 = c1 >> 11, g1 = (c1 >> 5) & 63, b1 = c1 & 31;
+    palette[0][0] = (r0 << 3) | (r0 >> 2); palette[0][1] = (g0 << 2) | (g0 >> 4); palette[0][2] = (b0 << 3) | (b0 >> 2);
+    palette[1][0] = (r1 << 3) | (r1 >> 2); palette[1][1] = (g1 << 2) | (g1 >> 4); palette[1][2] = (b1 << 3) | (b1 >> 2);
+    for (int ch = 0; ch < 3; ch++) {
+        if (c0 > c1) {
+            palette[2][ch] = (2 * palette[0][ch] + palette[1][ch]) / 3;
+            palette[3][ch] = (palette[0][ch] + 2 * palette[1][ch]) / 3;
+        } else {
+            palette[2][ch] = (palette[0][ch] + palette[1][ch]) / 2;
+            palette[3][ch] = 0;
+        }
+    }
+}
+
+// Indices for the endpoints, swapped so c0 > c1 (the 4 color mode). Returns
+// the error.
+static int BlockTryBC1(const unsigned char *rgb, glm::vec3 e0, glm::vec3 e1, unsigned short *c0, unsigned short *c1,
+                       unsigned char *indices)
+{
+    *c0 = BlockPack565(e0);
+    *c1 = BlockPack565(e1);
+    if (*c0 < *c1) {
+        unsigned short t = *c0;
+        *c0 = *c1;
+        *c1 = t;
+    }
+    int palette[4][3];
+    BlockPaletteBC1(*c0, *c1, palette);
+    return BlockChooseIndices(rgb, palette, *c0 == *c1 ? 1 : 4, indices);
+}
+
+static void BlockEncodeBC1(const unsigned char *rgb, unsigned char *out)
+{
+    static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+    glm::vec3      e0, e1;
+    unsigned short c0, c1;
+    unsigned char  indices[16];
+    BlockAxisEndpoints(rgb, &e0, &e1);
+    int error = BlockTryBC1(rgb, e0, e1, &c0, &c1, indices);
+
+    float a[16];
+    for (int i = 0; i < 16; i++) {
+        a[i] = weights[indices[i]];
+    }
+    unsigned short refined0, refined1;
+    unsigned char  refined[16];
+    if (error > 0 && BlockFitEndpoints(rgb, a, &e0, &e1) &&
+        BlockTryBC1(rgb, e0, e1, &refined0, &refined1, refined) < error) {
+        c0 = refined0;
+        c1 = refined1;
+        memcpy(indices, refined, sizeof(indices));
+    }
+    unsigned bits = 0;
+    for (int i = 0; i < 16; i++) {
+        bits |= (unsigned)indices[i] << (2 * i);
+    }
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    out[4] = bits & 0xff; out[5] = (bits >> 8) & 0xff; out[6] = (bits >> 16) & 0xff; out[7] = bits >> 24;
+}
+
+static void BlockDecodeBC1(const unsigned char *block, unsigned char *rgb)
+{
+    unsigned short c0   = block[0] | (block[1] << 8);
+    unsigned short c1   = block[2] | (block[3] << 8);
+    unsigned       bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned)block[7] << 24);
+    int palette[4][3];
+    BlockPaletteBC1(c0, c1, palette);
+    for (int i = 0; i < 16; i++) {
+        const int *color = palette[(bits >> (2 * i)) & 3];
+        rgb[3*i] = color[0]; rgb[3*i+1] = color[1]; rgb[3*i+2] = color[2];
+    }
+}
+
+// ---- BC7, mode 6
+
+static const int g_BlockWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static void BlockPutBits(unsigned char *block, int *pos, unsigned value, int count)
+{
+    for (int i = 0; i < count; i++, (*pos)++) {
+        block[*pos >> 3] |= ((value >> i) & 1) << (*pos & 7);
+    }
+}
+
+static void BlockPaletteBC7(const int e0[3], const int e1[3], int palette[16][3])
+{
+    for (int p = 0; p < 16; p++) {
+        for (int ch = 0; ch < 3; ch++) {
+            palette[p][ch] = ((64 - g_BlockWeights4[p]) * e0[ch] + g_BlockWeights4[p] * e1[ch] + 32) >> 6;
+        }
+    }
+}
+
+// The 7 bit endpoints and p-bits, out of the four p-bit pairs, that fit the
+// block best for e0 and e1. Returns the error.
+static int BlockTryBC7(const unsigned char *rgb, glm::vec3 e0, glm::vec3 e1, int q[2][3], int p[2], unsigned char *indices)
+{
+    int best_error = 0x7fffffff;
+    for (int pair = 0; pair < 4; pair++) {
+        int  pbits[2] = { pair & 1, pair >> 1 };
+        int  quantized[2][3];
+        int  expanded[2][3];
+        for (int ch = 0; ch < 3; ch++) {
+            quantized[0][ch] = glm::clamp((int)((e0[ch] - pbits[0]) / 2.0f + 0.5f), 0, 127);
+            quantized[1][ch] = glm::clamp((int)((e1[ch] - pbits[1]) / 2.0f + 0.5f), 0, 127);
+            expanded[0][ch]  = (quantized[0][ch] << 1) | pbits[0];
+            expanded[1][ch]  = (quantized[1][ch] << 1) | pbits[1];
+        }
+        int palette[16][3];
+        unsigned char chosen[16];
+        BlockPaletteBC7(expanded[0], expanded[1], palette);
+        int error = BlockChooseIndices(rgb, palette, 16, chosen);
+        if (error < best_error) {
+            best_error = error;
+            memcpy(q, quantized, sizeof(quantized));
+            p[0] = pbits[0];
+            p[1] = pbits[1];
+            memcpy(indices, chosen, 16);
+        }
+    }
+    return best_error;
+}
+
+static void BlockEncodeBC7(const unsigned char *rgb, unsigned char *out)
+{
+    glm::vec3     e0, e1;
+    int           q[2][3], p[2];
+    unsigned char indices[16];
+    BlockAxisEndpoints(rgb, &e0, &e1);
+    int error = BlockTryBC7(rgb, e0, e1, q, p, indices);
+
+    float a[16];
+    for (int i = 0; i < 16; i++) {
+        a[i] = g_BlockWeights4[indices[i]] / 64.0f;
+    }
+    int           refined_q[2][3], refined_p[2];
+    unsigned char refined[16];
+    if (error > 0 && BlockFitEndpoints(rgb, a, &e0, &e1) &&
+        BlockTryBC7(rgb, e0, e1, refined_q, refined_p, refined) < error) {
+        memcpy(q, refined_q, sizeof(q));
+        memcpy(p, refined_p, sizeof(p));
+        memcpy(indices, refined, sizeof(indices));
+    }
+    // the top bit of the first index is implied 0: swap the endpoints if it is set
+    if (indices[0] >= 8) {
+        for (int ch = 0; ch < 3; ch++) {
+            int t = q[0][ch]; q[0][ch] = q[1][ch]; q[1][ch] = t;
+        }
+        int t = p[0]; p[0] = p[1]; p[1] = t;
+        for (int i = 0; i < 16; i++) {
+            indices[i] = 15 - indices[i];
+        }
+    }
+    memset(out, 0, 16);
+    int pos = 0;
+    BlockPutBits(out, &pos, 1 << 6, 7); // mode 6
+    for (int ch = 0; ch < 3; ch++) {
+        BlockPutBits(out, &pos, q[0][ch], 7);
+        BlockPutBits(out, &pos, q[1][ch], 7);
+    }
+    BlockPutBits(out, &pos, 127, 7); // alpha, 255 with the p-bit 1, whatever the GPU makes of it is not sampled
+    BlockPutBits(out, &pos, 127, 7);
+    BlockPutBits(out, &pos, p[0], 1);
+    BlockPutBits(out, &pos, p[1], 1);
+    BlockPutBits(out, &pos, indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        BlockPutBits(out, &pos, indices[i], 4);
+    }
+}
+
+// Decodes the mode 6 blocks of BlockEncodeBC7(); any other mode comes out magenta.
+// Mode 6 puts the endpoints and the first p-bit in the low 64 bits of the block
+// and the second p-bit and the indices in the high 64, so both halves are read
+// whole instead of a bit at a time.
+static void BlockDecodeBC7(const unsigned char *block, unsigned char *rgb)
+{
+    unsigned long long lo = 0;
+    unsigned long long hi = 0;
+    for (int b = 7; b >= 0; b--) {
+        lo = (lo << 8) | block[b];
+        hi = (hi << 8) | block[8 + b];
+    }
+    if ((lo & 0x7f) != (1 << 6)) {
+        for (int i = 0; i < 16; i++) {
+            rgb[3*i] = 255; rgb[3*i+1] = 0; rgb[3*i+2] = 255;
+        }
+        return;
+    }
+    int p0 = (int)(lo >> 63);
+    int p1 = (int)(hi & 1);
+    int e[2][3];
+    for (int ch = 0; ch < 3; ch++) {
+        e[0][ch] = (int)(((lo >> (7 + 14 * ch)) & 0x7f) << 1) | p0;
+        e[1][ch] = (int)(((lo >> (14 + 14 * ch)) & 0x7f) << 1) | p1;
+    }
+    int palette[16][3];
+    BlockPaletteBC7(e[0], e[1], palette);
+    hi >>= 1;
+    for (int i = 0; i < 16; i++) {
+        int bits = i == 0 ? 3 : 4; // the anchor index drops its top bit
+        const int *color = palette[hi & ((1u << bits) - 1)];
+        hi >>= bits;
+        rgb[3*i] = color[0]; rgb[3*i+1] = color[1]; rgb[3*i+2] = color[2];
+    }
+}
+
+// ---- images
+
+static void BlockEncode(int format, const unsigned char *rgb, unsigned char *out)
+{
+    if (format == BLOCK_FORMAT_BC1) {
+        BlockEncodeBC1(rgb, out);
+    } else {
+        BlockEncodeBC7(rgb, out);
+    }
+}
+
+static void BlockDecode(int format, const unsigned char *block, unsigned char *rgb)
+{
+    if (format == BLOCK_FORMAT_BC1) {
+        BlockDecodeBC1(block, rgb);
+    } else {
+        BlockDecodeBC7(block, rgb);
+    }
+}
+
+// Compresses the block rows [first, last) of an RGB image. Blocks past the
+// right or bottom edge repeat the last column or row.
+static void BlockCompressRows(const unsigned char *rgb, int width, int height, int format, unsigned char *out,
+                              int first, int last)
+{
+    int blocks_x = (width + 3) / 4;
+    for (int by = first; by < last; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            unsigned char texels[48];
+            for (int i = 0; i < 16; i++) {
+                int x = glm::min(4 * bx + (i & 3),  width  - 1);
+                int y = glm::min(4 * by + (i >> 2), height - 1);
+                memcpy(texels + 3 * i, rgb + 3 * ((size_t)y * width + x), 3);
+            }
+            BlockEncode(format, texels, out + (size_t)BlockBytes(format) * ((size_t)by * blocks_x + bx));
+        }
+    }
+}
+
+// Compresses an RGB image into BlockImageBytes() bytes at out, the block rows
+// split in bands between up to max_threads threads.
+static void BlockCompressImage(const unsigned char *rgb, int width, int height, int format, unsigned char *out, int max_threads)
+{
+    int rows    = (height + 3) / 4;
+    int blocks  = rows * ((width + 3) / 4);
+    int threads = glm::clamp(blocks / BLOCK_COMPRESS_BLOCKS_PER_THREAD, 1, glm::max(max_threads, 1));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread(BlockCompressRows, rgb, width, height, format, out, rows * t / threads, rows * (t + 1) / threads));
+    }
+    BlockCompressRows(rgb, width, height, format, out, 0, rows / threads);
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
+
+// The RGB of texel (x, y), decoded with the rest of its block unless the
+// block is in the cache of the calling thread.
+static inline const unsigned char *BlockFetch(const BlockTexture &texture, int x, int y)
+{
+    struct Entry {
+        unsigned      id;
+        int           bx;
+        int           by;
+        unsigned char rgb[48];
+    };
+    static thread_local Entry cache[BLOCK_CACHE_ENTRIES];
+    int    bx    = x >> 2;
+    int    by    = y >> 2;
+    Entry &entry = cache[(bx & 15) | ((by & 15) << 4)];
+    if (entry.id != texture.id || entry.bx != bx || entry.by != by) {
+        size_t block = (size_t)by * ((texture.width + 3) / 4) + bx;
+        BlockDecode(texture.format, texture.data + BlockBytes(texture.format) * block, entry.rgb);
+        entry.id = texture.id;
+        entry.bx = bx;
+        entry.by = by;
+    }
+    return entry.rgb + 3 * (4 * (y & 3) + (x & 3));
+}
+
+#endif // _BLOCK_COMPRESS_H
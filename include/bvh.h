@@ -0,0 +1,294 @@
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Bounding volume hierarchy over the triangles of a model, built with binned
+// SAH and stored depth first in a flat array of 32 byte nodes: the left child
+// of an inner node is the next node and the right child is at offset. The
+// triangles are reordered so that every node covers a contiguous range, which
+// lets the traversal hand out whole draw ranges instead of single triangles.
+#define BVH_BINS          16
+#define BVH_LEAF_SIZE     4   // nodes with this many triangles or less are leaves
+#define BVH_MAX_LEAF_SIZE 16  // larger nodes are split even when SAH prefers a leaf
+#define BVH_MAX_DEPTH     64
+
+struct BvhNode {
+    glm::vec3 min;
+    unsigned  offset; // leaf: first triangle, inner node: index of the right child
+    glm::vec3 max;
+    unsigned  count;  // leaf: number of triangles, inner node: 0
+};
+
+struct BvhRange {
+    unsigned first;
+    unsigned count;
+};
+
+struct BvhBuilder {
+    const glm::vec3      *tri_min;
+    const glm::vec3      *tri_max;
+    unsigned             *order;
+    std::vector<BvhNode>  nodes;
+};
+
+static float BvhArea(glm::vec3 min, glm::vec3 max)
+{
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static void BvhBuildNode(BvhBuilder *builder, unsigned node, unsigned first, unsigned count, int depth)
+{
+    const glm::vec3 *tri_min = builder->tri_min;
+    const glm::vec3 *tri_max = builder->tri_max;
+    unsigned        *order   = builder->order;
+
+    glm::vec3 min( FLT_MAX), max(-FLT_MAX);
+    glm::vec3 cmin( FLT_MAX), cmax(-FLT_MAX); // bounds of the centroids
+    for (unsigned i = first; i < first + count; i++) {
+        unsigned t = order[i];
+        glm::vec3 centroid = 0.5f * (tri_min[t] + tri_max[t]);
+        min  = glm::min(min,  tri_min[t]);
+        max  = glm::max(max,  tri_max[t]);
+        cmin = glm::min(cmin, centroid);
+        cmax = glm::max(cmax, centroid);
+    }
+    builder->nodes[node].min    = min;
+    builder->nodes[node].max    = max;
+    builder->nodes[node].offset = first;
+    builder->nodes[node].count  = count;
+
+    glm::vec3 extent = cmax - cmin;
+    int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z) ? 1 : 2;
+    if (count <= BVH_LEAF_SIZE || extent[axis] <= 0.0f || depth >= BVH_MAX_DEPTH) {
+        return;
+    }
+
+    // bin the centroids along the largest axis
+    unsigned  bin_count[BVH_BINS] = { 0 };
+    glm::vec3 bin_min[BVH_BINS];
+    glm::vec3 bin_max[BVH_BINS];
+    for (int b = 0; b < BVH_BINS; b++) {
+        bin_min[b] = glm::vec3( FLT_MAX);
+        bin_max[b] = glm::vec3(-FLT_MAX);
+    }
+    float scale = BVH_BINS / extent[axis];
+    for (unsigned i = first; i < first + count; i++) {
+        unsigned t = order[i];
+        float centroid = 0.5f * (tri_min[t][axis] + tri_max[t][axis]);
+        int   b = glm::min(BVH_BINS - 1, (int)((centroid - cmin[axis]) * scale));
+        bin_count[b] += 1;
+        bin_min[b] = glm::min(bin_min[b], tri_min[t]);
+        bin_max[b] = glm::max(bin_max[b], tri_max[t]);
+    }
+
+    // cost of splitting after each bin, sweeping from both sides
+    float     left_area[BVH_BINS - 1];
+    unsigned  left_count[BVH_BINS - 1];
+    glm::vec3 lmin( FLT_MAX), lmax(-FLT_MAX);
+    unsigned  n = 0;
+    for (int b = 0; b < BVH_BINS - 1; b++) {
+        lmin = glm::min(lmin, bin_min[b]);
+        lmax = glm::max(lmax, bin_max[b]);
+        n += bin_count[b];
+        left_area[b]  = BvhArea(lmin, lmax);
+        left_count[b] = n;
+    }
+    int       best_split = -1;
+    float     best_cost  = FLT_MAX;
+    glm::vec3 rmin( FLT_MAX), rmax(-FLT_MAX);
+    for (int b = BVH_BINS - 1; b > 0; b--) {
+        rmin = glm::min(rmin, bin_min[b]);
+        rmax = glm::max(rmax, bin_max[b]);
+        unsigned right_count = count - left_count[b-1];
+        if (left_count[b-1] == 0 || right_count == 0) {
+            continue;
+        }
+        float cost = left_area[b-1] * left_count[b-1] + BvhArea(rmin, rmax) * right_count;
+        if (cost < best_cost) {
+            best_cost  = cost;
+            best_split = b;
+        }
+    }
+    // one traversal step costs about as much as testing one triangle
+    float leaf_cost = BvhArea(min, max) * count;
+    if (best_split < 0 || (best_cost + BvhArea(min, max) >= leaf_cost && count <= BVH_MAX_LEAF_SIZE)) {
+        return;
+    }
+
+    // partition the range, triangles of the bins before the split go left
+    unsigned *left  = order + first;
+    unsigned *right = order + first + count - 1;
+    while (left <= right) {
+        float centroid = 0.5f * (tri_min[*left][axis] + tri_max[*left][axis]);
+        int   b = glm::min(BVH_BINS - 1, (int)((centroid - cmin[axis]) * scale));
+        if (b < best_split) {
+            left++;
+        } else {
+            unsigned t = *left;
+            *left  = *right;
+            *right = t;
+            right--;
+        }
+    }
+    unsigned left_total = (unsigned)(left - (order + first));
+
+    builder->nodes[node].count = 0;
+    unsigned left_child = builder->nodes.size();
+    builder->nodes.push_back(BvhNode());
+    BvhBuildNode(builder, left_child, first, left_total, depth + 1);
+    unsigned right_child = builder->nodes.size();
+    builder->nodes.push_back(BvhNode());
+    builder->nodes[node].offset = right_child;
+    BvhBuildNode(builder, right_child, first + left_total, count - left_total, depth + 1);
+}
+
+// Builds the hierarchy from the bounds of each triangle. The node ranges refer
+// to the triangles after reordering: position i must hold the original
+// triangle order[i]. Returns the nodes, allocated with malloc().
+static BvhNode *BvhBuild(const glm::vec3 *tri_min, const glm::vec3 *tri_max, unsigned num_triangles,
+                         unsigned *order, int *num_nodes)
+{
+    BvhBuilder builder;
+    builder.tri_min = tri_min;
+    builder.tri_max = tri_max;
+    builder.order   = order;
+    for (unsigned i = 0; i < num_triangles; i++) {
+        order[i] = i;
+    }
+    builder.nodes.reserve(num_triangles > 0 ? 2 * num_triangles / BVH_LEAF_SIZE + 1 : 1);
+    builder.nodes.push_back(BvhNode());
+    BvhBuildNode(&builder, 0, 0, num_triangles, 0);
+
+    BvhNode *nodes = (BvhNode*)malloc(builder.nodes.size() * sizeof(BvhNode));
+    memcpy(nodes, builder.nodes.data(), builder.nodes.size() * sizeof(BvhNode));
+    *num_nodes = builder.nodes.size();
+    return nodes;
+}
+
+// Planes of the clip volume -w <= x,y,z <= w of the given matrix, pointing
+// inwards (Gribb and Hartmann).
+static void BvhFrustumPlanes(glm::mat4 m, glm::vec4 planes[6])
+{
+    glm::vec4 row0 = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1 = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2 = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3 = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row3 + row2;
+    planes[5] = row3 - row2;
+}
+
+// True when the box is entirely outside one of the planes.
+static bool BvhBoxOutside(const glm::vec4 planes[6], glm::vec3 min, glm::vec3 max)
+{
+    for (int p = 0; p < 6; p++) {
+        glm::vec3 normal     = glm::vec3(planes[p]);
+        glm::vec3 far_corner = glm::vec3(normal.x >= 0 ? max.x : min.x,
+                                         normal.y >= 0 ? max.y : min.y,
+                                         normal.z >= 0 ? max.z : min.z);
+        if (glm::dot(normal, far_corner) + planes[p].w < 0.0f) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Appends a triangle range, merging it with the previous one when they touch.
+static void BvhAppendRange(std::vector<BvhRange> *ranges, unsigned first, unsigned count)
+{
+    if (!ranges->empty() && ranges->back().first + ranges->back().count == first) {
+        ranges->back().count += count;
+    } else {
+        BvhRange range = { first, count };
+        ranges->push_back(range);
+    }
+}
+
+// Fills ranges with the items (triangles, or the meshlets of meshlet.h) whose
+// leaves are not entirely outside one of the frustum planes of matrix
+// (projection * view * model). Subtrees entirely inside the frustum are added
+// without testing their children. Returns the number of items in the ranges.
+static unsigned BvhCullFrustum(const BvhNode *nodes, glm::mat4 matrix, std::vector<BvhRange> *ranges)
+{
+    ranges->clear();
+    if (!nodes) {
+        return 0;
+    }
+    glm::vec4 planes[6];
+    BvhFrustumPlanes(matrix, planes);
+
+    unsigned visible = 0;
+    unsigned stack[2 * BVH_MAX_DEPTH + 2];
+    unsigned masks[2 * BVH_MAX_DEPTH + 2]; // planes the node may still cross
+    int      top = 0;
+    stack[0] = 0;
+    masks[0] = 0x3F;
+    while (top >= 0) {
+        unsigned       index = stack[top];
+        unsigned       mask  = masks[top];
+        const BvhNode &node  = nodes[index];
+        top--;
+
+        bool outside = false;
+        for (int p = 0; p < 6 && !outside; p++) {
+            if (!(mask & (1 << p))) {
+                continue;
+            }
+            glm::vec3 normal = glm::vec3(planes[p]);
+            // corner furthest along the plane normal, and the one closest to it
+            glm::vec3 far_corner  = glm::vec3(normal.x >= 0 ? node.max.x : node.min.x,
+                                              normal.y >= 0 ? node.max.y : node.min.y,
+                                              normal.z >= 0 ? node.max.z : node.min.z);
+            glm::vec3 near_corner = glm::vec3(normal.x >= 0 ? node.min.x : node.max.x,
+                                              normal.y >= 0 ? node.min.y : node.max.y,
+                                              normal.z >= 0 ? node.min.z : node.max.z);
+            if (glm::dot(normal, far_corner) + planes[p].w < 0.0f) {
+                outside = true;
+            } else if (glm::dot(normal, near_corner) + planes[p].w >= 0.0f) {
+                mask &= ~(1 << p);
+            }
+        }
+        if (outside) {
+            continue;
+        }
+        if (node.count > 0 || mask == 0) {
+            // a leaf, or a subtree inside the frustum: its leftmost and
+            // rightmost leaves bound its triangle range
+            unsigned leftmost = index;
+            while (nodes[leftmost].count == 0) {
+                leftmost = leftmost + 1;
+            }
+            unsigned rightmost = index;
+            while (nodes[rightmost].count == 0) {
+                rightmost = nodes[rightmost].offset;
+            }
+            unsigned first = nodes[leftmost].offset;
+            unsigned count = nodes[rightmost].offset + nodes[rightmost].count - first;
+            BvhAppendRange(ranges, first, count);
+            visible += count;
+            continue;
+        }
+        // right child pushed first so the ranges come out in order
+        stack[++top] = node.offset;
+        masks[top]   = mask;
+        stack[++top] = index + 1;
+        masks[top]   = mask;
+    }
+    return visible;
+}
+
+#endif // _BVH_H
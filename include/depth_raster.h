@@ -0,0 +1,209 @@
+#ifndef _DEPTH_RASTER_H
+#define _DEPTH_RASTER_H
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEPTH_RASTER_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Depth only rasterizer: edge functions evaluated at the pixel centers, four
+// pixels of a row at a time, with the depth interpolated linearly in screen
+// space like Close2GL does and nothing else set up. A pixel on an edge shared
+// by two triangles belongs to exactly one of them (top-left rule).
+#define DEPTH_RASTER_LANES 4
+
+// Depth plane owned by the caller: width x height floats, row j starting at
+// j * width. Empty pixels hold FLT_MAX and a pixel keeps the nearest depth.
+struct DepthTarget {
+    int    width;
+    int    height;
+    float *depth;
+};
+
+static void DepthClear(DepthTarget target)
+{
+    std::fill(target.depth, target.depth + (size_t)target.width * target.height, FLT_MAX);
+}
+
+// Edge functions of a triangle in screen space, set up for the pixel loops.
+// Edge k is opposite vertex k, e = a * x + b * y + c is positive inside and
+// pixels exactly on an edge belong to it only on its top-left side.
+struct RasterSetup {
+    int   x0, y0, x1, y1; // pixels whose centers may be covered
+    float a[3], b[3], c[3], bias[3];
+    float area;
+    bool  swapped;        // the last two vertices were exchanged to make the area positive
+};
+
+// Sets up a triangle with x and y in pixels. facing 1 drops triangles of
+// negative area (the back faces of Close2GL in clockwise mode), -1 those of
+// positive area and 0 none. Returns false if nothing is left to draw.
+static bool RasterSetupTriangle(int width, int height, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float facing,
+                                RasterSetup *setup)
+{
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    if (area == 0.0f || facing * area < 0.0f) {
+        return false;
+    }
+    setup->swapped = area < 0.0f;
+    if (setup->swapped) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+    setup->area = area;
+    setup->x0 = glm::max((int)ceilf (glm::min(v0.x, glm::min(v1.x, v2.x)) - 0.5f), 0);
+    setup->y0 = glm::max((int)ceilf (glm::min(v0.y, glm::min(v1.y, v2.y)) - 0.5f), 0);
+    setup->x1 = glm::min((int)floorf(glm::max(v0.x, glm::max(v1.x, v2.x)) - 0.5f), width  - 1);
+    setup->y1 = glm::min((int)floorf(glm::max(v0.y, glm::max(v1.y, v2.y)) - 0.5f), height - 1);
+    if (setup->x0 > setup->x1 || setup->y0 > setup->y1) {
+        return false;
+    }
+    glm::vec3 v[3] = { v0, v1, v2 };
+    for (int k = 0; k < 3; k++) {
+        glm::vec3 p = v[(k + 1) % 3];
+        glm::vec3 q = v[(k + 2) % 3];
+        setup->a[k]    = -(q.y - p.y);
+        setup->b[k]    =   q.x - p.x;
+        setup->c[k]    = -(setup->a[k] * p.x + setup->b[k] * p.y);
+        setup->bias[k] = (setup->a[k] > 0.0f || (setup->a[k] == 0.0f && setup->b[k] > 0.0f)) ? -FLT_MIN : 0.0f;
+    }
+    return true;
+}
+
+// Plane q = x * dqdx + y * dqdy + q0 through the values of an attribute at the
+// vertices given to RasterSetupTriangle(), from the barycentric weights.
+// Returns (dqdx, dqdy, q0).
+static glm::vec3 RasterPlane(const RasterSetup &setup, float q0, float q1, float q2)
+{
+    if (setup.swapped) {
+        std::swap(q1, q2);
+    }
+    return glm::vec3((setup.a[0] * q0 + setup.a[1] * q1 + setup.a[2] * q2) / setup.area,
+                     (setup.b[0] * q0 + setup.b[1] * q1 + setup.b[2] * q2) / setup.area,
+                     (setup.c[0] * q0 + setup.c[1] * q1 + setup.c[2] * q2) / setup.area);
+}
+
+// Writes the depth plane z of a set up triangle into target where it is
+// nearer, and calls fragments(x, y, mask) for every written group of pixels:
+// bit i of mask set means pixel x + i of row y was written. The pixel centers
+// are at x + i + 0.5 and y + 0.5.
+template <typename Fragments>
+static void RasterSpans(DepthTarget target, const RasterSetup &setup, glm::vec3 z, Fragments fragments)
+{
+    const float *a = setup.a, *b = setup.b, *c = setup.c, *bias = setup.bias;
+    float dzdx = z.x, dzdy = z.y, z0 = z.z;
+#ifdef DEPTH_RASTER_SSE
+    const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128 far_z = _mm_set1_ps(1.0f);
+    __m128 va[3], vbias[3];
+    for (int k = 0; k < 3; k++) {
+        va[k]    = _mm_set1_ps(a[k]);
+        vbias[k] = _mm_set1_ps(bias[k]);
+    }
+    __m128 vdzdx = _mm_set1_ps(dzdx);
+#endif
+    for (int y = setup.y0; y <= setup.y1; y++) {
+        float  py  = y + 0.5f;
+        float *row = target.depth + (size_t)y * target.width;
+        int    x   = setup.x0;
+#ifdef DEPTH_RASTER_SSE
+        __m128 row_e[3];
+        for (int k = 0; k < 3; k++) {
+            row_e[k] = _mm_set1_ps(b[k] * py + c[k]);
+        }
+        __m128 row_z = _mm_set1_ps(dzdy * py + z0);
+        // blocks may run past x1 inside the row, their extra lanes fail the
+        // edge tests and keep the stored depth
+        for (; x + DEPTH_RASTER_LANES <= target.width && x <= setup.x1; x += DEPTH_RASTER_LANES) {
+            __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), lanes);
+            __m128 inside = _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(va[0], px), row_e[0]), vbias[0]);
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(va[1], px), row_e[1]), vbias[1]));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(va[2], px), row_e[2]), vbias[2]));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 zs    = _mm_add_ps(_mm_mul_ps(vdzdx, px), row_z);
+            __m128 old   = _mm_loadu_ps(row + x);
+            __m128 write = _mm_and_ps(inside, _mm_and_ps(_mm_cmplt_ps(zs, old), _mm_cmple_ps(zs, far_z)));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(write, zs), _mm_andnot_ps(write, old)));
+            int mask = _mm_movemask_ps(write);
+            if (mask != 0) {
+                fragments(x, y, mask);
+            }
+        }
+#endif
+        // the last pixels of the row, and every pixel without SSE, rounded
+        // the same way as the blocks
+        float e0 = b[0] * py + c[0];
+        float e1 = b[1] * py + c[1];
+        float e2 = b[2] * py + c[2];
+        float ez = dzdy * py + z0;
+        for (; x <= setup.x1; x++) {
+            float px = x + 0.5f;
+            if (a[0] * px + e0 > bias[0] && a[1] * px + e1 > bias[1] && a[2] * px + e2 > bias[2]) {
+                float zs = dzdx * px + ez;
+                if (zs < row[x] && zs <= 1.0f) {
+                    row[x] = zs;
+                    fragments(x, y, 1);
+                }
+            }
+        }
+    }
+}
+
+struct DepthRasterNothing {
+    void operator()(int, int, int) const {}
+};
+
+// Rasterizes a triangle in screen space: x and y in pixels, z the depth.
+// facing as in RasterSetupTriangle().
+static void DepthRasterTriangle(DepthTarget target, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float facing)
+{
+    RasterSetup setup;
+    if (RasterSetupTriangle(target.width, target.height, v0, v1, v2, facing, &setup)) {
+        RasterSpans(target, setup, RasterPlane(setup, v0.z, v1.z, v2.z), DepthRasterNothing());
+    }
+}
+
+// Clips a triangle in clip space against the near plane (z >= -w), projects
+// it with viewport and rasterizes it.
+static void DepthRasterClipTriangle(DepthTarget target, glm::mat4 viewport, glm::vec4 c0, glm::vec4 c1, glm::vec4 c2, float facing)
+{
+    glm::vec4 in[3] = { c0, c1, c2 };
+    glm::vec4 out[4];
+    int       count = 0;
+    for (int k = 0; k < 3; k++) {
+        glm::vec4 p  = in[k];
+        glm::vec4 q  = in[(k + 1) % 3];
+        float     dp = p.z + p.w;
+        float     dq = q.z + q.w;
+        if (dp >= 0.0f) {
+            out[count++] = p;
+        }
+        if ((dp >= 0.0f) != (dq >= 0.0f)) {
+            out[count++] = p + (q - p) * (dp / (dp - dq));
+        }
+    }
+    glm::vec3 screen[4];
+    for (int k = 0; k < count; k++) {
+        if (out[k].w <= 0.0f) {
+            return; // not a perspective or orthographic projection
+        }
+        glm::vec4 s = viewport * (out[k] / out[k].w);
+        screen[k] = glm::vec3(s);
+    }
+    for (int k = 2; k < count; k++) {
+        DepthRasterTriangle(target, screen[0], screen[k-1], screen[k], facing);
+    }
+}
+
+#endif // _DEPTH_RASTER_H
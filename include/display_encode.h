@@ -0,0 +1,59 @@
+#ifndef _DISPLAY_ENCODE_H
+#define _DISPLAY_ENCODE_H
+
+#include <cmath>
+
+// Output stage of the Close2GL color buffer. Shading stores linear light in
+// 12 bit fixed point and the frame is encoded for the display only once per
+// pixel, when it is uploaded or written out, through a table of
+// pow(x, 1 / 2.2) like the one of the shaders. Colors that already are display
+// values (texels, the flat colors, the debug views) go in through the inverse
+// table, so they come out as they went in, the darkest few within 2 steps.
+#define DISPLAY_LINEAR_STEPS 4096 // entries of the encoding table
+#define DISPLAY_LINEAR_MAX   (DISPLAY_LINEAR_STEPS - 1)
+
+struct DisplayTables {
+    unsigned char  encode[DISPLAY_LINEAR_STEPS];
+    unsigned short decode[256]; // the linear value whose encoding is nearest each byte
+
+    DisplayTables()
+    {
+        for (int i = 0; i < DISPLAY_LINEAR_STEPS; i++) {
+            encode[i] = (unsigned char)(255.0f * powf((float)i / DISPLAY_LINEAR_MAX, 1.0f / 2.2f));
+        }
+        int linear = 0;
+        for (int value = 0; value < 256; value++) {
+            // the last entry not above value, or the next one if it is nearer
+            while (linear < DISPLAY_LINEAR_MAX && encode[linear + 1] <= value) {
+                linear += 1;
+            }
+            bool next = linear < DISPLAY_LINEAR_MAX && encode[linear + 1] - value < value - encode[linear];
+            decode[value] = (unsigned short)(next ? linear + 1 : linear);
+        }
+    }
+};
+
+static const DisplayTables &DisplayTable()
+{
+    static DisplayTables tables;
+    return tables;
+}
+
+// Linear light, clamped to [0, 1].
+static inline unsigned short DisplayLinear(float linear)
+{
+    int value = (int)(linear * DISPLAY_LINEAR_MAX + 0.5f);
+    return (unsigned short)(value < 0 ? 0 : value > DISPLAY_LINEAR_MAX ? DISPLAY_LINEAR_MAX : value);
+}
+
+static inline unsigned short DisplayDecode(unsigned char value)
+{
+    return DisplayTable().decode[value];
+}
+
+static inline unsigned char DisplayEncode(unsigned short linear)
+{
+    return DisplayTable().encode[linear];
+}
+
+#endif // _DISPLAY_ENCODE_H
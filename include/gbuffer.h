@@ -0,0 +1,500 @@
+#ifndef _GBUFFER_H
+#define _GBUFFER_H
+
+#include "block_compress.h"
+#include "depth_raster.h"
+#include "display_encode.h"
+#include "parallel.h"
+
+#include <glm/vec2.hpp>
+#include <glm/geometric.hpp>
+
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+// G-buffer of the deferred mode of Close2GL. The raster only stores what the
+// lighting needs and the lighting runs afterwards, once per covered pixel, so
+// its cost does not grow with the overdraw. A pixel takes 14 bytes in separate
+// planes: the depth, the normal folded into an octahedron (two 16 bit signed
+// coordinates), the texture coordinates (two 16 bit fractions) and the
+// material.
+#define GBUFFER_SHINE_SQUARINGS   5     // specular exponent 2^5 = 32, the one of triangles.frag
+
+// Built with AVX2 (CMP143_AVX2 in CMake) the lighting pass takes 8 pixels at
+// a time, and the pixels left at the end of a row 4 at a time with SSE2.
+#ifdef __AVX2__
+#define GBUFFER_AVX2       1
+#define GBUFFER_AVX2_LANES 8
+#include <immintrin.h>
+#endif
+
+struct GBuffer {
+    int             width;
+    int             height;
+    float          *depth;    // FLT_MAX where nothing was drawn
+    unsigned       *normal;
+    unsigned       *uv;
+    unsigned short *material;
+};
+
+// Texture of the lighting pass, sampled like Close2GL samples g_Texture.
+struct GBufferTexture {
+    const unsigned char *data; // NULL, with no blocks either, to use the material colors
+    int                  width;
+    int                  height;
+    int                  channels;
+    bool                 bilinear;
+    BlockTexture         blocks; // sampled instead of data when it has a format
+};
+
+static inline const unsigned char *GBufferTexel(const GBufferTexture &texture, int x, int y)
+{
+    if (texture.blocks.format != BLOCK_FORMAT_NONE) {
+        return BlockFetch(texture.blocks, x, y);
+    }
+    return texture.data + texture.channels * (x + y * texture.width);
+}
+
+struct GBufferLighting {
+    glm::mat4        screen_to_world; // inverse of viewport * projection * view
+    glm::vec3        camera;          // world position
+    glm::vec3        light;           // normalized direction towards the light
+    float            ambient;         // Ka * Ia, grey
+    const glm::vec3 *materials;       // base color of each material
+    GBufferTexture   texture;
+    unsigned short  *rgb;             // output, linear as DisplayLinear(): red of pixel 0, then green and blue
+    int              rgb_stride;      // unsigned shorts between the pixels of rgb
+};
+
+static void GBufferResize(GBuffer *gbuffer, int width, int height)
+{
+    if (gbuffer->depth && gbuffer->width == width && gbuffer->height == height) {
+        return;
+    }
+    free(gbuffer->depth);
+    free(gbuffer->normal);
+    free(gbuffer->uv);
+    free(gbuffer->material);
+    size_t pixels      = (size_t)width * height;
+    gbuffer->width     = width;
+    gbuffer->height    = height;
+    gbuffer->depth     = (float*)malloc(pixels * sizeof(float));
+    gbuffer->normal    = (unsigned*)malloc(pixels * sizeof(unsigned));
+    gbuffer->uv        = (unsigned*)malloc(pixels * sizeof(unsigned));
+    gbuffer->material  = (unsigned short*)malloc(pixels * sizeof(unsigned short));
+}
+
+static DepthTarget GBufferDepth(const GBuffer &gbuffer)
+{
+    DepthTarget target = { gbuffer.width, gbuffer.height, gbuffer.depth };
+    return target;
+}
+
+// Projects the normal on the octahedron |x| + |y| + |z| = 1 and unfolds the
+// lower half over the corners of the upper one. It need not be normalized.
+static unsigned GBufferPackNormal(glm::vec3 n)
+{
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (l1 == 0.0f) {
+        return 0;
+    }
+    float u = n.x / l1;
+    float v = n.y / l1;
+    if (n.z < 0.0f) {
+        float fold_u = (1.0f - fabsf(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float fold_v = (1.0f - fabsf(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fold_u;
+        v = fold_v;
+    }
+    // rounded half away from zero
+    short su = (short)(glm::clamp(u, -1.0f, 1.0f) * 32767.0f + (u >= 0.0f ? 0.5f : -0.5f));
+    short sv = (short)(glm::clamp(v, -1.0f, 1.0f) * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+    return (unsigned)(unsigned short)su | ((unsigned)(unsigned short)sv << 16);
+}
+
+static glm::vec3 GBufferUnpackNormal(unsigned packed)
+{
+    float u = (short)(packed & 0xffff) / 32767.0f;
+    float v = (short)(packed >> 16)    / 32767.0f;
+    float z = 1.0f - fabsf(u) - fabsf(v);
+    float t = glm::max(-z, 0.0f);
+    u -= (u >= 0.0f) ? t : -t;
+    v -= (v >= 0.0f) ? t : -t;
+    return glm::normalize(glm::vec3(u, v, z));
+}
+
+// Texture coordinates are clamped to [0, 1], as the texture lookups do.
+static unsigned GBufferPackUV(float s, float t)
+{
+    unsigned us = (unsigned)(glm::clamp(s, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    unsigned ut = (unsigned)(glm::clamp(t, 0.0f, 1.0f) * 65535.0f + 0.5f);
+    return us | (ut << 16);
+}
+
+// Interpolates the attributes planes[0..4] (normal, then texture coordinates)
+// at the pixels x + i of row y whose bit i is set in mask, and stores them.
+static void GBufferWriteFragments(GBuffer *gbuffer, const glm::vec3 *planes, unsigned material, int x, int y, int mask)
+{
+    float  py    = y + 0.5f;
+    size_t index = (size_t)y * gbuffer->width + x;
+#ifdef DEPTH_RASTER_SSE
+    // the same pixel centers as RasterSpans()
+    const __m128 one  = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    __m128 q[5];
+    for (int k = 0; k < 5; k++) {
+        q[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[k].x), px), _mm_set1_ps(planes[k].y * py + planes[k].z));
+    }
+    // octahedral normal, see GBufferPackNormal()
+    __m128 l1 = _mm_add_ps(_mm_add_ps(_mm_andnot_ps(sign, q[0]), _mm_andnot_ps(sign, q[1])), _mm_andnot_ps(sign, q[2]));
+    __m128 inv_l1 = _mm_div_ps(one, _mm_max_ps(l1, _mm_set1_ps(FLT_MIN)));
+    __m128 u = _mm_mul_ps(q[0], inv_l1);
+    __m128 v = _mm_mul_ps(q[1], inv_l1);
+    __m128 fold_u = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, v)), _mm_and_ps(u, sign));
+    __m128 fold_v = _mm_or_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, u)), _mm_and_ps(v, sign));
+    __m128 lower  = _mm_cmplt_ps(q[2], _mm_setzero_ps());
+    u = _mm_or_ps(_mm_and_ps(lower, fold_u), _mm_andnot_ps(lower, u));
+    v = _mm_or_ps(_mm_and_ps(lower, fold_v), _mm_andnot_ps(lower, v));
+    const __m128 snorm = _mm_set1_ps(32767.0f);
+    __m128i su = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(u, _mm_set1_ps(-1.0f)), one), snorm));
+    __m128i sv = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), one), snorm));
+    __m128i normal = _mm_or_si128(_mm_and_si128(su, _mm_set1_epi32(0xffff)), _mm_slli_epi32(sv, 16));
+    // texture coordinates, see GBufferPackUV()
+    const __m128 unorm = _mm_set1_ps(65535.0f);
+    const __m128 half  = _mm_set1_ps(0.5f);
+    __m128i us = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(q[3], _mm_setzero_ps()), one), unorm), half));
+    __m128i ut = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(q[4], _mm_setzero_ps()), one), unorm), half));
+    __m128i uv = _mm_or_si128(us, _mm_slli_epi32(ut, 16));
+    if (mask == (1 << DEPTH_RASTER_LANES) - 1) {
+        _mm_storeu_si128((__m128i*)(gbuffer->normal + index), normal);
+        _mm_storeu_si128((__m128i*)(gbuffer->uv + index), uv);
+        for (int i = 0; i < DEPTH_RASTER_LANES; i++) {
+            gbuffer->material[index + i] = (unsigned short)material;
+        }
+        return;
+    }
+    unsigned normals[DEPTH_RASTER_LANES], uvs[DEPTH_RASTER_LANES];
+    _mm_storeu_si128((__m128i*)normals, normal);
+    _mm_storeu_si128((__m128i*)uvs, uv);
+    for (int i = 0; mask != 0; i++, mask >>= 1) {
+        if (mask & 1) {
+            gbuffer->normal[index + i]   = normals[i];
+            gbuffer->uv[index + i]       = uvs[i];
+            gbuffer->material[index + i] = (unsigned short)material;
+        }
+    }
+#else
+    for (int i = 0; mask != 0; i++, mask >>= 1) {
+        if ((mask & 1) == 0) {
+            continue;
+        }
+        float q[5];
+        for (int k = 0; k < 5; k++) {
+            q[k] = planes[k].x * (x + i + 0.5f) + (planes[k].y * py + planes[k].z);
+        }
+        gbuffer->normal[index + i]   = GBufferPackNormal(glm::vec3(q[0], q[1], q[2]));
+        gbuffer->uv[index + i]       = GBufferPackUV(q[3], q[4]);
+        gbuffer->material[index + i] = (unsigned short)material;
+    }
+#endif
+}
+
+// Rasterizes a triangle in screen space (as DepthRasterTriangle()) into the
+// G-buffer, with one normal and texture coordinate per vertex. Like Close2GL
+// the attributes are interpolated linearly in screen space, and only the
+// fragments that pass the depth test write them. Returns how many did.
+static unsigned GBufferRasterTriangle(GBuffer *gbuffer, const glm::vec3 *screen, const glm::vec3 *normals,
+                                      const glm::vec2 *uvs, unsigned material, float facing)
+{
+    RasterSetup setup;
+    if (!RasterSetupTriangle(gbuffer->width, gbuffer->height, screen[0], screen[1], screen[2], facing, &setup)) {
+        return 0;
+    }
+    glm::vec3 planes[5];
+    for (int k = 0; k < 3; k++) {
+        planes[k] = RasterPlane(setup, normals[0][k], normals[1][k], normals[2][k]);
+    }
+    planes[3] = RasterPlane(setup, uvs[0].x, uvs[1].x, uvs[2].x);
+    planes[4] = RasterPlane(setup, uvs[0].y, uvs[1].y, uvs[2].y);
+
+    unsigned written = 0;
+    auto fragments = [&](int x, int y, int mask) {
+        written += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        GBufferWriteFragments(gbuffer, planes, material, x, y, mask);
+    };
+    RasterSpans(GBufferDepth(*gbuffer), setup, RasterPlane(setup, screen[0].z, screen[1].z, screen[2].z), fragments);
+    return written;
+}
+
+// Ambient, diffuse and specular intensity of the Phong model of triangles.frag
+// at one pixel: Kd = Ks = 1 and q = 32.
+static float GBufferPhong(const GBufferLighting &lighting, float px, float py, float z, unsigned packed_normal)
+{
+    glm::vec4 world = lighting.screen_to_world * glm::vec4(px, py, z, 1.0f);
+    glm::vec3 view  = glm::normalize(lighting.camera - glm::vec3(world) / world.w);
+    glm::vec3 n     = GBufferUnpackNormal(packed_normal);
+    float     ndotl = glm::dot(n, lighting.light);
+    glm::vec3 r     = -lighting.light + 2.0f * n * ndotl;
+    float     spec  = glm::max(glm::dot(r, view), 0.0f);
+    for (int k = 0; k < GBUFFER_SHINE_SQUARINGS; k++) {
+        spec *= spec;
+    }
+    return lighting.ambient + glm::max(ndotl, 0.0f) + spec;
+}
+
+// Planes of one row of pixels, and where its colors go.
+struct GBufferRow {
+    const float          *depth;
+    const unsigned       *normal;
+    const unsigned       *uv;
+    const unsigned short *material;
+    unsigned short       *rgb; // lighting.rgb_stride unsigned shorts between the pixels
+};
+
+// Base color times intensity, written as linear light.
+static void GBufferWritePixel(const GBufferLighting &lighting, unsigned uv, unsigned material, unsigned short *rgb,
+                              float intensity)
+{
+    glm::vec3 base;
+    const GBufferTexture &texture = lighting.texture;
+    if (texture.data || texture.blocks.format != BLOCK_FORMAT_NONE) {
+        float s = (uv & 0xffff) / 65535.0f * (texture.width  - 1);
+        float t = (uv >> 16)    / 65535.0f * (texture.height - 1);
+        if (texture.bilinear) {
+            // the average of the four texels around, like getTextureColourBilinear()
+            int x0 = (int)floorf(s), x1 = (int)ceilf(s);
+            int y0 = (int)floorf(t), y1 = (int)ceilf(t);
+            for (int ch = 0; ch < 3; ch++) {
+                int sum = GBufferTexel(texture, x0, y0)[ch] + GBufferTexel(texture, x0, y1)[ch] +
+                          GBufferTexel(texture, x1, y0)[ch] + GBufferTexel(texture, x1, y1)[ch];
+                base[ch] = (sum / 4) / 255.0f;
+            }
+        } else {
+            const unsigned char *texel = GBufferTexel(texture, (int)roundf(s), (int)roundf(t));
+            base = glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+        }
+    } else {
+        base = lighting.materials[material];
+    }
+    glm::vec3 color = base * intensity;
+    rgb[0] = DisplayLinear(color.r);
+    rgb[1] = DisplayLinear(color.g);
+    rgb[2] = DisplayLinear(color.b);
+}
+
+#ifdef DEPTH_RASTER_SSE
+static inline __m128 GBufferDot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+// Row of the matrix m applied to (x, y, z, 1), four points at a time.
+static inline __m128 GBufferTransform(const glm::mat4 &m, int row, __m128 x, __m128 y, __m128 z)
+{
+    __m128 r = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][row]), x), _mm_mul_ps(_mm_set1_ps(m[1][row]), y));
+    return _mm_add_ps(_mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(m[2][row]), z)), _mm_set1_ps(m[3][row]));
+}
+#endif
+
+#ifdef GBUFFER_AVX2
+static inline __m256 GBufferDot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+static inline __m256 GBufferTransform8(const glm::mat4 &m, int row, __m256 x, __m256 y, __m256 z)
+{
+    __m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(m[0][row]), x), _mm256_mul_ps(_mm256_set1_ps(m[1][row]), y));
+    return _mm256_add_ps(_mm256_add_ps(r, _mm256_mul_ps(_mm256_set1_ps(m[2][row]), z)), _mm256_set1_ps(m[3][row]));
+}
+
+// One channel of the material colors of 8 pixels times their intensities,
+// as GBufferWritePixel() writes it.
+static inline __m256i GBufferLinearChannel8(const GBufferLighting &lighting, __m256i index, __m256 covered,
+                                            __m256 intensity)
+{
+    __m256 base  = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), &lighting.materials[0].x, index, covered, 4);
+    __m256 color = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(base, intensity), _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(color, _mm256_set1_ps(DISPLAY_LINEAR_MAX)), _mm256_set1_ps(0.5f)));
+}
+#endif
+
+// Lights the covered pixels of row y, width pixels long, eight or four pixels
+// at a time when AVX2 or SSE is available.
+static void GBufferLightRow(const GBufferLighting &lighting, int y, int width, GBufferRow row)
+{
+    float py = y + 0.5f;
+    int   x  = 0;
+#ifdef GBUFFER_AVX2
+    {
+        // the same steps as the SSE loop below, one register of 8 pixels
+        const glm::mat4 &m = lighting.screen_to_world;
+        const __m256 lanes = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+        const __m256 one   = _mm256_set1_ps(1.0f);
+        const __m256 zero  = _mm256_setzero_ps();
+        const __m256 sign  = _mm256_set1_ps(-0.0f);
+        const __m256 scale = _mm256_set1_ps(1.0f / 32767.0f);
+        __m256 vpy = _mm256_set1_ps(py);
+        __m256 lx  = _mm256_set1_ps(lighting.light.x);
+        __m256 ly  = _mm256_set1_ps(lighting.light.y);
+        __m256 lz  = _mm256_set1_ps(lighting.light.z);
+        for (; x + GBUFFER_AVX2_LANES <= width; x += GBUFFER_AVX2_LANES) {
+            __m256 z         = _mm256_loadu_ps(row.depth + x);
+            __m256 in_front  = _mm256_cmp_ps(z, one, _CMP_LE_OQ);
+            int    covered   = _mm256_movemask_ps(in_front);
+            if (covered == 0) {
+                continue;
+            }
+            __m256 px = _mm256_add_ps(_mm256_set1_ps(x + 0.5f), lanes);
+            __m256 w  = _mm256_div_ps(one, GBufferTransform8(m, 3, px, vpy, z));
+            __m256 vx = _mm256_sub_ps(_mm256_set1_ps(lighting.camera.x), _mm256_mul_ps(GBufferTransform8(m, 0, px, vpy, z), w));
+            __m256 vy = _mm256_sub_ps(_mm256_set1_ps(lighting.camera.y), _mm256_mul_ps(GBufferTransform8(m, 1, px, vpy, z), w));
+            __m256 vz = _mm256_sub_ps(_mm256_set1_ps(lighting.camera.z), _mm256_mul_ps(GBufferTransform8(m, 2, px, vpy, z), w));
+            __m256 inv_length = _mm256_div_ps(one, _mm256_sqrt_ps(GBufferDot8(vx, vy, vz, vx, vy, vz)));
+            vx = _mm256_mul_ps(vx, inv_length);
+            vy = _mm256_mul_ps(vy, inv_length);
+            vz = _mm256_mul_ps(vz, inv_length);
+
+            __m256i packed = _mm256_loadu_si256((const __m256i*)(row.normal + x));
+            __m256  nx = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16)), scale);
+            __m256  ny = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(packed, 16)), scale);
+            __m256  nz = _mm256_sub_ps(_mm256_sub_ps(one, _mm256_andnot_ps(sign, nx)), _mm256_andnot_ps(sign, ny));
+            __m256  t  = _mm256_max_ps(_mm256_sub_ps(zero, nz), zero);
+            nx = _mm256_sub_ps(nx, _mm256_or_ps(t, _mm256_and_ps(nx, sign)));
+            ny = _mm256_sub_ps(ny, _mm256_or_ps(t, _mm256_and_ps(ny, sign)));
+            inv_length = _mm256_div_ps(one, _mm256_sqrt_ps(GBufferDot8(nx, ny, nz, nx, ny, nz)));
+            nx = _mm256_mul_ps(nx, inv_length);
+            ny = _mm256_mul_ps(ny, inv_length);
+            nz = _mm256_mul_ps(nz, inv_length);
+
+            __m256 ndotl = GBufferDot8(nx, ny, nz, lx, ly, lz);
+            __m256 twice = _mm256_add_ps(ndotl, ndotl);
+            __m256 rx    = _mm256_sub_ps(_mm256_mul_ps(nx, twice), lx);
+            __m256 ry    = _mm256_sub_ps(_mm256_mul_ps(ny, twice), ly);
+            __m256 rz    = _mm256_sub_ps(_mm256_mul_ps(nz, twice), lz);
+            __m256 spec  = _mm256_max_ps(GBufferDot8(rx, ry, rz, vx, vy, vz), zero);
+            for (int k = 0; k < GBUFFER_SHINE_SQUARINGS; k++) {
+                spec = _mm256_mul_ps(spec, spec);
+            }
+            __m256 intensity = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(lighting.ambient), _mm256_max_ps(ndotl, zero)), spec);
+
+            if (lighting.texture.data || lighting.texture.blocks.format != BLOCK_FORMAT_NONE) {
+                float intensities[GBUFFER_AVX2_LANES];
+                _mm256_storeu_ps(intensities, intensity);
+                for (int i = 0; i < GBUFFER_AVX2_LANES; i++) {
+                    if (covered & (1 << i)) {
+                        GBufferWritePixel(lighting, row.uv[x + i], row.material[x + i],
+                                          row.rgb + (size_t)(x + i) * lighting.rgb_stride, intensities[i]);
+                    }
+                }
+                continue;
+            }
+            // material colors gathered, 3 floats apart; the empty pixels hold
+            // no material and are not read
+            __m256i index = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(row.material + x)));
+            index = _mm256_add_epi32(index, _mm256_add_epi32(index, index));
+            __m256i r = GBufferLinearChannel8(lighting, index, in_front, intensity);
+            __m256i g = GBufferLinearChannel8(lighting, _mm256_add_epi32(index, _mm256_set1_epi32(1)), in_front, intensity);
+            __m256i b = GBufferLinearChannel8(lighting, _mm256_add_epi32(index, _mm256_set1_epi32(2)), in_front, intensity);
+            int rgb[3][GBUFFER_AVX2_LANES];
+            _mm256_storeu_si256((__m256i*)rgb[0], r);
+            _mm256_storeu_si256((__m256i*)rgb[1], g);
+            _mm256_storeu_si256((__m256i*)rgb[2], b);
+            for (int i = 0; i < GBUFFER_AVX2_LANES; i++) {
+                if (covered & (1 << i)) {
+                    unsigned short *out = row.rgb + (size_t)(x + i) * lighting.rgb_stride;
+                    out[0] = (unsigned short)rgb[0][i];
+                    out[1] = (unsigned short)rgb[1][i];
+                    out[2] = (unsigned short)rgb[2][i];
+                }
+            }
+        }
+    }
+#endif
+#ifdef DEPTH_RASTER_SSE
+    const glm::mat4 &m = lighting.screen_to_world;
+    const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128 one   = _mm_set1_ps(1.0f);
+    const __m128 zero  = _mm_setzero_ps();
+    const __m128 sign  = _mm_set1_ps(-0.0f);
+    const __m128 scale = _mm_set1_ps(1.0f / 32767.0f);
+    __m128 vpy = _mm_set1_ps(py);
+    __m128 lx  = _mm_set1_ps(lighting.light.x);
+    __m128 ly  = _mm_set1_ps(lighting.light.y);
+    __m128 lz  = _mm_set1_ps(lighting.light.z);
+    for (; x + DEPTH_RASTER_LANES <= width; x += DEPTH_RASTER_LANES) {
+        __m128 z       = _mm_loadu_ps(row.depth + x);
+        int    covered = _mm_movemask_ps(_mm_cmple_ps(z, one));
+        if (covered == 0) {
+            continue;
+        }
+        // world position and direction to the camera
+        __m128 px = _mm_add_ps(_mm_set1_ps(x + 0.5f), lanes);
+        __m128 w  = _mm_div_ps(one, GBufferTransform(m, 3, px, vpy, z));
+        __m128 vx = _mm_sub_ps(_mm_set1_ps(lighting.camera.x), _mm_mul_ps(GBufferTransform(m, 0, px, vpy, z), w));
+        __m128 vy = _mm_sub_ps(_mm_set1_ps(lighting.camera.y), _mm_mul_ps(GBufferTransform(m, 1, px, vpy, z), w));
+        __m128 vz = _mm_sub_ps(_mm_set1_ps(lighting.camera.z), _mm_mul_ps(GBufferTransform(m, 2, px, vpy, z), w));
+        __m128 inv_length = _mm_div_ps(one, _mm_sqrt_ps(GBufferDot(vx, vy, vz, vx, vy, vz)));
+        vx = _mm_mul_ps(vx, inv_length);
+        vy = _mm_mul_ps(vy, inv_length);
+        vz = _mm_mul_ps(vz, inv_length);
+
+        // normal: unfold the octahedron and normalize
+        __m128i packed = _mm_loadu_si128((const __m128i*)(row.normal + x));
+        __m128  nx = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(packed, 16), 16)), scale);
+        __m128  ny = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(packed, 16)), scale);
+        __m128  nz = _mm_sub_ps(_mm_sub_ps(one, _mm_andnot_ps(sign, nx)), _mm_andnot_ps(sign, ny));
+        __m128  t  = _mm_max_ps(_mm_sub_ps(zero, nz), zero);
+        nx = _mm_sub_ps(nx, _mm_or_ps(t, _mm_and_ps(nx, sign)));
+        ny = _mm_sub_ps(ny, _mm_or_ps(t, _mm_and_ps(ny, sign)));
+        inv_length = _mm_div_ps(one, _mm_sqrt_ps(GBufferDot(nx, ny, nz, nx, ny, nz)));
+        nx = _mm_mul_ps(nx, inv_length);
+        ny = _mm_mul_ps(ny, inv_length);
+        nz = _mm_mul_ps(nz, inv_length);
+
+        // reflection of the light, r = 2 n (n . l) - l
+        __m128 ndotl = GBufferDot(nx, ny, nz, lx, ly, lz);
+        __m128 twice = _mm_add_ps(ndotl, ndotl);
+        __m128 rx    = _mm_sub_ps(_mm_mul_ps(nx, twice), lx);
+        __m128 ry    = _mm_sub_ps(_mm_mul_ps(ny, twice), ly);
+        __m128 rz    = _mm_sub_ps(_mm_mul_ps(nz, twice), lz);
+        __m128 spec  = _mm_max_ps(GBufferDot(rx, ry, rz, vx, vy, vz), zero);
+        for (int k = 0; k < GBUFFER_SHINE_SQUARINGS; k++) {
+            spec = _mm_mul_ps(spec, spec);
+        }
+        float intensity[DEPTH_RASTER_LANES];
+        _mm_storeu_ps(intensity, _mm_add_ps(_mm_add_ps(_mm_set1_ps(lighting.ambient), _mm_max_ps(ndotl, zero)), spec));
+        for (int i = 0; i < DEPTH_RASTER_LANES; i++) {
+            if (covered & (1 << i)) {
+                GBufferWritePixel(lighting, row.uv[x + i], row.material[x + i],
+                                  row.rgb + (size_t)(x + i) * lighting.rgb_stride, intensity[i]);
+            }
+        }
+    }
+#endif
+    for (; x < width; x++) {
+        if (row.depth[x] <= 1.0f) {
+            GBufferWritePixel(lighting, row.uv[x], row.material[x], row.rgb + (size_t)x * lighting.rgb_stride,
+                              GBufferPhong(lighting, x + 0.5f, py, row.depth[x], row.normal[x]));
+        }
+    }
+}
+
+// Lights every covered pixel of the G-buffer into lighting.rgb, the rows split
+// in bands between up to max_threads threads. Empty pixels are left alone.
+static void GBufferLight(const GBuffer &gbuffer, const GBufferLighting &lighting, int max_threads)
+{
+    DisplayTable(); // built before the threads read it
+    ParallelForRowBands(gbuffer.width, gbuffer.height, max_threads, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            size_t     index = (size_t)y * gbuffer.width;
+            GBufferRow row   = { gbuffer.depth + index, gbuffer.normal + index, gbuffer.uv + index,
+                                 gbuffer.material + index, lighting.rgb + index * lighting.rgb_stride };
+            GBufferLightRow(lighting, y, gbuffer.width, row);
+        }
+    });
+}
+
+#endif // _GBUFFER_H
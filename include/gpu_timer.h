@@ -0,0 +1,102 @@
+#ifndef _GPU_TIMER_H
+#define _GPU_TIMER_H
+
+#include <cstdio>
+
+// GPU timings with GL_TIME_ELAPSED queries. Each frame owns one query per
+// section and the ring keeps GPU_TIMER_FRAMES frames in flight, so a result is
+// only read back when its slot is about to be reused, several frames after it
+// was issued. Results that are still not available at that point are dropped
+// instead of stalling the pipeline.
+#define GPU_TIMER_FRAMES   4
+#define GPU_TIMER_SECTIONS 3
+
+#define GPU_TIMER_DRAW   0
+#define GPU_TIMER_UPLOAD 1
+#define GPU_TIMER_SWAP   2
+
+struct GpuTimer {
+    bool   enabled;
+    int    frame;    // ring slot of the current frame
+    int    active;   // section with an open query, -1 if none
+    GLuint queries[GPU_TIMER_FRAMES][GPU_TIMER_SECTIONS];
+    bool   issued [GPU_TIMER_FRAMES][GPU_TIMER_SECTIONS];
+    double elapsed_ms[GPU_TIMER_SECTIONS]; // accumulated since the last report
+    int    samples   [GPU_TIMER_SECTIONS];
+};
+
+static void GpuTimerInit(GpuTimer *timer)
+{
+    *timer = GpuTimer();
+    timer->active = -1;
+
+    // drivers without a usable timer report zero counter bits
+    GLint bits = 0;
+    glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+    timer->enabled = (bits > 0);
+    if (!timer->enabled) {
+        fprintf(stderr, "WARNING: GL_TIME_ELAPSED queries not supported, GPU timings disabled.\n");
+        return;
+    }
+    glGenQueries(GPU_TIMER_FRAMES * GPU_TIMER_SECTIONS, &timer->queries[0][0]);
+}
+
+static void GpuTimerBegin(GpuTimer *timer, int section)
+{
+    // time elapsed queries cannot be nested and each section is timed once per frame
+    if (!timer->enabled || timer->active != -1 || timer->issued[timer->frame][section]) {
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, timer->queries[timer->frame][section]);
+    timer->active = section;
+}
+
+static void GpuTimerEnd(GpuTimer *timer)
+{
+    if (!timer->enabled || timer->active == -1) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    timer->issued[timer->frame][timer->active] = true;
+    timer->active = -1;
+}
+
+// Called once per frame, after the swap. Collects the results of the oldest
+// frame in the ring and hands its slot to the next frame.
+static void GpuTimerNextFrame(GpuTimer *timer)
+{
+    if (!timer->enabled) {
+        return;
+    }
+    timer->frame = (timer->frame + 1) % GPU_TIMER_FRAMES;
+    for (int section = 0; section < GPU_TIMER_SECTIONS; section++) {
+        if (!timer->issued[timer->frame][section]) {
+            continue;
+        }
+        GLuint query = timer->queries[timer->frame][section];
+        GLint  available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed_ns = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+            timer->elapsed_ms[section] += elapsed_ns / 1.0e6;
+            timer->samples[section]    += 1;
+        }
+        timer->issued[timer->frame][section] = false;
+    }
+}
+
+// Average time of a section in milliseconds since the last call, -1 when the
+// section was not measured in that interval.
+static double GpuTimerAverage(GpuTimer *timer, int section)
+{
+    double average = -1.0;
+    if (timer->samples[section] > 0) {
+        average = timer->elapsed_ms[section] / timer->samples[section];
+    }
+    timer->elapsed_ms[section] = 0.0;
+    timer->samples[section]    = 0;
+    return average;
+}
+
+#endif // _GPU_TIMER_H
@@ -0,0 +1,120 @@
+#ifndef _HIZ_H
+#define _HIZ_H
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/common.hpp>
+
+#include <cfloat>
+#include <vector>
+
+// Hierarchical Z pyramid: level 0 holds the farthest depth of each
+// HIZ_TILE_SIZE x HIZ_TILE_SIZE tile of the depth plane and every following
+// level the farthest of 2x2 texels of the previous one. A box whose nearest
+// depth is behind the farthest depth of every texel it covers is hidden.
+// Depth grows away from the camera and empty pixels hold FLT_MAX, so they
+// never hide anything.
+#define HIZ_TILE_SIZE     8
+#define HIZ_MAX_LEVELS    16
+#define HIZ_MAX_TEXELS    4     // texels tested along each axis, the level is chosen to fit
+#define HIZ_DEPTH_EPSILON 1e-5f // incremental interpolation may undershoot the vertex depths
+
+struct HizPyramid {
+    int                levels;
+    int                width[HIZ_MAX_LEVELS];
+    int                height[HIZ_MAX_LEVELS];
+    std::vector<float> depth[HIZ_MAX_LEVELS];
+};
+
+// Builds the pyramid from a depth plane of width x height values, stride
+// floats apart (the z of an array of pixels), row j starting at j * width.
+static void HizBuild(HizPyramid *hiz, const float *depth, int stride, int width, int height)
+{
+    int w = (width  + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    int h = (height + HIZ_TILE_SIZE - 1) / HIZ_TILE_SIZE;
+    hiz->levels    = 1;
+    hiz->width[0]  = w;
+    hiz->height[0] = h;
+    hiz->depth[0].assign((size_t)w * h, -FLT_MAX);
+    float *level0 = hiz->depth[0].data();
+    for (int j = 0; j < height; j++) {
+        const float *row   = depth + (size_t)j * width * stride;
+        float       *tiles = level0 + (size_t)(j / HIZ_TILE_SIZE) * w;
+        for (int i = 0; i < width; i++) {
+            float z = row[(size_t)i * stride];
+            float *tile = &tiles[i / HIZ_TILE_SIZE];
+            if (z > *tile) {
+                *tile = z;
+            }
+        }
+    }
+    while ((w > 1 || h > 1) && hiz->levels < HIZ_MAX_LEVELS) {
+        int l  = hiz->levels;
+        int pw = w;
+        int ph = h;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+        hiz->width[l]  = w;
+        hiz->height[l] = h;
+        hiz->depth[l].resize((size_t)w * h);
+        const float *prev = hiz->depth[l-1].data();
+        for (int j = 0; j < h; j++) {
+            for (int i = 0; i < w; i++) {
+                int i0 = 2 * i, i1 = glm::min(2 * i + 1, pw - 1);
+                int j0 = 2 * j, j1 = glm::min(2 * j + 1, ph - 1);
+                hiz->depth[l][(size_t)j * w + i] = glm::max(glm::max(prev[(size_t)j0 * pw + i0], prev[(size_t)j0 * pw + i1]),
+                                                            glm::max(prev[(size_t)j1 * pw + i0], prev[(size_t)j1 * pw + i1]));
+            }
+        }
+        hiz->levels += 1;
+    }
+}
+
+// True when the box min..max is hidden. matrix takes the box to screen space
+// (viewport * projection * view * model), where x and y are pixels and z the
+// depth stored in the plane the pyramid was built from.
+static bool HizOccluded(const HizPyramid *hiz, glm::mat4 matrix, glm::vec3 min, glm::vec3 max)
+{
+    if (hiz->levels == 0) {
+        return false;
+    }
+    glm::vec3 screen_min( FLT_MAX);
+    glm::vec3 screen_max(-FLT_MAX);
+    for (int c = 0; c < 8; c++) {
+        glm::vec4 corner = matrix * glm::vec4((c & 1) ? max.x : min.x, (c & 2) ? max.y : min.y, (c & 4) ? max.z : min.z, 1.0f);
+        if (corner.w <= 0.0f) {
+            return false; // crosses the plane of the camera, the projection is unbounded
+        }
+        glm::vec3 p = glm::vec3(corner) / corner.w;
+        screen_min = glm::min(screen_min, p);
+        screen_max = glm::max(screen_max, p);
+    }
+    // one pixel of margin for the rounding of the rasterizer
+    float width  = (float)(hiz->width[0]  * HIZ_TILE_SIZE);
+    float height = (float)(hiz->height[0] * HIZ_TILE_SIZE);
+    int x0 = (int)glm::clamp(floorf(screen_min.x) - 1.0f, 0.0f, width);
+    int y0 = (int)glm::clamp(floorf(screen_min.y) - 1.0f, 0.0f, height);
+    int x1 = (int)glm::clamp(floorf(screen_max.x) + 1.0f, -1.0f, width  - 1.0f);
+    int y1 = (int)glm::clamp(floorf(screen_max.y) + 1.0f, -1.0f, height - 1.0f);
+    if (x0 > x1 || y0 > y1) {
+        return false;
+    }
+    x0 /= HIZ_TILE_SIZE; x1 /= HIZ_TILE_SIZE;
+    y0 /= HIZ_TILE_SIZE; y1 /= HIZ_TILE_SIZE;
+    int l = 0;
+    while (l + 1 < hiz->levels && (x1 - x0 >= HIZ_MAX_TEXELS || y1 - y0 >= HIZ_MAX_TEXELS)) {
+        x0 /= 2; x1 /= 2;
+        y0 /= 2; y1 /= 2;
+        l  += 1;
+    }
+    float farthest = -FLT_MAX;
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            farthest = glm::max(farthest, hiz->depth[l][(size_t)j * hiz->width[l] + i]);
+        }
+    }
+    return screen_min.z > farthest + HIZ_DEPTH_EPSILON;
+}
+
+#endif // _HIZ_H
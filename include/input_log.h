@@ -0,0 +1,161 @@
+#ifndef _INPUT_LOG_H
+#define _INPUT_LOG_H
+
+#include <cstdio>
+#include <cstring>
+
+// Binary log of the input of an interactive session, so it can be replayed
+// frame by frame. The file starts with INPUT_LOG_MAGIC and a version number,
+// followed by the events in the order they happened:
+//
+//   u32 frame, f32 seconds since the start, u8 type, u16 size, size bytes of payload
+//
+// The frame is the index of the frame during which the event was handled;
+// replay dispatches it at the same point of the same frame, which makes the
+// camera motion (a fixed step per frame) identical to the recorded session.
+#define INPUT_LOG_MAGIC       "CMPLOG"
+#define INPUT_LOG_VERSION     1
+#define INPUT_LOG_MAX_PAYLOAD 512
+
+#define INPUT_LOG_OFF    0
+#define INPUT_LOG_RECORD 1
+#define INPUT_LOG_REPLAY 2
+
+#define INPUT_EVENT_KEY          1
+#define INPUT_EVENT_MOUSE_BUTTON 2
+#define INPUT_EVENT_CURSOR       3
+#define INPUT_EVENT_RESIZE       4
+#define INPUT_EVENT_UI_STATE     5 // payload defined by the application
+#define INPUT_EVENT_MODEL        6 // payload is the file name
+#define INPUT_EVENT_TEXTURE      7 // payload is the file name
+#define INPUT_EVENT_END          8 // last frame of the session
+
+struct InputKeyEvent {
+    int key;
+    int action;
+    int mods;
+};
+
+struct InputButtonEvent {
+    int   button;
+    int   action;
+    int   mods;
+    float x; // cursor position when the button changed
+    float y;
+};
+
+struct InputCursorEvent {
+    float x;
+    float y;
+};
+
+struct InputResizeEvent {
+    int width;
+    int height;
+};
+
+struct InputEvent {
+    unsigned       frame;
+    float          time;
+    unsigned char  type;
+    unsigned short size;
+    unsigned char  payload[INPUT_LOG_MAX_PAYLOAD + 1]; // room for a terminating zero
+};
+
+struct InputLog {
+    FILE      *fp;
+    int        mode;
+    bool       dispatching; // set while replayed events are handled
+    unsigned   frame;       // current frame
+    bool       has_next;    // replay: next holds an event not dispatched yet
+    InputEvent next;
+};
+
+static bool InputLogReadEvent(InputLog *log, InputEvent *event)
+{
+    if (fread(&event->frame, sizeof(event->frame), 1, log->fp) != 1 ||
+        fread(&event->time,  sizeof(event->time),  1, log->fp) != 1 ||
+        fread(&event->type,  sizeof(event->type),  1, log->fp) != 1 ||
+        fread(&event->size,  sizeof(event->size),  1, log->fp) != 1 ||
+        event->size > INPUT_LOG_MAX_PAYLOAD ||
+        fread(event->payload, 1, event->size, log->fp) != event->size) {
+        return false;
+    }
+    return true;
+}
+
+static bool InputLogOpen(InputLog *log, const char *filename, int mode)
+{
+    *log = InputLog();
+    log->fp = fopen(filename, (mode == INPUT_LOG_RECORD) ? "wb" : "rb");
+    if (!log->fp) {
+        fprintf(stderr, "ERROR: unable to open file [%s]!\n", filename);
+        return false;
+    }
+    unsigned version = INPUT_LOG_VERSION;
+    if (mode == INPUT_LOG_RECORD) {
+        fwrite(INPUT_LOG_MAGIC, 1, sizeof(INPUT_LOG_MAGIC), log->fp);
+        fwrite(&version, sizeof(version), 1, log->fp);
+    } else {
+        char magic[sizeof(INPUT_LOG_MAGIC)];
+        if (fread(magic, 1, sizeof(magic), log->fp) != sizeof(magic) ||
+            memcmp(magic, INPUT_LOG_MAGIC, sizeof(magic)) != 0 ||
+            fread(&version, sizeof(version), 1, log->fp) != 1 || version != INPUT_LOG_VERSION) {
+            fprintf(stderr, "ERROR: [%s] is not an input log of version %d.\n", filename, INPUT_LOG_VERSION);
+            fclose(log->fp);
+            log->fp = NULL;
+            return false;
+        }
+        log->has_next = InputLogReadEvent(log, &log->next);
+    }
+    log->mode = mode;
+    return true;
+}
+
+static void InputLogWrite(InputLog *log, unsigned char type, const void *payload, unsigned short size, float time)
+{
+    if (log->mode != INPUT_LOG_RECORD) {
+        return;
+    }
+    fwrite(&log->frame, sizeof(log->frame), 1, log->fp);
+    fwrite(&time,       sizeof(time),       1, log->fp);
+    fwrite(&type,       sizeof(type),       1, log->fp);
+    fwrite(&size,       sizeof(size),       1, log->fp);
+    fwrite(payload, 1, size, log->fp);
+}
+
+// Size of the payload of the events of type, 0 for the file names and for the
+// payloads defined by the application.
+static unsigned short InputEventSize(unsigned char type)
+{
+    switch (type) {
+      case INPUT_EVENT_KEY:          return sizeof(InputKeyEvent);
+      case INPUT_EVENT_MOUSE_BUTTON: return sizeof(InputButtonEvent);
+      case INPUT_EVENT_CURSOR:       return sizeof(InputCursorEvent);
+      case INPUT_EVENT_RESIZE:       return sizeof(InputResizeEvent);
+    }
+    return 0;
+}
+
+// Replay: returns the next event of the current frame, false once all of them
+// were returned.
+static bool InputLogNext(InputLog *log, InputEvent *event)
+{
+    if (log->mode != INPUT_LOG_REPLAY || !log->has_next || log->next.frame > log->frame) {
+        return false;
+    }
+    *event = log->next;
+    log->has_next = InputLogReadEvent(log, &log->next);
+    return true;
+}
+
+static void InputLogClose(InputLog *log)
+{
+    if (log->fp) {
+        fclose(log->fp);
+    }
+    log->fp   = NULL;
+    log->mode = INPUT_LOG_OFF;
+}
+
+#endif // _INPUT_LOG_H
@@ -0,0 +1,243 @@
+#ifndef _MESHLET_H
+#define _MESHLET_H
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Meshlets are the largest subtrees of a triangle BVH that fit in
+// MESHLET_MAX_TRIANGLES triangles and MESHLET_MAX_VERTICES distinct vertex
+// positions. Each one keeps a bounding sphere and a cone bounding the front
+// facing normals of its triangles, so a whole meshlet can be rejected when all
+// of its triangles face away from the camera. The subtrees are collapsed into
+// leaves of a new hierarchy whose leaves are meshlets (offset = meshlet index,
+// count = 1), so BvhCullFrustum() returns ranges of meshlets.
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet {
+    glm::vec3 min;         // bounding box
+    glm::vec3 max;
+    glm::vec3 center;      // bounding sphere
+    float     radius;
+    glm::vec3 cone_axis;
+    float     cone_cutoff; // sine of the cone half angle, 1 if it can never face away
+    unsigned  first;       // triangle range
+    unsigned  count;
+};
+
+struct MeshletBuilder {
+    const BvhNode        *nodes;     // triangle hierarchy
+    const glm::vec3      *positions; // three per triangle, in hierarchy order
+    const glm::vec3      *normals;   // front facing normal of each triangle, zero if degenerate
+    std::vector<Meshlet> *meshlets;
+    std::vector<BvhNode> *meshlet_nodes;
+};
+
+static bool MeshletLess(glm::vec3 a, glm::vec3 b)
+{
+    return (a.x != b.x) ? a.x < b.x : (a.y != b.y) ? a.y < b.y : a.z < b.z;
+}
+
+static unsigned MeshletCountVertices(const glm::vec3 *positions, unsigned first, unsigned count)
+{
+    glm::vec3 vertices[3 * MESHLET_MAX_TRIANGLES];
+    std::copy(positions + 3 * first, positions + 3 * (first + count), vertices);
+    std::sort(vertices, vertices + 3 * count, MeshletLess);
+    unsigned unique = 0;
+    for (unsigned i = 0; i < 3 * count; i++) {
+        if (i == 0 || vertices[i] != vertices[i-1]) {
+            unique += 1;
+        }
+    }
+    return unique;
+}
+
+static Meshlet MeshletCreate(const MeshletBuilder *builder, const BvhNode &node, unsigned first, unsigned count)
+{
+    Meshlet meshlet;
+    meshlet.first  = first;
+    meshlet.count  = count;
+    meshlet.min    = node.min;
+    meshlet.max    = node.max;
+    meshlet.center = 0.5f * (node.min + node.max);
+    meshlet.radius = 0.0f;
+    for (unsigned i = 3 * first; i < 3 * (first + count); i++) {
+        meshlet.radius = glm::max(meshlet.radius, glm::length(builder->positions[i] - meshlet.center));
+    }
+
+    // the axis is the average normal and the cone must contain every normal
+    glm::vec3 sum(0.0f);
+    bool degenerate = false;
+    for (unsigned i = first; i < first + count; i++) {
+        sum += builder->normals[i];
+        degenerate = degenerate || builder->normals[i] == glm::vec3(0.0f);
+    }
+    float length = glm::length(sum);
+    meshlet.cone_axis   = (length > 0.0f) ? sum / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    meshlet.cone_cutoff = 1.0f;
+    if (degenerate || length <= 0.0f) {
+        return meshlet;
+    }
+    float min_dot = 1.0f;
+    for (unsigned i = first; i < first + count; i++) {
+        min_dot = glm::min(min_dot, glm::dot(builder->normals[i], meshlet.cone_axis));
+    }
+    // cones wider than about 84 degrees are hardly ever entirely back facing
+    if (min_dot > 0.1f) {
+        meshlet.cone_cutoff = sqrtf(1.0f - min_dot * min_dot);
+    }
+    return meshlet;
+}
+
+static void MeshletBuildNode(MeshletBuilder *builder, unsigned index)
+{
+    const BvhNode *nodes = builder->nodes;
+    unsigned leftmost = index;
+    while (nodes[leftmost].count == 0) {
+        leftmost = leftmost + 1;
+    }
+    unsigned rightmost = index;
+    while (nodes[rightmost].count == 0) {
+        rightmost = nodes[rightmost].offset;
+    }
+    unsigned first = nodes[leftmost].offset;
+    unsigned count = nodes[rightmost].offset + nodes[rightmost].count - first;
+
+    unsigned node = builder->meshlet_nodes->size();
+    builder->meshlet_nodes->push_back(nodes[index]);
+    if (nodes[index].count > 0 || (count <= MESHLET_MAX_TRIANGLES &&
+        MeshletCountVertices(builder->positions, first, count) <= MESHLET_MAX_VERTICES)) {
+        (*builder->meshlet_nodes)[node].offset = builder->meshlets->size();
+        (*builder->meshlet_nodes)[node].count  = 1;
+        builder->meshlets->push_back(MeshletCreate(builder, nodes[index], first, count));
+        return;
+    }
+    MeshletBuildNode(builder, index + 1);
+    (*builder->meshlet_nodes)[node].offset = builder->meshlet_nodes->size();
+    MeshletBuildNode(builder, nodes[index].offset);
+}
+
+// Index of the cube face the normal points to, so that the normals of a group
+// are at most about 55 degrees away from its axis.
+static unsigned MeshletNormalGroup(glm::vec3 normal)
+{
+    glm::vec3 a = glm::abs(normal);
+    if (a.x >= a.y && a.x >= a.z) {
+        return normal.x >= 0.0f ? 0 : 1;
+    }
+    if (a.y >= a.z) {
+        return normal.y >= 0.0f ? 2 : 3;
+    }
+    return normal.z >= 0.0f ? 4 : 5;
+}
+
+// Splits the triangles into meshlets and returns the hierarchy over them,
+// allocated with malloc(). positions holds three vertices per triangle and
+// normals the front facing normal of each triangle (zero if degenerate). The
+// triangles are first grouped by the direction of their normals, each group
+// gets its own SAH hierarchy and those become the subtrees of a chain of inner
+// nodes; a meshlet never mixes groups unless the whole model fits in one.
+// Position i of the new order must hold the original triangle order[i].
+static BvhNode *MeshletBuild(const glm::vec3 *positions, const glm::vec3 *normals, unsigned num_triangles,
+                             unsigned *order, std::vector<Meshlet> *meshlets, int *num_nodes)
+{
+    std::vector<unsigned> group_first(7, 0);
+    for (unsigned i = 0; i < num_triangles; i++) {
+        group_first[MeshletNormalGroup(normals[i]) + 1] += 1;
+    }
+    for (int g = 0; g < 6; g++) {
+        group_first[g+1] += group_first[g];
+    }
+    std::vector<unsigned> grouped(num_triangles);
+    std::vector<unsigned> next(group_first.begin(), group_first.end() - 1);
+    for (unsigned i = 0; i < num_triangles; i++) {
+        grouped[next[MeshletNormalGroup(normals[i])]++] = i;
+    }
+
+    std::vector<BvhNode>   nodes;
+    std::vector<glm::vec3> tri_min;
+    std::vector<glm::vec3> tri_max;
+    std::vector<unsigned>  local_order;
+    std::vector<unsigned>  chain; // inner nodes joining the groups
+    std::vector<unsigned>  roots; // root of each group
+    for (int g = 0; g < 6; g++) {
+        unsigned first = group_first[g];
+        unsigned count = group_first[g+1] - first;
+        if (count == 0) {
+            continue;
+        }
+        if (group_first[6] - group_first[g+1] > 0) {
+            // more triangles follow: this group is the left child of a new inner node
+            chain.push_back(nodes.size());
+            nodes.push_back(BvhNode());
+        }
+        tri_min.resize(count);
+        tri_max.resize(count);
+        local_order.resize(count);
+        for (unsigned i = 0; i < count; i++) {
+            const glm::vec3 *v = positions + 3 * grouped[first + i];
+            tri_min[i] = glm::min(v[0], glm::min(v[1], v[2]));
+            tri_max[i] = glm::max(v[0], glm::max(v[1], v[2]));
+        }
+        int group_nodes = 0;
+        BvhNode *group = BvhBuild(tri_min.data(), tri_max.data(), count, local_order.data(), &group_nodes);
+        for (unsigned i = 0; i < count; i++) {
+            order[first + i] = grouped[first + local_order[i]];
+        }
+        unsigned base = nodes.size();
+        for (int n = 0; n < group_nodes; n++) {
+            BvhNode node = group[n];
+            node.offset += (node.count > 0) ? first : base;
+            nodes.push_back(node);
+        }
+        free(group);
+        roots.push_back(base);
+    }
+    // chain node c has group c on the left and the next chain node, or the
+    // last group, on the right
+    for (int c = (int)chain.size() - 1; c >= 0; c--) {
+        unsigned index = chain[c];
+        unsigned right = (c + 1 < (int)chain.size()) ? chain[c+1] : roots.back();
+        nodes[index].offset = right;
+        nodes[index].count  = 0;
+        nodes[index].min    = glm::min(nodes[index + 1].min, nodes[right].min);
+        nodes[index].max    = glm::max(nodes[index + 1].max, nodes[right].max);
+    }
+
+    std::vector<glm::vec3> sorted_positions(3 * num_triangles);
+    std::vector<glm::vec3> sorted_normals(num_triangles);
+    for (unsigned i = 0; i < num_triangles; i++) {
+        sorted_positions[3*i+0] = positions[3*order[i]+0];
+        sorted_positions[3*i+1] = positions[3*order[i]+1];
+        sorted_positions[3*i+2] = positions[3*order[i]+2];
+        sorted_normals[i]       = normals[order[i]];
+    }
+    std::vector<BvhNode> meshlet_nodes;
+    MeshletBuilder builder;
+    builder.nodes         = nodes.data();
+    builder.positions     = sorted_positions.data();
+    builder.normals       = sorted_normals.data();
+    builder.meshlets      = meshlets;
+    builder.meshlet_nodes = &meshlet_nodes;
+    meshlets->clear();
+    MeshletBuildNode(&builder, 0);
+
+    BvhNode *result = (BvhNode*)malloc(meshlet_nodes.size() * sizeof(BvhNode));
+    memcpy(result, meshlet_nodes.data(), meshlet_nodes.size() * sizeof(BvhNode));
+    *num_nodes = meshlet_nodes.size();
+    return result;
+}
+
+// True when every triangle of the meshlet faces away from a camera at
+// camera_position (in model space). facing is 1 when the front faces are the
+// ones the normals were built for and -1 when the winding is reversed.
+static bool MeshletBackfacing(const Meshlet &meshlet, glm::vec3 camera_position, float facing)
+{
+    glm::vec3 to_center = meshlet.center - camera_position;
+    return glm::dot(to_center, facing * meshlet.cone_axis) >=
+           meshlet.cone_cutoff * glm::length(to_center) + meshlet.radius;
+}
+
+#endif // _MESHLET_H
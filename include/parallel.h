@@ -0,0 +1,31 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include <glm/common.hpp>
+
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Work split over the rows of an image: the lighting of the G-buffer, the
+// resolve of the visibility buffer and the mip levels of the texture loader.
+#define PARALLEL_PIXELS_PER_THREAD 32768 // fewest pixels worth a thread of their own
+
+// Calls rows(first, last) over bands of the rows [0, height) on up to
+// max_threads threads, one band per thread.
+template <typename Rows>
+static void ParallelForRowBands(int width, int height, int max_threads, Rows rows)
+{
+    size_t pixels  = (size_t)width * height;
+    int    threads = (int)glm::clamp(pixels / PARALLEL_PIXELS_PER_THREAD, (size_t)1, (size_t)glm::max(max_threads, 1));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread(rows, height * t / threads, height * (t + 1) / threads));
+    }
+    rows(0, height / threads);
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
+
+#endif // _PARALLEL_H
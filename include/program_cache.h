@@ -0,0 +1,182 @@
+#ifndef _PROGRAM_CACHE_H
+#define _PROGRAM_CACHE_H
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Linked GPU programs kept on disk with glGetProgramBinary(), so a launch
+// loads them with glProgramBinary() instead of compiling and linking every
+// shader again. Each program is keyed by a hash of its sources, with the
+// #defines already inserted, and of the driver (vendor, renderer and version
+// strings). The file starts with PROGRAM_CACHE_MAGIC, a version number and the
+// hash of the driver that wrote it, followed by the programs:
+//
+//   u64 key, u32 binary format, u32 size, size bytes of binary
+//
+// A file of another driver is ignored and rewritten by the first program
+// stored. A binary the driver rejects is dropped and the program is compiled.
+#define PROGRAM_CACHE_MAGIC   "CMPBIN"
+#define PROGRAM_CACHE_VERSION 1
+
+struct ProgramBinary {
+    GLenum                     format;
+    std::vector<unsigned char> data;
+};
+
+struct ProgramCache {
+    char                                         filename[FILENAME_MAX];
+    bool                                         enabled; // the driver has binary formats
+    bool                                         stale;   // the file must be rewritten, not appended
+    unsigned long long                           driver;
+    std::map<unsigned long long, ProgramBinary>  binaries;
+};
+
+// FNV-1a, continuing from hash.
+static unsigned long long ProgramCacheHash(const void *data, size_t size, unsigned long long hash = 14695981039346656037ull)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Key of the program linked from the given sources on the current driver.
+static unsigned long long ProgramCacheKey(const ProgramCache &cache, const std::string &vertex_source, const std::string &fragment_source)
+{
+    unsigned long long key = cache.driver;
+    key = ProgramCacheHash(vertex_source.data(), vertex_source.size() + 1, key); // the terminating zero separates the two
+    key = ProgramCacheHash(fragment_source.data(), fragment_source.size(), key);
+    return key;
+}
+
+static void ProgramCacheWrite(FILE *fp, unsigned long long key, const ProgramBinary &binary)
+{
+    unsigned format = binary.format;
+    unsigned size   = (unsigned)binary.data.size();
+    fwrite(&key,    sizeof(key),    1, fp);
+    fwrite(&format, sizeof(format), 1, fp);
+    fwrite(&size,   sizeof(size),   1, fp);
+    fwrite(binary.data.data(), 1, size, fp);
+}
+
+// Reads the programs of filename, if it exists and was written by this driver.
+// Needs a current GL context.
+static void ProgramCacheOpen(ProgramCache *cache, const char *filename)
+{
+    *cache = ProgramCache();
+    snprintf(cache->filename, FILENAME_MAX, "%s", filename);
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    cache->enabled = formats > 0;
+    cache->stale   = true;
+    if (!cache->enabled) {
+        return;
+    }
+    const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    cache->driver = ProgramCacheHash(NULL, 0);
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        const char *string = (const char*)glGetString(strings[i]);
+        if (string) {
+            cache->driver = ProgramCacheHash(string, strlen(string) + 1, cache->driver);
+        }
+    }
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return;
+    }
+    char               magic[sizeof(PROGRAM_CACHE_MAGIC)];
+    unsigned           version;
+    unsigned long long driver;
+    if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+        memcmp(magic, PROGRAM_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&version, sizeof(version), 1, fp) != 1 || version != PROGRAM_CACHE_VERSION ||
+        fread(&driver, sizeof(driver), 1, fp) != 1 || driver != cache->driver) {
+        fclose(fp);
+        return;
+    }
+    cache->stale = false;
+    unsigned long long key;
+    unsigned           format;
+    unsigned           size;
+    while (fread(&key, sizeof(key), 1, fp) == 1) {
+        ProgramBinary binary;
+        if (fread(&format, sizeof(format), 1, fp) != 1 || fread(&size, sizeof(size), 1, fp) != 1) {
+            cache->stale = true; // truncated, rewritten with what was read
+            break;
+        }
+        binary.format = format;
+        binary.data.resize(size);
+        if (fread(binary.data.data(), 1, size, fp) != size) {
+            cache->stale = true;
+            break;
+        }
+        cache->binaries[key] = binary;
+    }
+    fclose(fp);
+}
+
+// Returns a linked program made from the binary of key, 0 if there is none or
+// the driver rejects it.
+static GLuint ProgramCacheLoad(ProgramCache *cache, unsigned long long key)
+{
+    std::map<unsigned long long, ProgramBinary>::iterator found = cache->binaries.find(key);
+    if (!cache->enabled || found == cache->binaries.end()) {
+        return 0;
+    }
+    GLuint program_id = glCreateProgram();
+    glProgramBinary(program_id, found->second.format, found->second.data.data(), (GLsizei)found->second.data.size());
+    GLint linked_ok = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &linked_ok);
+    if (linked_ok == GL_FALSE) {
+        glDeleteProgram(program_id);
+        cache->binaries.erase(found);
+        cache->stale = true;
+        return 0;
+    }
+    return program_id;
+}
+
+// Saves the binary of a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+// under key, appending it to the file.
+static void ProgramCacheStore(ProgramCache *cache, unsigned long long key, GLuint program_id)
+{
+    GLint linked_ok = GL_FALSE;
+    GLint length    = 0;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &linked_ok);
+    glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!cache->enabled || linked_ok == GL_FALSE || length <= 0) {
+        return;
+    }
+    ProgramBinary binary;
+    binary.data.resize(length);
+    glGetProgramBinary(program_id, length, &length, &binary.format, binary.data.data());
+    binary.data.resize(length);
+    cache->binaries[key] = binary;
+
+    FILE *fp = fopen(cache->filename, cache->stale ? "wb" : "ab");
+    if (!fp) {
+        fprintf(stderr, "WARNING: cannot write the program cache \"%s\".\n", cache->filename);
+        return;
+    }
+    if (cache->stale) {
+        unsigned version = PROGRAM_CACHE_VERSION;
+        fwrite(PROGRAM_CACHE_MAGIC, 1, sizeof(PROGRAM_CACHE_MAGIC), fp);
+        fwrite(&version, sizeof(version), 1, fp);
+        fwrite(&cache->driver, sizeof(cache->driver), 1, fp);
+        std::map<unsigned long long, ProgramBinary>::const_iterator it;
+        for (it = cache->binaries.begin(); it != cache->binaries.end(); ++it) {
+            ProgramCacheWrite(fp, it->first, it->second);
+        }
+        cache->stale = false;
+    } else {
+        ProgramCacheWrite(fp, key, binary);
+    }
+    fclose(fp);
+}
+
+#endif // _PROGRAM_CACHE_H
@@ -0,0 +1,90 @@
+#ifndef _RADIX_SORT_H
+#define _RADIX_SORT_H
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Stable least significant digit radix sort of key/value pairs, one pass per
+// byte of the key. Each pass counts the digits of contiguous chunks of the
+// items, one chunk per thread, and then every thread scatters its chunk to the
+// offsets the counts of the chunks before it leave. Small inputs are sorted
+// on the calling thread, where starting threads would cost more than the sort.
+#define RADIX_SORT_BUCKETS          256
+#define RADIX_SORT_ITEMS_PER_THREAD 8192 // fewest items worth a thread of their own
+
+struct RadixItem {
+    unsigned key;
+    unsigned value;
+};
+
+static void RadixSortCount(const RadixItem *items, unsigned first, unsigned last, int shift, unsigned *count)
+{
+    std::fill(count, count + RADIX_SORT_BUCKETS, 0u);
+    for (unsigned i = first; i < last; i++) {
+        count[(items[i].key >> shift) & (RADIX_SORT_BUCKETS - 1)] += 1;
+    }
+}
+
+static void RadixSortScatter(const RadixItem *items, RadixItem *sorted, unsigned first, unsigned last, int shift,
+                             unsigned *offset)
+{
+    for (unsigned i = first; i < last; i++) {
+        sorted[offset[(items[i].key >> shift) & (RADIX_SORT_BUCKETS - 1)]++] = items[i];
+    }
+}
+
+// Sorts count items by the low key_bits bits of their keys (rounded up to a
+// whole byte) with up to max_threads threads. scratch must hold count items;
+// the result is left in items.
+static void RadixSort(RadixItem *items, RadixItem *scratch, unsigned count, int key_bits, int max_threads)
+{
+    int threads = (int)glm::clamp(count / RADIX_SORT_ITEMS_PER_THREAD, 1u, (unsigned)glm::max(max_threads, 1));
+    std::vector<unsigned>    counts((size_t)threads * RADIX_SORT_BUCKETS);
+    std::vector<unsigned>    chunk(threads + 1);
+    std::vector<std::thread> workers;
+    for (int t = 0; t <= threads; t++) {
+        chunk[t] = (unsigned)((unsigned long long)count * t / threads);
+    }
+
+    RadixItem *from = items;
+    RadixItem *to   = scratch;
+    for (int shift = 0; shift < key_bits; shift += 8) {
+        for (int t = 1; t < threads; t++) {
+            workers.push_back(std::thread(RadixSortCount, from, chunk[t], chunk[t+1], shift, &counts[t * RADIX_SORT_BUCKETS]));
+        }
+        RadixSortCount(from, chunk[0], chunk[1], shift, &counts[0]);
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].join();
+        }
+        workers.clear();
+
+        // offsets: all the items of smaller digits, then those of the same
+        // digit in the chunks before
+        unsigned total = 0;
+        for (int digit = 0; digit < RADIX_SORT_BUCKETS; digit++) {
+            for (int t = 0; t < threads; t++) {
+                unsigned n = counts[t * RADIX_SORT_BUCKETS + digit];
+                counts[t * RADIX_SORT_BUCKETS + digit] = total;
+                total += n;
+            }
+        }
+
+        for (int t = 1; t < threads; t++) {
+            workers.push_back(std::thread(RadixSortScatter, from, to, chunk[t], chunk[t+1], shift, &counts[t * RADIX_SORT_BUCKETS]));
+        }
+        RadixSortScatter(from, to, chunk[0], chunk[1], shift, &counts[0]);
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].join();
+        }
+        workers.clear();
+        std::swap(from, to);
+    }
+    if (from != items) {
+        std::copy(from, from + count, items);
+    }
+}
+
+#endif // _RADIX_SORT_H
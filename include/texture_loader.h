@@ -0,0 +1,504 @@
+#ifndef _TEXTURE_LOADER_H
+#define _TEXTURE_LOADER_H
+
+#include "block_compress.h"
+#include "parallel.h"
+#include "uniform_ring.h"
+
+#include <sys/stat.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Texture images decoded off the render thread. Worker threads decode the file
+// with stb_image and build the mip chain on the CPU, its rows split between
+// threads. The render thread then uploads at most TEXTURE_UPLOAD_BUDGET bytes
+// per frame through the uniform ring, which acts as the pixel unpack buffer,
+// into a new texture. The texture is shown only once every level is in. The
+// decoded images and their textures are cached by file name, modification
+// time and format, so opening the same file again only rebinds its texture.
+//
+// An image requested in a BLOCK_FORMAT_ is compressed level by level after its
+// mip chain is built, and only the blocks are kept. They are also written next
+// to the image, as its name plus .bc1 or .bc7, so the next launch reads the
+// blocks of every level instead of decoding and compressing again. That file
+// starts with TEXTURE_BLOCKS_MAGIC, followed by
+//
+//   u32 version, u32 format, i32 width, i32 height, i32 levels, i64 mtime of the image, the blocks of each level
+#define TEXTURE_LOADER_THREADS 2         // images decoded at the same time
+#define TEXTURE_UPLOAD_BUDGET  (4 << 20) // bytes staged per frame, room the uniform ring must have
+#define TEXTURE_CACHE_MAX      8         // images kept, the least recently shown are dropped first
+#define TEXTURE_BLOCKS_MAGIC   "CMPTEX"
+#define TEXTURE_BLOCKS_VERSION 1
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+struct TextureImage {
+    std::string                filename;
+    long long                  mtime;
+    int                        format;   // BLOCK_FORMAT_
+    unsigned                   id;       // of the BlockTexture of level 0
+    bool                       decoded;  // set by the worker under the mutex of the loader
+    bool                       failed;   // likewise, before decoded
+    int                        width;
+    int                        height;
+    int                        channels; // of the file, the texels are always RGB
+    int                        levels;
+    std::vector<size_t>        offsets;  // of each level in texels, levels + 1 entries
+    std::vector<unsigned char> texels;   // RGB, level 0 first, empty once compressed
+    std::vector<size_t>        block_offsets; // of each level in bytes, levels + 1 entries
+    std::vector<unsigned char> blocks;   // the levels compressed in format
+    GLuint                     texture;  // storage for all the levels, 0 until the upload starts
+    int                        level;    // upload progress: next level and row
+    int                        row;
+    bool                       resident; // every level uploaded
+    unsigned                   last_used;
+};
+
+struct TextureLoader {
+    std::vector<std::thread>   workers;
+    std::mutex                 mutex;
+    std::condition_variable    wake;    // work queued or quit
+    std::condition_variable    done;    // an image was decoded
+    std::deque<TextureImage*>  queue;   // waiting to be decoded
+    bool                       quit;
+    std::vector<TextureImage*> images;  // the cache
+    TextureImage              *pending; // requested, shown once resident
+    TextureImage              *current; // shown
+    unsigned                   clock;
+};
+
+static int TextureLevelSize(int size, int level)
+{
+    return (size >> level) > 0 ? size >> level : 1;
+}
+
+// Threads a worker may split the work of one image between: its share of the
+// cores, so the images decoded at the same time do not take them all from the
+// render thread.
+static int TextureWorkerThreads()
+{
+    return glm::max((int)std::thread::hardware_concurrency() / TEXTURE_LOADER_THREADS, 1);
+}
+
+// Box filters level - 1 into level, both in image->texels.
+static void TextureBuildLevel(TextureImage *image, int level)
+{
+    int src_width  = TextureLevelSize(image->width,  level - 1);
+    int src_height = TextureLevelSize(image->height, level - 1);
+    int width      = TextureLevelSize(image->width,  level);
+    int height     = TextureLevelSize(image->height, level);
+    const unsigned char *src = image->texels.data() + 3 * image->offsets[level - 1];
+    unsigned char       *dst = image->texels.data() + 3 * image->offsets[level];
+    ParallelForRowBands(width, height, TextureWorkerThreads(), [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            const unsigned char *row0 = src + (size_t)3 * src_width * glm::min(2 * y,     src_height - 1);
+            const unsigned char *row1 = src + (size_t)3 * src_width * glm::min(2 * y + 1, src_height - 1);
+            for (int x = 0; x < width; x++) {
+                int x0 = 3 * glm::min(2 * x,     src_width - 1);
+                int x1 = 3 * glm::min(2 * x + 1, src_width - 1);
+                for (int c = 0; c < 3; c++) {
+                    dst[3 * ((size_t)y * width + x) + c] =
+                        (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+        }
+    });
+}
+
+static const char *TextureBlocksSuffix(int format)
+{
+    return format == BLOCK_FORMAT_BC1 ? ".bc1" : ".bc7";
+}
+
+static void TextureBlockOffsets(TextureImage *image)
+{
+    image->block_offsets.resize(image->levels + 1);
+    image->block_offsets[0] = 0;
+    for (int level = 0; level < image->levels; level++) {
+        image->block_offsets[level + 1] = image->block_offsets[level] +
+            BlockImageBytes(image->format, TextureLevelSize(image->width, level), TextureLevelSize(image->height, level));
+    }
+}
+
+// Reads the blocks written for the image, if they are of its format and of the
+// current version of the file. Returns false otherwise.
+static bool TextureReadBlocks(TextureImage *image)
+{
+    std::string filename = image->filename + TextureBlocksSuffix(image->format);
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    char      magic[sizeof(TEXTURE_BLOCKS_MAGIC)];
+    unsigned  version, format;
+    int       size[3];
+    long long mtime;
+    bool ok = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+              memcmp(magic, TEXTURE_BLOCKS_MAGIC, sizeof(magic)) == 0 &&
+              fread(&version, sizeof(version), 1, fp) == 1 && version == TEXTURE_BLOCKS_VERSION &&
+              fread(&format,  sizeof(format),  1, fp) == 1 && (int)format == image->format &&
+              fread(size,     sizeof(size),    1, fp) == 1 && size[0] > 0 && size[1] > 0 && size[2] > 0 && size[2] <= 32 &&
+              fread(&mtime,   sizeof(mtime),   1, fp) == 1 && mtime == image->mtime;
+    if (ok) {
+        image->width  = size[0];
+        image->height = size[1];
+        image->levels = size[2];
+        TextureBlockOffsets(image);
+        image->blocks.resize(image->block_offsets[image->levels]);
+        ok = fread(image->blocks.data(), 1, image->blocks.size(), fp) == image->blocks.size();
+    }
+    fclose(fp);
+    if (!ok) {
+        image->blocks.clear();
+    }
+    return ok;
+}
+
+static void TextureWriteBlocks(const TextureImage *image)
+{
+    std::string filename = image->filename + TextureBlocksSuffix(image->format);
+    FILE *fp = fopen(filename.c_str(), "wb");
+    if (!fp) {
+        fprintf(stderr, "WARNING: cannot write the compressed texture \"%s\".\n", filename.c_str());
+        return;
+    }
+    unsigned version = TEXTURE_BLOCKS_VERSION;
+    unsigned format  = image->format;
+    int      size[3] = { image->width, image->height, image->levels };
+    fwrite(TEXTURE_BLOCKS_MAGIC, 1, sizeof(TEXTURE_BLOCKS_MAGIC), fp);
+    fwrite(&version,      sizeof(version),      1, fp);
+    fwrite(&format,       sizeof(format),       1, fp);
+    fwrite(size,          sizeof(size),         1, fp);
+    fwrite(&image->mtime, sizeof(image->mtime), 1, fp);
+    fwrite(image->blocks.data(), 1, image->blocks.size(), fp);
+    fclose(fp);
+}
+
+// Runs on a worker: decodes the file and builds the mip chain, then
+// compresses it unless its blocks were written already. Returns false if the
+// file cannot be read.
+static bool TextureDecode(TextureImage *image)
+{
+    if (image->format != BLOCK_FORMAT_NONE && TextureReadBlocks(image)) {
+        return true;
+    }
+    int width;
+    int height;
+    int channels;
+    unsigned char *pixels = stbi_load(image->filename.c_str(), &width, &height, &channels, 3);
+    if (!pixels) {
+        return false;
+    }
+    image->width    = width;
+    image->height   = height;
+    image->channels = channels;
+    image->levels   = 1;
+    while ((width >> image->levels) > 0 || (height >> image->levels) > 0) {
+        image->levels += 1;
+    }
+    image->offsets.resize(image->levels + 1);
+    image->offsets[0] = 0;
+    for (int level = 0; level < image->levels; level++) {
+        image->offsets[level + 1] = image->offsets[level] + (size_t)TextureLevelSize(width, level) * TextureLevelSize(height, level);
+    }
+    image->texels.resize(3 * image->offsets[image->levels]);
+    memcpy(image->texels.data(), pixels, (size_t)3 * width * height);
+    stbi_image_free(pixels);
+    for (int level = 1; level < image->levels; level++) {
+        TextureBuildLevel(image, level);
+    }
+    if (image->format != BLOCK_FORMAT_NONE) {
+        TextureBlockOffsets(image);
+        image->blocks.resize(image->block_offsets[image->levels]);
+        for (int level = 0; level < image->levels; level++) {
+            BlockCompressImage(image->texels.data() + 3 * image->offsets[level], TextureLevelSize(width, level),
+                               TextureLevelSize(height, level), image->format, image->blocks.data() + image->block_offsets[level],
+                               TextureWorkerThreads());
+        }
+        std::vector<unsigned char>().swap(image->texels);
+        TextureWriteBlocks(image);
+    }
+    return true;
+}
+
+static void TextureLoaderWork(TextureLoader *loader)
+{
+    std::unique_lock<std::mutex> lock(loader->mutex);
+    while (true) {
+        while (!loader->quit && loader->queue.empty()) {
+            loader->wake.wait(lock);
+        }
+        if (loader->quit) {
+            return;
+        }
+        TextureImage *image = loader->queue.front();
+        loader->queue.pop_front();
+        lock.unlock();
+        bool loaded = TextureDecode(image);
+        lock.lock();
+        image->failed  = !loaded;
+        image->decoded = true;
+        loader->done.notify_all();
+        glfwPostEmptyEvent(); // the render thread may be asleep in glfwWaitEvents()
+    }
+}
+
+static void TextureLoaderInit(TextureLoader *loader)
+{
+    loader->quit    = false;
+    loader->pending = NULL;
+    loader->current = NULL;
+    loader->clock   = 0;
+    stbi_set_flip_vertically_on_load(true); // global in stb_image, set before the workers read it
+    for (int t = 0; t < TEXTURE_LOADER_THREADS; t++) {
+        loader->workers.push_back(std::thread(TextureLoaderWork, loader));
+    }
+}
+
+static void TextureLoaderShutdown(TextureLoader *loader)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        loader->quit = true;
+    }
+    loader->wake.notify_all();
+    for (size_t t = 0; t < loader->workers.size(); t++) {
+        loader->workers[t].join();
+    }
+    loader->workers.clear();
+    for (size_t i = 0; i < loader->images.size(); i++) {
+        glDeleteTextures(1, &loader->images[i]->texture);
+        delete loader->images[i];
+    }
+    loader->images.clear();
+}
+
+static long long TextureFileTime(const char *filename)
+{
+    struct stat info;
+    return stat(filename, &info) == 0 ? (long long)info.st_mtime : -1;
+}
+
+// Drops the least recently shown images past TEXTURE_CACHE_MAX, leaving the
+// ones shown, requested or still decoding.
+static void TextureLoaderTrim(TextureLoader *loader)
+{
+    while (loader->images.size() > TEXTURE_CACHE_MAX) {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        int oldest = -1;
+        for (size_t i = 0; i < loader->images.size(); i++) {
+            TextureImage *image = loader->images[i];
+            if (image == loader->current || image == loader->pending || !image->decoded) {
+                continue;
+            }
+            if (oldest < 0 || image->last_used < loader->images[oldest]->last_used) {
+                oldest = (int)i;
+            }
+        }
+        if (oldest < 0) {
+            return;
+        }
+        glDeleteTextures(1, &loader->images[oldest]->texture);
+        delete loader->images[oldest];
+        loader->images.erase(loader->images.begin() + oldest);
+    }
+}
+
+// Makes the image of filename, in format, the pending one, queueing it for
+// decoding unless the cache has it for the same modification time.
+static TextureImage *TextureLoaderRequest(TextureLoader *loader, const char *filename, int format)
+{
+    long long mtime = TextureFileTime(filename);
+    TextureImage *image = NULL;
+    {
+        std::lock_guard<std::mutex> lock(loader->mutex);
+        for (size_t i = 0; i < loader->images.size() && !image; i++) {
+            TextureImage *cached = loader->images[i];
+            if (cached->filename == filename && cached->mtime == mtime && cached->format == format && !cached->failed) {
+                image = cached;
+            }
+        }
+    }
+    if (!image) {
+        image = new TextureImage();
+        image->filename = filename;
+        image->mtime    = mtime;
+        image->format   = format;
+        image->id       = BlockTextureId();
+        loader->images.push_back(image);
+        {
+            std::lock_guard<std::mutex> lock(loader->mutex);
+            loader->queue.push_back(image);
+        }
+        loader->wake.notify_one();
+    }
+    image->last_used = ++loader->clock;
+    loader->pending  = image;
+    TextureLoaderTrim(loader);
+    return image;
+}
+
+static bool TextureImageDecoded(TextureLoader *loader, TextureImage *image)
+{
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    return image->decoded;
+}
+
+static bool TextureImageFailed(TextureLoader *loader, TextureImage *image)
+{
+    std::lock_guard<std::mutex> lock(loader->mutex);
+    return image->failed;
+}
+
+// True while the pending image is decoded and TextureLoaderUpdate() still has
+// rows of it to upload, so the frames must go on.
+static bool TextureLoaderUploading(TextureLoader *loader)
+{
+    return loader->pending && TextureImageDecoded(loader, loader->pending);
+}
+
+static GLenum TextureInternalFormat(int format)
+{
+    switch (format) {
+      case BLOCK_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+      case BLOCK_FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+    }
+    return GL_RGB8;
+}
+
+// True when the context takes format compressed: BC7 (BPTC) is core since
+// OpenGL 4.2, BC1 (S3TC) still needs GL_EXT_texture_compression_s3tc.
+static bool TextureFormatSupported(int format)
+{
+    if (format != BLOCK_FORMAT_BC1) {
+        return true;
+    }
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+        if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Uploads rows of the image, from the next one, up to budget bytes (all of
+// them with a budget of 0), whole rows of blocks when it is compressed.
+// Through the uniform ring when ring is not NULL, from the texels or blocks
+// directly otherwise. Returns true once every level is in.
+static bool TextureUpload(TextureImage *image, UniformRing *ring, size_t budget)
+{
+    GLenum internal_format = TextureInternalFormat(image->format);
+    if (!image->texture) {
+        glCreateTextures(GL_TEXTURE_2D, 1, &image->texture);
+        glTextureStorage2D(image->texture, image->levels, internal_format, image->width, image->height);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    if (ring) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->buffer);
+    }
+    bool   compressed = image->format != BLOCK_FORMAT_NONE;
+    int    unit       = compressed ? 4 : 1; // texel rows in a row of the data
+    size_t sent       = 0;
+    while (image->level < image->levels && (budget == 0 || sent < budget)) {
+        int    width     = TextureLevelSize(image->width,  image->level);
+        int    height    = TextureLevelSize(image->height, image->level);
+        size_t row_bytes = compressed ? BlockImageBytes(image->format, width, 1) : (size_t)3 * width;
+        int    units     = (height - image->row + unit - 1) / unit;
+        if (budget) {
+            units = glm::min(units, (int)glm::max((budget - sent) / row_bytes, (size_t)1));
+        }
+        int    rows  = glm::min(units * unit, height - image->row);
+        size_t bytes = units * row_bytes;
+        const unsigned char *data = compressed ? image->blocks.data() + image->block_offsets[image->level] + row_bytes * (image->row / unit)
+                                               : image->texels.data() + 3 * image->offsets[image->level] + row_bytes * image->row;
+        const void *pixels = data;
+        if (ring) {
+            GLintptr offset;
+            void    *staged = UniformRingAlloc(ring, bytes, &offset);
+            if (!staged) {
+                break; // the slot of the frame is full, the next frame goes on
+            }
+            memcpy(staged, data, bytes);
+            pixels = (const void*)offset;
+        }
+        if (compressed) {
+            glCompressedTextureSubImage2D(image->texture, image->level, 0, image->row, width, rows, internal_format,
+                                          (GLsizei)bytes, pixels);
+        } else {
+            glTextureSubImage2D(image->texture, image->level, 0, image->row, width, rows, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        }
+        sent       += bytes;
+        image->row += rows;
+        if (image->row == height) {
+            image->level += 1;
+            image->row    = 0;
+        }
+    }
+    if (ring) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    image->resident = image->level == image->levels;
+    return image->resident;
+}
+
+// Called once per frame, between UniformRingBegin() and UniformRingEnd().
+// Uploads a part of the pending image once it is decoded. Returns it when it
+// is ready to be shown, and makes it the current one.
+static TextureImage *TextureLoaderUpdate(TextureLoader *loader, UniformRing *ring)
+{
+    TextureImage *image = loader->pending;
+    if (!image || !TextureImageDecoded(loader, image)) {
+        return NULL;
+    }
+    if (TextureImageFailed(loader, image)) {
+        fprintf(stderr, "ERROR: cannot load texture \"%s\".\n", image->filename.c_str());
+        loader->pending = NULL;
+        return NULL;
+    }
+    if (!image->resident && !TextureUpload(image, ring, TEXTURE_UPLOAD_BUDGET)) {
+        return NULL;
+    }
+    loader->pending = NULL;
+    loader->current = image;
+    return image;
+}
+
+// Waits for the pending image and uploads it whole, for when the frame must
+// not go on without it (the replay of a session). Returns it, or NULL if it
+// cannot be loaded.
+static TextureImage *TextureLoaderFinish(TextureLoader *loader)
+{
+    TextureImage *image = loader->pending;
+    if (!image) {
+        return NULL;
+    }
+    bool failed;
+    {
+        std::unique_lock<std::mutex> lock(loader->mutex);
+        while (!image->decoded) {
+            loader->done.wait(lock);
+        }
+        failed = image->failed;
+    }
+    if (!image->resident && !failed) {
+        TextureUpload(image, NULL, 0);
+    }
+    return TextureLoaderUpdate(loader, NULL);
+}
+
+#endif // _TEXTURE_LOADER_H
@@ -0,0 +1,105 @@
+#ifndef _UNIFORM_RING_H
+#define _UNIFORM_RING_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Uniform blocks (and the other data a frame streams to the GPU: storage
+// buffers, indirect draws) written straight into a persistently mapped buffer.
+// The buffer holds UNIFORM_RING_FRAMES slots, one per frame in flight: a frame
+// fills its slot, binds ranges of it to the blocks of the shaders and fences
+// it when its draws are issued, and the slot is only written again after that
+// fence signals, so the CPU neither stalls the GPU nor overwrites blocks the
+// GPU is still reading.
+#define UNIFORM_RING_FRAMES 3
+
+struct UniformRing {
+    GLuint         buffer;
+    unsigned char *mapped;    // the whole buffer, mapped for as long as it lives
+    GLsizeiptr     slot_size;
+    GLsizeiptr     alignment; // of uniform and storage buffer offsets
+    GLsizeiptr     used;      // bytes taken in the slot of the current frame
+    int            frame;     // slot of the current frame
+    GLsync         fences[UNIFORM_RING_FRAMES];
+};
+
+static GLsizeiptr UniformRingAlign(const UniformRing &ring, GLsizeiptr size)
+{
+    return (size + ring.alignment - 1) / ring.alignment * ring.alignment;
+}
+
+// Makes each slot room for up to blocks blocks of block_bytes bytes in all,
+// with the padding that aligns their offsets.
+static void UniformRingInit(UniformRing *ring, GLsizeiptr block_bytes, int blocks)
+{
+    *ring = UniformRing();
+    GLint uniform_alignment = 256;
+    GLint storage_alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+    ring->alignment = uniform_alignment > storage_alignment ? uniform_alignment : storage_alignment;
+    ring->slot_size = UniformRingAlign(*ring, block_bytes + blocks * ring->alignment);
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &ring->buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, ring->slot_size * UNIFORM_RING_FRAMES, NULL, flags);
+    ring->mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, ring->slot_size * UNIFORM_RING_FRAMES, flags);
+    if (!ring->mapped) {
+        fprintf(stderr, "ERROR: Cannot map the uniform buffer.\n");
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+// Called at the start of a frame, before its first UniformRingPush(). Waits
+// until the GPU is done with the frame that used the slot before.
+static void UniformRingBegin(UniformRing *ring)
+{
+    GLsync fence = ring->fences[ring->frame];
+    if (fence) {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        while (result == GL_TIMEOUT_EXPIRED) {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // 1 s
+        }
+        glDeleteSync(fence);
+        ring->fences[ring->frame] = NULL;
+    }
+    ring->used = 0;
+}
+
+// Takes size bytes of the slot of the frame, for the caller to write and
+// bind at *offset in ring->buffer. Returns NULL when the slot is full.
+static void *UniformRingAlloc(UniformRing *ring, GLsizeiptr size, GLintptr *offset)
+{
+    GLsizeiptr taken = UniformRingAlign(*ring, size);
+    if (ring->used + taken > ring->slot_size) {
+        return NULL;
+    }
+    *offset = ring->frame * ring->slot_size + ring->used;
+    ring->used += taken;
+    return ring->mapped + *offset;
+}
+
+// Copies a block into the slot of the frame and binds it to binding, for
+// the draws that follow. Returns false, binding nothing, when the slot is full.
+static bool UniformRingPush(UniformRing *ring, GLuint binding, const void *block, GLsizeiptr size)
+{
+    GLintptr offset;
+    void    *data = UniformRingAlloc(ring, size, &offset);
+    if (!data) {
+        return false;
+    }
+    memcpy(data, block, size);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, ring->buffer, offset, size);
+    return true;
+}
+
+// Called after the last draw of a frame that reads the slot.
+static void UniformRingEnd(UniformRing *ring)
+{
+    ring->fences[ring->frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    ring->frame = (ring->frame + 1) % UNIFORM_RING_FRAMES;
+}
+
+#endif // _UNIFORM_RING_H
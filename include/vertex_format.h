@@ -0,0 +1,94 @@
+#ifndef _VERTEX_FORMAT_H
+#define _VERTEX_FORMAT_H
+
+#include "gbuffer.h"
+
+#include <glm/packing.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// Vertex of the OpenGL path: one interleaved, tightly packed stream of 24
+// bytes per vertex, against the 40 of the separate vec4 position, vec4 normal
+// and vec2 uv streams it replaces. The normal is octahedral in 2 x 16 bits
+// (the encoding of the G-buffer) and the uv are half floats. Corners equal in
+// every field are welded into one vertex, so an index is all that repeats.
+struct GpuVertex {
+    glm::vec3 position;
+    unsigned  normal;   // GBufferPackNormal()
+    unsigned  uv;       // glm::packHalf2x16()
+    unsigned  material;
+};
+
+// attribute locations of triangles.vert
+#define GPU_VERTEX_POSITION 0
+#define GPU_VERTEX_NORMAL   2
+#define GPU_VERTEX_UV       3
+#define GPU_VERTEX_MATERIAL 4
+#define GPU_VERTEX_INSTANCE 5 // not in GpuVertex: the index of the instance, one per instance
+
+static GpuVertex GpuVertexPack(glm::vec3 position, glm::vec3 normal, glm::vec2 uv, unsigned material)
+{
+    GpuVertex vertex;
+    vertex.position = position;
+    vertex.normal   = GBufferPackNormal(normal);
+    vertex.uv       = glm::packHalf2x16(uv);
+    vertex.material = material;
+    return vertex;
+}
+
+struct GpuVertexHash {
+    size_t operator()(const GpuVertex &vertex) const
+    {
+        unsigned words[sizeof(GpuVertex) / sizeof(unsigned)];
+        memcpy(words, &vertex, sizeof(words));
+        size_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+            hash = (hash ^ words[i]) * 16777619u;
+        }
+        return hash;
+    }
+};
+
+struct GpuVertexEqual {
+    bool operator()(const GpuVertex &a, const GpuVertex &b) const
+    {
+        return memcmp(&a, &b, sizeof(GpuVertex)) == 0;
+    }
+};
+
+// Welds count corners into distinct vertices, appended to vertices, and
+// appends to indices the vertex of each corner, in order.
+static void GpuVertexWeld(const GpuVertex *corners, size_t count, std::vector<GpuVertex> *vertices, std::vector<unsigned> *indices)
+{
+    std::unordered_map<GpuVertex, unsigned, GpuVertexHash, GpuVertexEqual> welded;
+    welded.reserve(count / 2);
+    indices->reserve(indices->size() + count);
+    for (size_t i = 0; i < count; i++) {
+        std::pair<std::unordered_map<GpuVertex, unsigned, GpuVertexHash, GpuVertexEqual>::iterator, bool> found =
+            welded.insert(std::make_pair(corners[i], (unsigned)vertices->size()));
+        if (found.second) {
+            vertices->push_back(corners[i]);
+        }
+        indices->push_back(found.first->second);
+    }
+}
+
+// Describes GpuVertex to the attributes of a vertex array, read from the
+// buffer bound to binding.
+static void GpuVertexFormat(GLuint vertex_array, GLuint binding)
+{
+    glVertexArrayAttribFormat (vertex_array, GPU_VERTEX_POSITION, 3, GL_FLOAT,      GL_FALSE, offsetof(GpuVertex, position));
+    glVertexArrayAttribFormat (vertex_array, GPU_VERTEX_NORMAL,   2, GL_SHORT,      GL_TRUE,  offsetof(GpuVertex, normal));
+    glVertexArrayAttribFormat (vertex_array, GPU_VERTEX_UV,       2, GL_HALF_FLOAT, GL_FALSE, offsetof(GpuVertex, uv));
+    glVertexArrayAttribIFormat(vertex_array, GPU_VERTEX_MATERIAL, 1, GL_UNSIGNED_INT,         offsetof(GpuVertex, material));
+    GLuint attributes[] = { GPU_VERTEX_POSITION, GPU_VERTEX_NORMAL, GPU_VERTEX_UV, GPU_VERTEX_MATERIAL };
+    for (size_t i = 0; i < sizeof(attributes) / sizeof(attributes[0]); i++) {
+        glVertexArrayAttribBinding(vertex_array, attributes[i], binding);
+        glEnableVertexArrayAttrib(vertex_array, attributes[i]);
+    }
+}
+
+#endif // _VERTEX_FORMAT_H
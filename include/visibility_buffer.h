@@ -0,0 +1,117 @@
+#ifndef _VISIBILITY_BUFFER_H
+#define _VISIBILITY_BUFFER_H
+
+#include "gbuffer.h"
+#include "parallel.h"
+
+// Visibility buffer of Close2GL: the raster stores per pixel only the depth
+// and the index of the nearest triangle in the list of the triangles drawn in
+// the frame, 8 bytes in all. The list keeps their screen positions and vertex
+// attributes, copied while the raster has them in cache, so the resolve pass
+// finds the barycentric coordinates of each pixel center in its triangle,
+// interpolates the attributes there and shades the pixel once with the
+// lighting of the G-buffer, without going back to the model.
+struct VisibilityBuffer {
+    int       width;
+    int       height;
+    float    *depth; // FLT_MAX where nothing was drawn
+    unsigned *id;    // index in the drawn triangles, meaningless where nothing was drawn
+};
+
+// A triangle as it was drawn.
+struct VisibilityTriangle {
+    glm::vec2 screen[3];
+    glm::vec3 normals[3];
+    glm::vec2 uvs[3];
+    unsigned  material;
+};
+
+static void VisibilityResize(VisibilityBuffer *buffer, int width, int height)
+{
+    if (buffer->depth && buffer->width == width && buffer->height == height) {
+        return;
+    }
+    free(buffer->depth);
+    free(buffer->id);
+    buffer->width  = width;
+    buffer->height = height;
+    buffer->depth  = (float*)malloc((size_t)width * height * sizeof(float));
+    buffer->id     = (unsigned*)malloc((size_t)width * height * sizeof(unsigned));
+}
+
+static DepthTarget VisibilityDepth(const VisibilityBuffer &buffer)
+{
+    DepthTarget target = { buffer.width, buffer.height, buffer.depth };
+    return target;
+}
+
+// Rasterizes a triangle in screen space (as DepthRasterTriangle()) and
+// stores id where it is nearest. Returns the number of pixels written.
+static unsigned VisibilityRasterTriangle(VisibilityBuffer *buffer, const glm::vec3 *screen, unsigned id, float facing)
+{
+    RasterSetup setup;
+    if (!RasterSetupTriangle(buffer->width, buffer->height, screen[0], screen[1], screen[2], facing, &setup)) {
+        return 0;
+    }
+    unsigned written = 0;
+    auto fragments = [&](int x, int y, int mask) {
+        unsigned *ids = buffer->id + (size_t)y * buffer->width + x;
+        for (int i = 0; mask != 0; i++, mask >>= 1) {
+            if (mask & 1) {
+                ids[i]   = id;
+                written += 1;
+            }
+        }
+    };
+    RasterSpans(VisibilityDepth(*buffer), setup, RasterPlane(setup, screen[0].z, screen[1].z, screen[2].z), fragments);
+    return written;
+}
+
+// Shades every covered pixel into lighting.rgb, the rows split in bands
+// between up to max_threads threads. Like Close2GL the attributes are
+// interpolated linearly in screen space.
+static void VisibilityResolve(const VisibilityBuffer &buffer, const VisibilityTriangle *triangles,
+                              const GBufferLighting &lighting, int max_threads)
+{
+    DisplayTable(); // built before the threads read it
+    ParallelForRowBands(buffer.width, buffer.height, max_threads, [&](int first, int last) {
+        // one row of G-buffer, filled from the triangles and lit at once
+        std::vector<unsigned>       normal(buffer.width);
+        std::vector<unsigned>       uv(buffer.width);
+        std::vector<unsigned short> material(buffer.width);
+        const VisibilityTriangle *drawn = NULL;
+        glm::vec2 origin, edge1, edge2;
+        float     inv_area = 0.0f;
+        for (int y = first; y < last; y++) {
+            size_t       index = (size_t)y * buffer.width;
+            const float *depth = buffer.depth + index;
+            float        py    = y + 0.5f;
+            for (int x = 0; x < buffer.width; x++) {
+                if (depth[x] > 1.0f) {
+                    continue;
+                }
+                if (drawn != triangles + buffer.id[index + x]) {
+                    // neighbouring pixels mostly share a triangle
+                    drawn    = triangles + buffer.id[index + x];
+                    origin   = drawn->screen[0];
+                    edge1    = drawn->screen[1] - origin;
+                    edge2    = drawn->screen[2] - origin;
+                    inv_area = 1.0f / (edge1.x * edge2.y - edge1.y * edge2.x);
+                }
+                glm::vec2 d  = glm::vec2(x + 0.5f, py) - origin;
+                float     b1 = (d.x * edge2.y - d.y * edge2.x) * inv_area;
+                float     b2 = (edge1.x * d.y - edge1.y * d.x) * inv_area;
+                float     b0 = 1.0f - b1 - b2;
+                glm::vec3 n  = b0 * drawn->normals[0] + b1 * drawn->normals[1] + b2 * drawn->normals[2];
+                glm::vec2 t  = b0 * drawn->uvs[0]     + b1 * drawn->uvs[1]     + b2 * drawn->uvs[2];
+                normal[x]    = GBufferPackNormal(n);
+                uv[x]        = GBufferPackUV(t.x, t.y);
+                material[x]  = (unsigned short)drawn->material;
+            }
+            GBufferRow row = { depth, normal.data(), uv.data(), material.data(), lighting.rgb + index * lighting.rgb_stride };
+            GBufferLightRow(lighting, y, buffer.width, row);
+        }
+    });
+}
+
+#endif // _VISIBILITY_BUFFER_H
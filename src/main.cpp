@@ -24,7 +24,9 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <string>
 #include <vector>
+#include <chrono>
 
 #include <math.h>
 #include <float.h>
@@ -33,6 +35,20 @@
 #include <stb_image.h>
 
 #include "matrices.h"
+#include "gpu_timer.h"
+#include "uniform_ring.h"
+#include "program_cache.h"
+#include "input_log.h"
+#include "bvh.h"
+#include "meshlet.h"
+#include "hiz.h"
+#include "radix_sort.h"
+#include "depth_raster.h"
+#include "display_encode.h"
+#include "gbuffer.h"
+#include "visibility_buffer.h"
+#include "vertex_format.h"
+#include "texture_loader.h"
 
 
 // Windows procedures
@@ -60,6 +76,7 @@
 #define PROC_NEAREST_NEIGHBOUR 21
 #define PROC_BILINEAR 22
 #define PROC_MIPMAPPING 23
+#define PROC_OVERDRAW 24
 
 #define BUFFER_SIZE 100
 
@@ -70,6 +87,15 @@
 #define CH_G 1
 #define CH_B 2
 
+#define OVERDRAW_HEAT_SCALE 8 // depth complexity shown as red in the heat map
+#define DEPTH_TILE_SHIFT    3 // depth bounds are kept per 8x8 pixel tile
+#define DEPTH_TILE_SIZE     (1 << DEPTH_TILE_SHIFT)
+#define DEPTH_TILE_EPSILON  1e-5f // interpolated depths may fall slightly outside the vertex depths
+#define DEPTH_TILE_SPARSE   8     // triangles filling less than 1/8 of their bounding box only lower the floor
+#define DEPTH_SORT_BITS     16    // precision of the view depth the meshlets are sorted by
+#define DEPTH_SORT_PROBE    60    // frames between checks that the front-to-back sort still pays
+#define REGRESS_SKIPPED     77    // exit status of --regress when only time checks were skipped, as CTest skips
+
 
 struct TriangleVertex {
     glm::vec3 pos;
@@ -83,6 +109,7 @@ struct Triangle {
     TriangleVertex v1;
     TriangleVertex v2;
     glm::vec3 face_normal;
+    unsigned  material;  // of the first vertex
 };
 
 struct ModelObject {
@@ -94,6 +121,10 @@ struct ModelObject {
     glm::vec3 *specular_color;
     float     *material_shine;
     Triangle  *triangles;
+    BvhNode   *bvh_nodes; // built by ReadModelFile(), which also reorders the triangles
+    int        num_bvh_nodes;
+    Meshlet   *meshlets;  // leaves of bvh_nodes
+    int        num_meshlets;
 };
 
 struct TextureObject {
@@ -101,23 +132,64 @@ struct TextureObject {
     int            height;
     int            width;
     int            channels;
+    BlockTexture   blocks;      // level 0 block compressed, sampled instead of textureData when it has a format
 };
 
-struct SceneObject {
-    const char *name;        
-    void       *first_index; 
-    int         num_indices; 
-    GLenum      rendering_mode;
+// A model of the scene. Its welded vertices and its indices are in the arena
+// of the scene, triangle i at indices first_index + 3i to first_index + 3i + 2.
+struct SceneMesh {
+    ModelObject model;
+    unsigned    first_index;
+    unsigned    base_vertex;
     glm::vec3   min_coord;
     glm::vec3   max_coord;
+    glm::mat4   center_matrix; // ComputeModelMatrix()
+};
+
+// A placement of a mesh. The matrices include the center_matrix of the mesh.
+struct SceneInstance {
+    unsigned  mesh;
+    glm::mat4 model_matrix;
+    glm::mat4 normal_matrix;
+    glm::vec4 color;           // w = 0 for the color of the interface
+};
+
+// glMultiDrawElementsIndirect() command
+struct DrawElementsCommand {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint  base_vertex;
+    GLuint base_instance;
+};
+
+// What the OpenGL path draws: meshes packed in one vertex and index arena and
+// instances of them, drawn with a single indirect multi-draw per frame. Mesh 0
+// is g_Model, the model Close2GL renders.
+struct Scene {
+    std::vector<SceneMesh>     meshes;
+    std::vector<SceneInstance> instances;
+    GLenum                     rendering_mode;
+    GLuint                     vertex_array;
+    GLuint                     vertex_buffer;     // the arena, grown by doubling
+    GLuint                     index_buffer;
+    size_t                     vertex_count;
+    size_t                     vertex_capacity;
+    size_t                     index_count;
+    size_t                     index_capacity;
+    GLuint                     instance_buffer;   // 0, 1, 2...: instance_index of triangles.vert
+    std::vector<std::vector<unsigned> > visible;  // instances of each mesh drawn in the frame
+    std::vector<DrawElementsCommand>    commands;
+    size_t                     triangles;         // in all the instances
 };
 
+// Color in linear light, DisplayLinear() fixed point, encoded for the display
+// by EncodeColorBuffer() and WritePPM().
 struct ScreenPixel {
-    unsigned char r;
-    unsigned char g;
-    unsigned char b;
-    unsigned char a;
-    float         z;
+    unsigned short r;
+    unsigned short g;
+    unsigned short b;
+    float          z;
 };
 
 struct ColorBuffer {
@@ -126,21 +198,111 @@ struct ColorBuffer {
     ScreenPixel *pixels;
 };
 
+// Bounds of the depths stored in a tile of the color buffer. Both only ever
+// move towards the camera: min with every triangle drawn over the tile, max
+// when a triangle covers the whole tile.
+struct DepthTile {
+    float min;
+    float max;
+};
+
+struct DepthTileBuffer {
+    int        width;  // in tiles
+    int        height;
+    float      floor;  // nearest depth of large triangles, a bound for the min of every tile
+    DepthTile *tiles;
+};
+
+// Front-to-back sort of the meshlets of Close2GL. Every DEPTH_SORT_PROBE
+// frames one frame is drawn the other way, and the shaded fragments of the
+// two frames tell what the sort saves.
+struct DepthSortBudget {
+    bool     enabled;        // the sort saved more than it cost at the last probe
+    bool     sorted;         // the current frame was sorted
+    int      frames;         // since the last probe
+    unsigned last_fragments; // shaded fragments and raster time of the last frame
+    double   last_ms;
+    double   sort_ms;        // the last sort
+    double   saved_ms;       // estimated at the last probe
+};
+
+struct OverdrawBuffer {
+    int       width;
+    int       height;
+    unsigned *tests;  // depth tests per pixel
+    unsigned *passes; // depth tests that passed, i.e. shaded fragments
+};
+
+struct OverdrawStats {
+    int      covered_pixels;
+    unsigned max_tests;
+    float    average_tests;  // depth complexity over the covered pixels
+    float    average_passes;
+    float    overwritten;    // fraction of shaded fragments overwritten later
+};
+
+// Everything the Win32 controls change, recorded by the input log. Changing it
+// changes the payload of INPUT_EVENT_UI_STATE, so INPUT_LOG_VERSION too.
+struct UiState {
+    bool  use_close2gl;
+    bool  points;
+    bool  wireframe;
+    bool  solid;
+    bool  cw;
+    bool  gouraud;
+    bool  phong;
+    bool  texture;
+    bool  nearest;
+    bool  linear;
+    bool  mipmapping;
+    bool  overdraw;
+    bool  look_at;
+    bool  reset_camera;
+    int   vertex_shader_type;
+    int   fragment_shader_type;
+    float near_plane;
+    float far_plane;
+    float hfov;
+    float vfov;
+    float red;
+    float green;
+    float blue;
+    float camera_theta;
+    float camera_phi;
+    float camera_distance;
+};
+
+struct HeadlessCamera {
+    float theta;
+    float phi;
+    float distance;
+};
+
 inline int getIndexColorBuffer(ColorBuffer buffer, int i, int j)
 {
     return (i + (j * buffer.width));
 }
 
-int getIndexTexture(TextureObject texture, float tx, float ty, int ch) // nearest neighbour
+// Channel ch of texel (x, y), from the blocks when the texture is compressed.
+inline int getTexel(const TextureObject &texture, int x, int y, int ch)
+{
+    if (texture.blocks.format != BLOCK_FORMAT_NONE) {
+        return BlockFetch(texture.blocks, x, y)[ch];
+    }
+    return texture.textureData[ch + texture.channels * (x + y*texture.width)];
+}
+
+int getTextureColourNearest(const TextureObject &texture, float tx, float ty, int ch)
 {   // ch 0 = r, 1 = g, 2 = b
-    int x = round(tx * (texture.width-1));
-    int y = round(ty * (texture.height-1));
-    return (ch + (texture.channels * (x + y*texture.width)));
+    // interpolated coordinates may fall slightly outside [0,1] at the edges
+    tx = glm::clamp(tx, 0.0f, 1.0f);
+    ty = glm::clamp(ty, 0.0f, 1.0f);
+    return getTexel(texture, round(tx * (texture.width-1)), round(ty * (texture.height-1)), ch);
 }
 
 
 // global variables
-std::map<const char*, SceneObject> g_VirtualScene;
+Scene g_Scene;
 double g_LastCursorPosX, g_LastCursorPosY;
 float g_ScreenRatio;
 float g_CameraTheta    = 0.0f;
@@ -155,6 +317,8 @@ float g_hFov  = glm::radians(50.0f);
 float g_vFov  = glm::radians(37.5f);
 bool g_LeftMouseButtonPressed = false;
 bool g_ResetCamera      = false;
+bool g_Redraw           = true;  // the camera, the model, the texture or a toggle changed since the last frame
+bool g_Present          = false; // the window needs the last frame again, as it was
 bool g_W_pressed        = false;
 bool g_A_pressed        = false;
 bool g_S_pressed        = false;
@@ -173,10 +337,50 @@ bool g_ToggleTexture    = false;
 bool g_ToggleNearest    = true;
 bool g_ToggleLinear     = false;
 bool g_ToggleMipMapping = false;
+bool g_ToggleOverdraw   = false;
+bool g_ToggleOcclusion  = true; // hierarchical Z occlusion culling in Close2GL
+bool g_ToggleTileDepth  = false; // per 8x8 tile depth bounds tested by every triangle in Close2GL
+bool g_ToggleSort       = false; // front-to-back sort of the meshlets in Close2GL
+bool g_ToggleDepthOnly  = false; // headless: render only the depth with RasterizeDepth()
+bool g_ToggleVisibility = false; // deferred Close2GL frames use the visibility buffer, not the G-buffer
 int g_ScreenWidth  = 800;
 int g_ScreenHeight = 600;
 
-ColorBuffer g_ColorBuffer;
+ColorBuffer    g_ColorBuffer;
+
+// triangle ranges of g_Model inside the view frustum, filled by CullModel()
+std::vector<BvhRange>    g_VisibleRanges;
+std::vector<BvhRange>    g_VisibleMeshlets;
+unsigned                 g_VisibleTriangles  = 0;
+unsigned                 g_FrustumMeshlets   = 0; // meshlets inside the frustum
+unsigned                 g_BackfaceMeshlets  = 0; // of those, the ones facing away
+unsigned                 g_OccludedMeshlets  = 0; // hidden by the depth pyramid of Close2GL
+std::vector<unsigned>    g_CandidateMeshlets;     // inside the frustum and facing the camera
+// occlusion culling of Close2GL, see RasterizeClose2GL()
+HizPyramid                 g_Hiz;
+std::vector<unsigned char> g_MeshletVisible;     // per meshlet of g_Model, in the last frame
+std::vector<unsigned>      g_DrawnMeshlets;
+// per triangle depth tests of Close2GL, see DrawTriangle()
+DepthTileBuffer g_DepthTiles;
+bool            g_DepthTilePass       = false; // the triangle being drawn is in front of every pixel
+unsigned        g_TileHiddenTriangles = 0;
+unsigned        g_TileFrontTriangles  = 0;
+// front-to-back sort of Close2GL, see SortMeshlets()
+DepthSortBudget        g_DepthSort = { true };
+bool                   g_DepthSortProbe = true; // off in --render and --regress, which must draw every frame alike
+std::vector<RadixItem> g_SortItems;
+std::vector<RadixItem> g_SortScratch;
+unsigned               g_ShadedFragments = 0; // depth tests passed in the last frame
+std::vector<float>     g_DepthPlane;          // target of the headless depth only frames
+// deferred Phong shading of Close2GL, see RasterizeClose2GL()
+GBuffer                         g_GBuffer;
+VisibilityBuffer                g_Visibility;
+std::vector<VisibilityTriangle> g_VisibilityTriangles; // drawn into g_Visibility in this frame
+bool                            g_Deferred   = false; // the current frame goes through g_GBuffer or g_Visibility
+std::vector<glm::vec3>          g_Materials;          // base color of each material of g_Model
+double                          g_LightingMs = 0.0;   // lighting or resolve pass of the last deferred frame
+OverdrawBuffer g_Overdraw;
+OverdrawStats  g_OverdrawStats;
 
 glm::mat4 g_ModelMatrix;
 glm::mat4 g_ViewMatrix;
@@ -187,17 +391,91 @@ char g_TextureFilename[FILENAME_MAX];
 ModelObject g_Model;
 
 TextureObject g_Texture;
+TextureLoader g_TextureLoader;
+int g_TextureFormat = BLOCK_FORMAT_BC7;        // BLOCK_FORMAT_ of the images loaded, --texture-format
+std::vector<unsigned char> g_TextureBlocks;    // g_Texture.blocks of the headless renders
 
 GLFWwindow *g_GLWindow;
 GLuint g_VertexArrayObject_id;
-GLint  g_UseClose2GLLocation;
-GLint  g_UseTextureLocation;
 GLuint g_Texture_id;
 
-GLint g_VertexShaderTypeLocation;
-GLint g_FragmentShaderTypeLocation;
-int   g_VertexShaderType;
-int   g_FragmentShaderType;
+GpuTimer g_GpuTimer;
+double   g_CpuFrameSeconds  = 0.0; // accumulated between fps reports
+double   g_CpuRasterSeconds = 0.0;
+bool     g_PrintTimings     = false;
+
+InputLog g_InputLog;
+double   g_InputLogStart;
+UiState  g_RecordedUiState; // last UI state written to the log
+char     g_RecordedModelFilename[FILENAME_MAX];
+char     g_RecordedTextureFilename[FILENAME_MAX];
+
+int g_VertexShaderType;
+int g_FragmentShaderType;
+
+// triangles.vert and triangles.frag compiled for one combination of the mode
+// toggles, so the shaders branch on nothing at run time
+struct GpuProgram {
+    GLuint program_id;
+};
+
+// key of a GpuProgram: the shading in the low bits, then the toggles
+#define GPU_PROGRAM_GOURAUD_AD    1
+#define GPU_PROGRAM_GOURAUD_ADS   2
+#define GPU_PROGRAM_PHONG         3
+#define GPU_PROGRAM_SHADING_MASK  3
+#define GPU_PROGRAM_TEXTURE       4
+#define GPU_PROGRAM_CLOSE2GL_BLIT 8 // alone, the quad showing the Close2GL color buffer
+
+std::map<unsigned, GpuProgram> g_GpuPrograms; // built when first used
+GpuProgram *g_GpuProgram = NULL;              // the one of the current toggles
+ProgramCache g_ProgramCache;                  // binaries of the linked programs, across launches
+
+// The per frame uniform block (std140) and per instance storage of the
+// shaders, computed on the CPU so no vertex or fragment inverts matrices.
+struct FrameUniforms {
+    glm::mat4 view_projection;
+    glm::vec4 camera_position;
+    glm::vec4 light_direction;
+};
+
+// instances[] of triangles.vert (std430)
+struct InstanceData {
+    glm::mat4 model_matrix;
+    glm::mat4 normal_matrix;
+    glm::vec4 color_vector;
+};
+#define FRAME_UNIFORMS_BINDING 0
+#define INSTANCE_DATA_BINDING  0 // shader storage
+#define SCENE_MAX_INSTANCES    16384 // drawn in a frame
+#define SCENE_MAX_DRAWS        16384 // indirect commands in a frame
+
+UniformRing g_UniformRing;
+
+// GL objects that outlive the mode toggles: a toggle only rebinds them or
+// changes draw state, and data is uploaded again only when it changes.
+#define TEXTURE_FILTER_NEAREST  0
+#define TEXTURE_FILTER_BILINEAR 1
+#define TEXTURE_FILTER_MIPMAP   2
+
+#define TEXTURE_UNIT_FRAME 0 // textureC2GL of triangles.frag
+#define TEXTURE_UNIT_IMAGE 1 // textureSampler
+
+struct GpuResidency {
+    const Triangle *bounds_triangles;  // the model of min_coord and max_coord, NULL if none
+    glm::vec3       min_coord;
+    glm::vec3       max_coord;
+    GLuint          quad_vertex_array; // the quad showing the Close2GL frame
+    GLuint          quad_buffer;
+    GLuint          frame_texture;     // the Close2GL frame
+    int             frame_width;
+    int             frame_height;
+    GLuint          frame_sampler;
+    GLuint          image_texture;     // of g_Texture, owned by g_TextureLoader
+    GLuint          image_samplers[3]; // one per TEXTURE_FILTER_
+};
+
+GpuResidency g_Resident;
 
 HWND w_ToggleCW         = NULL;
 HWND w_ToggleCCW        = NULL;
@@ -221,56 +499,151 @@ HWND w_ToggleTexture    = NULL;
 HWND w_ToggleNearest    = NULL;
 HWND w_ToggleBilinear   = NULL;
 HWND w_ToggleMipMapping = NULL;
+HWND w_ToggleOverdraw   = NULL;
 
 // callback functions
 void ErrorCallback(int error, const char *description);
 void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mod);
 void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods);
+void HandleMouseButton(int button, int action, double xpos, double ypos);
 void CursorPosCallback(GLFWwindow *window, double xpos, double ypos);
 void FramebufferSizeCallback(GLFWwindow *window, int width, int height);
+void WindowRefreshCallback(GLFWwindow *window);
 
 // shader functions
 void   LoadTextureImage(const char *filename);
-void   LoadTexture(unsigned char *textureData, int width, int height);
-void   LoadShader(const char *filename, GLuint shader_id);
-GLuint LoadShader_Vertex(const char *filename);
-GLuint LoadShader_Fragment(const char *filename);
+void   ShowTextureImage(TextureImage *image);
+void   ReadTextureImage(const char *filename);
+int    ParseTextureFormat(const char *name);
+void   UploadFrameTexture(unsigned char *textureData, int width, int height);
+void   SelectTextureFilter();
+void   FreeModel(ModelObject *model);
+void   EvictModel();
+GLuint ResidentModel(const ModelObject &model);
+void   SceneInit();
+void   SceneClear();
+unsigned SceneAddMesh(const ModelObject &model);
+void   SceneAddInstance(unsigned mesh, glm::mat4 transform, glm::vec4 color);
+void   DrawScene(glm::mat4 projection, glm::mat4 view);
+bool   LoadScene(const char *filename);
+std::string ReadShader(const char *filename, const char *defines);
+void   LoadShader(const char *filename, GLuint shader_id, const std::string &source);
+GLuint LoadShader_Vertex(const char *filename, const std::string &source);
+GLuint LoadShader_Fragment(const char *filename, const std::string &source);
 GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id);
+GpuProgram *LoadGpuProgram(unsigned key);
+void   SelectGpuProgram();
 
 void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::vec3 c2, glm::vec3 c3);
 GLuint      BuildTriangles(ModelObject model);
 ModelObject ReadModelFile(char *filename);
+void        BuildModelBvh(ModelObject *model);
+void        CullModel(ModelObject model, glm::mat4 projection, glm::mat4 view_model);
+void        ComputeModelBounds(ModelObject model, glm::vec3 *min_coord, glm::vec3 *max_coord);
+glm::mat4   ComputeModelMatrix(glm::vec3 min_coord, glm::vec3 max_coord);
+
+// software renderer functions
+void ClearColorBuffer();
+void RasterizeTriangle(const Triangle &triangle);
+void RasterizeTriangleDeferred(const Triangle &triangle);
+bool UseDeferredShading();
+void BuildDepthPyramid();
+void ShadeDeferred();
+void SortMeshlets(ModelObject model, glm::mat4 view_model);
+void RasterizeClose2GL(ModelObject model);
+void RasterizeMeshlets(ModelObject model);
+void RasterizeDepth(ModelObject model, glm::mat4 matrix, DepthTarget target, float facing);
+void ShowDepthPlane(DepthTarget target);
+void ResolveOverdraw();
+void WritePPM(const char *filename, ColorBuffer buffer);
+void EncodeColorBuffer(ColorBuffer buffer, unsigned char *rgba);
+void SetupCamera(float theta, float phi, float distance);
+void ResetRenderOptions();
+bool ParseRenderOptions(int argc, char **argv, int first, HeadlessCamera *camera);
+void LoadHeadlessModel(const char *filename);
+double RenderHeadlessFrame();
+int  RenderHeadless(int argc, char **argv);
+bool ReadPPM(const char *filename, int *width, int *height, std::vector<unsigned char> *rgb);
+int  RunRegression(int argc, char **argv);
 
 void ShowFramesPerSecond();
 
+float   InputLogTime();
+UiState CaptureUiState();
+void    ApplyUiState(UiState state);
+void    RecordUiState(bool force);
+void    ReplayInputEvents();
+
 // windows.h functions
 LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp);
 void    AddMenus(HWND hWnd, HMENU hMenu);
 void    AddControls(HWND hWnd);
 int     OpenFile(HWND hWnd);
 
-int getTextureColourBilinear(TextureObject texture, float tx, float ty, int ch)
+int getTextureColourBilinear(const TextureObject &texture, float tx, float ty, int ch)
 {
+    tx = glm::clamp(tx, 0.0f, 1.0f);
+    ty = glm::clamp(ty, 0.0f, 1.0f);
     int x0 = floor(tx * (texture.width-1));
     int x1 = ceil (tx * (texture.width-1));
     int y0 = floor(ty * (texture.height-1));
     int y1 = ceil (ty * (texture.height-1));
     
-    int i0 = (ch + (texture.channels * (x0 + y0*texture.width)));
-    int i1 = (ch + (texture.channels * (x0 + y1*texture.width)));
-    int i2 = (ch + (texture.channels * (x1 + y0*texture.width)));
-    int i3 = (ch + (texture.channels * (x1 + y1*texture.width)));
-    
-    int t0 = g_Texture.textureData[i0];
-    int t1 = g_Texture.textureData[i1];
-    int t2 = g_Texture.textureData[i2];
-    int t3 = g_Texture.textureData[i3];
+    int t0 = getTexel(texture, x0, y0, ch);
+    int t1 = getTexel(texture, x0, y1, ch);
+    int t2 = getTexel(texture, x1, y0, ch);
+    int t3 = getTexel(texture, x1, y1, ch);
     
     return (t0 + t1 + t2 + t3)/4;
 }
 
+// Depth test used by every fragment of DrawTriangle, which counts the
+// fragments that pass and get shaded. Fragments of a triangle in front of all
+// the tiles it overlaps pass without reading the pixel. In overdraw mode it
+// also counts how many times each pixel was tested and written.
+inline bool DepthTest(int index, float z)
+{
+    bool pass = g_DepthTilePass || z < g_ColorBuffer.pixels[index].z;
+    g_ShadedFragments += pass ? 1 : 0;
+    if (g_ToggleOverdraw) {
+        g_Overdraw.tests[index]  += 1;
+        g_Overdraw.passes[index] += pass ? 1 : 0;
+    }
+    return pass;
+}
+
 int main( int argc, char** argv )
 {
+    if (argc > 1 && strcmp(argv[1], "--render") == 0) {
+        return RenderHeadless(argc, argv);
+    }
+    if (argc > 1 && strcmp(argv[1], "--regress") == 0) {
+        return RunRegression(argc, argv);
+    }
+    // CMP143 [--record <session.log> | --replay <session.log>] [--scene <scene.txt>]
+    //        [--texture-format rgb|bc1|bc7]
+    const char *scene_filename = NULL;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--scene") == 0) {
+            scene_filename = argv[i + 1];
+        } else if (strcmp(argv[i], "--texture-format") == 0) {
+            g_TextureFormat = ParseTextureFormat(argv[i + 1]);
+            if (g_TextureFormat < 0) {
+                fprintf(stderr, "ERROR: unknown texture format \"%s\".\n", argv[i + 1]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (argc > 2 && strcmp(argv[1], "--record") == 0) {
+        if (!InputLogOpen(&g_InputLog, argv[2], INPUT_LOG_RECORD)) {
+            return EXIT_FAILURE;
+        }
+    } else if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        if (!InputLogOpen(&g_InputLog, argv[2], INPUT_LOG_REPLAY)) {
+            return EXIT_FAILURE;
+        }
+    }
+
     // initialize win32 window
     WNDCLASSW wc = { 0 }; // define window class
     wc.style = CS_HREDRAW | CS_VREDRAW;
@@ -335,6 +708,7 @@ int main( int argc, char** argv )
     glfwSetMouseButtonCallback(g_GLWindow, MouseButtonCallback);
     glfwSetCursorPosCallback(g_GLWindow, CursorPosCallback);
     glfwSetFramebufferSizeCallback(g_GLWindow, FramebufferSizeCallback);
+    glfwSetWindowRefreshCallback(g_GLWindow, WindowRefreshCallback);
     glfwSetWindowSize(g_GLWindow, 800, 600);
     g_ScreenRatio = 800.0f/600.0f;
 
@@ -342,35 +716,26 @@ int main( int argc, char** argv )
     
     // load shaders
     gl3wInit();
-    GLuint vertex_shader_id = LoadShader_Vertex("../triangles.vert");
-    GLuint fragment_shader_id = LoadShader_Fragment("../triangles.frag");
-    GLuint program_id = CreateGpuProgram(vertex_shader_id, fragment_shader_id);
-
-    GLint modelMatrixLocation      = glGetUniformLocation(program_id, "modelMatrix"     );
-    GLint viewMatrixLocation       = glGetUniformLocation(program_id, "viewMatrix"      );
-    GLint projectionMatrixLocation = glGetUniformLocation(program_id, "projectionMatrix");
-    GLint colorVectorLocation      = glGetUniformLocation(program_id, "colorVector"     );
-    GLint textureSamplerLocation   = glGetUniformLocation(program_id, "textureSampler"  );
-    GLint textureC2GLLocation      = glGetUniformLocation(program_id, "textureC2GL"     );
-    
-    g_VertexShaderTypeLocation   = glGetUniformLocation(program_id, "vertexShaderType");
-    g_FragmentShaderTypeLocation = glGetUniformLocation(program_id, "fragmentShaderType");
+    ProgramCacheOpen(&g_ProgramCache, "../gpu_programs.cache");
     g_VertexShaderType   = 0;
     g_FragmentShaderType = 0;
-    
-    g_UseClose2GLLocation  = glGetUniformLocation(program_id, "useClose2GL");
-    g_UseTextureLocation   = glGetUniformLocation(program_id, "useTexture");
+    SelectGpuProgram();
+    // the frame, the instances, the draws and the texture rows staged in a frame, one range per mip level
+    UniformRingInit(&g_UniformRing, sizeof(FrameUniforms) + SCENE_MAX_INSTANCES * sizeof(InstanceData) +
+                    SCENE_MAX_DRAWS * sizeof(DrawElementsCommand) + TEXTURE_UPLOAD_BUDGET, 3 + 32);
+    if (!TextureFormatSupported(g_TextureFormat)) {
+        fprintf(stderr, "WARNING: GL_EXT_texture_compression_s3tc is not supported, loading textures as bc7.\n");
+        g_TextureFormat = BLOCK_FORMAT_BC7;
+    }
+    TextureLoaderInit(&g_TextureLoader);
+    SceneInit();
     g_VertexArrayObject_id = -1;
 
     glFrontFace(GL_CW);
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
-    
-    glUniform1i(g_UseClose2GLLocation       , g_UseClose2GL       );
-    glUniform1i(g_VertexShaderTypeLocation  , g_VertexShaderType  );
-    glUniform1i(g_FragmentShaderTypeLocation, g_FragmentShaderType);
-    glUniform1i(textureC2GLLocation,    (GLuint)0);
-    glUniform1i(textureSamplerLocation, (GLuint)1);
+
+    GpuTimerInit(&g_GpuTimer);
     
     //initialize back and front buffers
     g_ColorBuffer.width  = g_ScreenWidth;
@@ -381,10 +746,9 @@ int main( int argc, char** argv )
     for (int i = 0; i < g_ScreenWidth; i++) {
         for (int j = 0; j < g_ScreenHeight; j++) {
             int index = getIndexColorBuffer(g_ColorBuffer, i, j);
-            g_ColorBuffer.pixels[index].r = 255;
-            g_ColorBuffer.pixels[index].g = 255;
-            g_ColorBuffer.pixels[index].b = 255;
-            g_ColorBuffer.pixels[index].a = 255;
+            g_ColorBuffer.pixels[index].r = DISPLAY_LINEAR_MAX;
+            g_ColorBuffer.pixels[index].g = DISPLAY_LINEAR_MAX;
+            g_ColorBuffer.pixels[index].b = DISPLAY_LINEAR_MAX;
             g_ColorBuffer.pixels[index].z = -FLT_MAX;
 
             baseTexture.push_back(255);
@@ -394,11 +758,45 @@ int main( int argc, char** argv )
         }
     }
     
-    LoadTexture(baseTexture.data(), g_ScreenWidth, g_ScreenHeight);
+    UploadFrameTexture(baseTexture.data(), g_ScreenWidth, g_ScreenHeight);
+
+    if (scene_filename) {
+        if (!LoadScene(scene_filename)) {
+            std::exit(EXIT_FAILURE);
+        }
+        g_VertexArrayObject_id = BuildTriangles(g_Model);
+    }
+
+    // frame 0 holds the state the session starts from
+    g_InputLogStart = glfwGetTime();
+    if (g_InputLog.mode == INPUT_LOG_RECORD) {
+        InputResizeEvent resize = { g_ScreenWidth, g_ScreenHeight };
+        InputLogWrite(&g_InputLog, INPUT_EVENT_RESIZE, &resize, sizeof(resize), InputLogTime());
+        RecordUiState(true);
+    } else if (g_InputLog.mode == INPUT_LOG_REPLAY) {
+        ReplayInputEvents();
+    }
+    g_InputLog.frame = 1;
     
+    // Frames are drawn on demand: with nothing changed, no camera key held, no
+    // texture upload going on and no session replaying, the loop sleeps in
+    // glfwWaitEvents() until an event marks g_Redraw (or g_Present, for a frame
+    // that only shows the last image again). A skipped frame still counts, so
+    // the events of the wait are logged before the frame they change, as the
+    // polled ones are.
     while (!glfwWindowShouldClose(g_GLWindow)) {
+        bool moving = g_W_pressed || g_A_pressed || g_S_pressed || g_D_pressed || g_Q_pressed || g_Z_pressed;
+        bool redraw = g_Redraw || moving || g_InputLog.mode == INPUT_LOG_REPLAY || TextureLoaderUploading(&g_TextureLoader);
+        if (!redraw && !g_Present) {
+            glfwWaitEvents();
+            g_InputLog.frame += 1;
+            continue;
+        }
+        g_Redraw  = false;
+        g_Present = false;
+        double frame_start = glfwGetTime();
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glUseProgram(program_id);
+        glUseProgram(g_GpuProgram->program_id);
 
         static const float background[] = { 1.0f, 1.0f, 1.0f, 0.0f };
         glClearBufferfv(GL_COLOR, 0, background);
@@ -409,7 +807,7 @@ int main( int argc, char** argv )
         float x = r*cos(g_CameraPhi)*sin(g_CameraTheta);
 
         static int ini = 0;
-        glm::vec4 camera_position_c;
+        static glm::vec4 camera_position_c; // moved by W/A/S/D/Q/Z from frame to frame
         if (!ini || g_ResetCamera) {
             camera_position_c = glm::vec4(x,y,z,1.0f);
             ini = 1;
@@ -483,77 +881,91 @@ int main( int argc, char** argv )
                
         g_ProjectionMatrix = Matrix_Perspective(g_vFov, g_hFov, g_ScreenRatio, g_NearPlane, g_FarPlane);
 
-        glUniformMatrix4fv(viewMatrixLocation,       1 , GL_FALSE , glm::value_ptr(g_ViewMatrix));
-        glUniformMatrix4fv(projectionMatrixLocation, 1 , GL_FALSE , glm::value_ptr(g_ProjectionMatrix));
+        UniformRingBegin(&g_UniformRing);
+        FrameUniforms frame;
+        frame.view_projection = g_ProjectionMatrix * g_ViewMatrix;
+        frame.camera_position = camera_position_c;
+        frame.light_direction = glm::normalize(glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
+        UniformRingPush(&g_UniformRing, FRAME_UNIFORMS_BINDING, &frame, sizeof(frame));
+        ShowTextureImage(TextureLoaderUpdate(&g_TextureLoader, &g_UniformRing));
 
         // rendering
         ShowFramesPerSecond();
         if (g_VertexArrayObject_id != -1) {
-            glUniform4f(colorVectorLocation, g_Red, g_Green, g_Blue, 1.0f);
-            float max_x = g_VirtualScene["model"].max_coord.x;
-            float max_y = g_VirtualScene["model"].max_coord.y;
-            float max_z = g_VirtualScene["model"].max_coord.z;
-            float min_x = g_VirtualScene["model"].min_coord.x;
-            float min_y = g_VirtualScene["model"].min_coord.y;
-            float min_z = g_VirtualScene["model"].min_coord.z;
-            float trans_x = (min_x + max_x) / 2;
-            float trans_y = (min_y + max_y) / 2;
-            float trans_z = (min_z + max_z) / 2;
-            float size_x  = (max_x - min_x);
-            float size_y  = (max_y - min_y);
-            float size_z  = (max_z - min_z);
-            float scaling_factor = size_x;
-            scaling_factor = (size_y > scaling_factor) ? size_y : scaling_factor;
-            scaling_factor = (size_z > scaling_factor) ? size_z : scaling_factor;
-
             if (g_UseClose2GL) {
-                g_VertexArrayObject_id = BuildTriangles(g_Model);                
+                // the frame texture still holds the last image when it only has to be shown again
+                if (redraw) {
+                    double raster_start = glfwGetTime();
+                    g_VertexArrayObject_id = BuildTriangles(g_Model);
+                    g_CpuRasterSeconds += glfwGetTime() - raster_start;
+                }
+                glBindVertexArray(g_VertexArrayObject_id);
+                GpuTimerBegin(&g_GpuTimer, GPU_TIMER_DRAW);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+            } else {
+                GpuTimerBegin(&g_GpuTimer, GPU_TIMER_DRAW);
+                DrawScene(g_ProjectionMatrix, g_ViewMatrix);
             }
-            glBindVertexArray(g_VertexArrayObject_id);
-
-            glm::vec3 objectTranslate = glm::vec3(-trans_x, -trans_y, -trans_z);
-            glm::vec3 objectScale = glm::vec3(4.0f / scaling_factor, 4.0f / scaling_factor, 4.0f / scaling_factor);
-            g_ModelMatrix = glm::mat4(1.0f);
-            g_ModelMatrix = glm::scale(g_ModelMatrix, objectScale);
-            g_ModelMatrix = glm::translate(g_ModelMatrix, objectTranslate);
-
-            glDrawElements(
-                g_VirtualScene["model"].rendering_mode,
-                g_VirtualScene["model"].num_indices,
-                GL_UNSIGNED_INT,
-                (void*)g_VirtualScene["model"].first_index
-            );
-
-            glUniformMatrix4fv(modelMatrixLocation, 1, GL_FALSE, glm::value_ptr(g_ModelMatrix));
+            GpuTimerEnd(&g_GpuTimer);
+
             glBindVertexArray(0);
         }
+        UniformRingEnd(&g_UniformRing);
         
+        g_CpuFrameSeconds += glfwGetTime() - frame_start;
+
+        GpuTimerBegin(&g_GpuTimer, GPU_TIMER_SWAP);
         glfwSwapBuffers(g_GLWindow);
+        GpuTimerEnd(&g_GpuTimer);
+        GpuTimerNextFrame(&g_GpuTimer);
         glfwPollEvents();
+        // replayed events are handled where the recorded ones were polled
+        if (g_InputLog.mode == INPUT_LOG_REPLAY) {
+            ReplayInputEvents();
+        }
+        g_InputLog.frame += 1;
     }
 
+    if (g_InputLog.mode == INPUT_LOG_RECORD) {
+        // tagged with the last frame drawn, so the replay stops after it too
+        g_InputLog.frame -= 1;
+        InputLogWrite(&g_InputLog, INPUT_EVENT_END, NULL, 0, InputLogTime());
+        printf("recorded %u frames in %.2f s\n", g_InputLog.frame, InputLogTime());
+    }
+    InputLogClose(&g_InputLog);
+
+    TextureLoaderShutdown(&g_TextureLoader);
     glfwDestroyWindow(g_GLWindow);
 
     glfwTerminate();
     return 0;
 }
 
-void LoadTexture(unsigned char *textureData, int width, int height)
+// Copies the Close2GL frame into the frame texture, which is only
+// reallocated when the window size changes.
+void UploadFrameTexture(unsigned char *textureData, int width, int height)
 {
-    GLuint texture_id;
-    GLuint sampler_id;
-    glGenTextures(1, &texture_id);
-    glGenSamplers(1, &sampler_id);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-    
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, textureData);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindSampler(0, sampler_id);
+    if (!g_Resident.frame_texture || g_Resident.frame_width != width || g_Resident.frame_height != height) {
+        if (!g_Resident.frame_sampler) {
+            // the quad covers the window, one texel per pixel
+            glCreateSamplers(1, &g_Resident.frame_sampler);
+            glSamplerParameteri(g_Resident.frame_sampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glSamplerParameteri(g_Resident.frame_sampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glBindSampler(TEXTURE_UNIT_FRAME, g_Resident.frame_sampler);
+        }
+        glDeleteTextures(1, &g_Resident.frame_texture);
+        glCreateTextures(GL_TEXTURE_2D, 1, &g_Resident.frame_texture);
+        glTextureStorage2D(g_Resident.frame_texture, 1, GL_RGBA8, width, height);
+        glBindTextureUnit(TEXTURE_UNIT_FRAME, g_Resident.frame_texture);
+        g_Resident.frame_width  = width;
+        g_Resident.frame_height = height;
+    }
+    GpuTimerBegin(&g_GpuTimer, GPU_TIMER_UPLOAD);
+    glTextureSubImage2D(g_Resident.frame_texture, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, textureData);
+    GpuTimerEnd(&g_GpuTimer);
 }
 
-void LoadTextureImage(const char *filename)
+void ReadTextureImage(const char *filename)
 {
     printf("Loading texture \"%s\"...\n", filename);
     stbi_set_flip_vertically_on_load(true);
@@ -564,44 +976,87 @@ void LoadTextureImage(const char *filename)
     g_Texture.width       = width;
     g_Texture.height      = height;
     g_Texture.channels    = channels;
+    g_Texture.blocks      = BlockTexture();
     
     if (g_Texture.textureData == NULL) {
         printf("Error loading texture\n");
         std::exit(EXIT_FAILURE);
     }
+}
+
+// BLOCK_FORMAT_ of "rgb", "bc1" or "bc7", -1 for any other name.
+int ParseTextureFormat(const char *name)
+{
+    if (strcmp(name, "rgb") == 0) return BLOCK_FORMAT_NONE;
+    if (strcmp(name, "bc1") == 0) return BLOCK_FORMAT_BC1;
+    if (strcmp(name, "bc7") == 0) return BLOCK_FORMAT_BC7;
+    return -1;
+}
+
+// Requests an image from g_TextureLoader. The frame loop shows it once its
+// decode and upload are done, the old texture until then; an image in the
+// cache is shown at once. The replay of a session waits for it, so its frames
+// see the texture from the same frame on. Changing the filter afterwards only
+// takes SelectTextureFilter().
+void LoadTextureImage(const char *filename)
+{
+    TextureImage *image = TextureLoaderRequest(&g_TextureLoader, filename, g_TextureFormat);
+    if (image->resident || g_InputLog.dispatching) {
+        ShowTextureImage(TextureLoaderFinish(&g_TextureLoader));
+    } else {
+        printf("Loading texture \"%s\"...\n", filename);
+    }
+}
 
-    GLuint texture_id;
-    GLuint sampler_id;
-    glGenTextures(1, &texture_id);
-    glGenSamplers(1, &sampler_id);
+// Makes a loaded image g_Texture and binds its texture. Does nothing for NULL.
+void ShowTextureImage(TextureImage *image)
+{
+    if (!image) {
+        return;
+    }
+    // level 0, owned by g_TextureLoader: the texels or, once compressed, the blocks
+    g_Texture.textureData    = image->texels.empty() ? NULL : image->texels.data();
+    g_Texture.width          = image->width;
+    g_Texture.height         = image->height;
+    g_Texture.channels       = 3;
+    g_Texture.blocks         = BlockTexture();
+    if (image->format != BLOCK_FORMAT_NONE) {
+        g_Texture.blocks.format = image->format;
+        g_Texture.blocks.width  = image->width;
+        g_Texture.blocks.height = image->height;
+        g_Texture.blocks.data   = image->blocks.data();
+        g_Texture.blocks.id     = image->id;
+    }
+    g_Resident.image_texture = image->texture;
+    glBindTextureUnit(TEXTURE_UNIT_IMAGE, image->texture);
+    SelectTextureFilter();
+    printf("Texture loaded.\n");
+}
 
+// Binds the sampler of the filter toggles to the image texture unit.
+void SelectTextureFilter()
+{
+    if (!g_Resident.image_samplers[0]) {
+        glCreateSamplers(3, g_Resident.image_samplers);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_NEAREST],  GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_NEAREST],  GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_BILINEAR], GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_BILINEAR], GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_MIPMAP],   GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glSamplerParameteri(g_Resident.image_samplers[TEXTURE_FILTER_MIPMAP],   GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+    int filter;
     if (g_ToggleNearest) {
         printf("Nearest\n");
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        filter = TEXTURE_FILTER_NEAREST;
     } else if (g_ToggleLinear) {
         printf("Bilinear\n");
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    } else if (g_ToggleMipMapping) {
+        filter = TEXTURE_FILTER_BILINEAR;
+    } else {
         printf("Mip mapping\n");
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glSamplerParameteri(sampler_id, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        filter = TEXTURE_FILTER_MIPMAP;
     }
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, g_Texture.textureData);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glBindSampler(0, sampler_id);
-
-  //  stbi_image_free(g_Texture.textureData);
-    printf("Texture loaded.\n");
+    glBindSampler(TEXTURE_UNIT_IMAGE, g_Resident.image_samplers[filter]);
 }
 
 ModelObject ReadModelFile(char *filename)
@@ -638,7 +1093,7 @@ ModelObject ReadModelFile(char *filename)
     }
     char textureType[10] = { 0 };
     fscanf(fp, "Texture = %s\n", textureType);
-    char ch;
+    char ch = 0;
     while (ch != '\n') {
         fscanf(fp, "%c", &ch);
     }
@@ -699,81 +1154,74 @@ ModelObject ReadModelFile(char *filename)
                 &model.triangles[i].face_normal.x,
                 &model.triangles[i].face_normal.y,
                 &model.triangles[i].face_normal.z);
+        model.triangles[i].material = color_index;
     }
 
     fclose(fp);
+    BuildModelBvh(&model);
     return model;
 }
 
-void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::vec3 c2, glm::vec3 c3, glm::vec2 t1, glm::vec2 t2, glm::vec2 t3)
+void DrawTriangleSpans(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::vec3 c2, glm::vec3 c3, glm::vec2 t1, glm::vec2 t2, glm::vec2 t3)
 {
     bool change = false;
-    // verificar se os três vertices estão dentro da tela
-    if (! (v1.x > 0 && v1.x < g_ScreenWidth && v1.y > 0 && v1.y < g_ScreenHeight &&
-           v2.x > 0 && v2.x < g_ScreenWidth && v2.y > 0 && v2.y < g_ScreenHeight &&
-           v3.x > 0 && v3.x < g_ScreenWidth && v3.y > 0 && v3.y < g_ScreenHeight)  ) {
-        return;
-    }
     
     if (g_TogglePoints) {
         int index = getIndexColorBuffer(g_ColorBuffer, floor(v1.x), floor(v1.y));
-        if (v1.z < g_ColorBuffer.pixels[index].z) {
+        if (DepthTest(index, v1.z)) {
             if (g_ToggleTexture) {
                 if (g_ToggleNearest) {
-                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_R)];
-                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_G)];
-                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_B)];
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_B));
                 } else if (g_ToggleLinear) {
-                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_R);
-                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_G);
-                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_B);
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_B));
                 }
             } else {
-                g_ColorBuffer.pixels[index].r = g_Red   * 255;
-                g_ColorBuffer.pixels[index].g = g_Green * 255;
-                g_ColorBuffer.pixels[index].b = g_Blue  * 255;
+                g_ColorBuffer.pixels[index].r = DisplayDecode(g_Red   * 255);
+                g_ColorBuffer.pixels[index].g = DisplayDecode(g_Green * 255);
+                g_ColorBuffer.pixels[index].b = DisplayDecode(g_Blue  * 255);
             }
-            g_ColorBuffer.pixels[index].a = 255;
             g_ColorBuffer.pixels[index].z = v1.z;
         }
         index = getIndexColorBuffer(g_ColorBuffer, floor(v2.x), floor(v2.y));
-        if (v2.z < g_ColorBuffer.pixels[index].z) {
+        if (DepthTest(index, v2.z)) {
             if (g_ToggleTexture) {
                 if (g_ToggleNearest) {
-                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_R)];
-                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_G)];
-                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_B)];
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_B));
                 } else if (g_ToggleLinear) {
-                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_R);
-                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_G);
-                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_B);
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_B));
                 }
             } else {
-                g_ColorBuffer.pixels[index].r = g_Red   * 255;
-                g_ColorBuffer.pixels[index].g = g_Green * 255;
-                g_ColorBuffer.pixels[index].b = g_Blue  * 255;
+                g_ColorBuffer.pixels[index].r = DisplayDecode(g_Red   * 255);
+                g_ColorBuffer.pixels[index].g = DisplayDecode(g_Green * 255);
+                g_ColorBuffer.pixels[index].b = DisplayDecode(g_Blue  * 255);
             }
-            g_ColorBuffer.pixels[index].a = 255;
             g_ColorBuffer.pixels[index].z = v2.z;
         }
         index = getIndexColorBuffer(g_ColorBuffer, floor(v3.x), floor(v3.y));
-        if (v3.z < g_ColorBuffer.pixels[index].z) {
+        if (DepthTest(index, v3.z)) {
             if (g_ToggleTexture) {
                 if (g_ToggleNearest) {
-                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_R)];
-                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_G)];
-                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_B)];
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_B));
                 } else if (g_ToggleLinear) {
-                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_R);
-                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_G);
-                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_B);
+                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_R));
+                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_G));
+                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_B));
                 }
             } else {
-                g_ColorBuffer.pixels[index].r = g_Red   * 255;
-                g_ColorBuffer.pixels[index].g = g_Green * 255;
-                g_ColorBuffer.pixels[index].b = g_Blue  * 255;
+                g_ColorBuffer.pixels[index].r = DisplayDecode(g_Red   * 255);
+                g_ColorBuffer.pixels[index].g = DisplayDecode(g_Green * 255);
+                g_ColorBuffer.pixels[index].b = DisplayDecode(g_Blue  * 255);
             }
-            g_ColorBuffer.pixels[index].a = 255;
             g_ColorBuffer.pixels[index].z = v3.z;
         }
         return;
@@ -781,63 +1229,60 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
     
     // desenhar primeiro os vertices
     int index = getIndexColorBuffer(g_ColorBuffer, floor(v1.x), floor(v1.y));
-    if (v1.z < g_ColorBuffer.pixels[index].z) {
+    if (DepthTest(index, v1.z)) {
         if (g_ToggleTexture) {
             if (g_ToggleNearest) {
-                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_R)];
-                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_G)];
-                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t1.x, t1.y, CH_B)];
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t1.x, t1.y, CH_B));
             } else if (g_ToggleLinear) {
-                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_R);
-                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_G);
-                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_B);
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t1.x, t1.y, CH_B));
             }        
         } else {
-            g_ColorBuffer.pixels[index].r = c1.x * 255;
-            g_ColorBuffer.pixels[index].g = c1.y * 255;
-            g_ColorBuffer.pixels[index].b = c1.z * 255;
+            g_ColorBuffer.pixels[index].r = DisplayLinear(c1.x);
+            g_ColorBuffer.pixels[index].g = DisplayLinear(c1.y);
+            g_ColorBuffer.pixels[index].b = DisplayLinear(c1.z);
         }
-        g_ColorBuffer.pixels[index].a = 255;
         g_ColorBuffer.pixels[index].z = v1.z;
     }
     index = getIndexColorBuffer(g_ColorBuffer, floor(v2.x), floor(v2.y));
-    if (v2.z < g_ColorBuffer.pixels[index].z) {
+    if (DepthTest(index, v2.z)) {
         if (g_ToggleTexture) {
             if (g_ToggleNearest) {
-                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_R)];
-                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_G)];
-                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t2.x, t2.y, CH_B)];
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t2.x, t2.y, CH_B));
             } else if (g_ToggleLinear) {
-                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_R);
-                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_G);
-                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_B);
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t2.x, t2.y, CH_B));
             }        
         } else {
-            g_ColorBuffer.pixels[index].r = c2.x * 255;
-            g_ColorBuffer.pixels[index].g = c2.y * 255;
-            g_ColorBuffer.pixels[index].b = c2.z * 255;
+            g_ColorBuffer.pixels[index].r = DisplayLinear(c2.x);
+            g_ColorBuffer.pixels[index].g = DisplayLinear(c2.y);
+            g_ColorBuffer.pixels[index].b = DisplayLinear(c2.z);
         }
-        g_ColorBuffer.pixels[index].a = 255;
         g_ColorBuffer.pixels[index].z = v2.z;
     }
     index = getIndexColorBuffer(g_ColorBuffer, floor(v3.x), floor(v3.y));
-    if (v3.z < g_ColorBuffer.pixels[index].z) {
+    if (DepthTest(index, v3.z)) {
         if (g_ToggleTexture) {
             if (g_ToggleNearest) {
-                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_R)];
-                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_G)];
-                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, t3.x, t3.y, CH_B)];
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, t3.x, t3.y, CH_B));
             } else if (g_ToggleLinear) {
-                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_R);
-                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_G);
-                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_B);
+                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_R));
+                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_G));
+                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, t3.x, t3.y, CH_B));
             }    
         } else {
-            g_ColorBuffer.pixels[index].r = c3.x * 255;
-            g_ColorBuffer.pixels[index].g = c3.y * 255;
-            g_ColorBuffer.pixels[index].b = c3.z * 255;
+            g_ColorBuffer.pixels[index].r = DisplayLinear(c3.x);
+            g_ColorBuffer.pixels[index].g = DisplayLinear(c3.y);
+            g_ColorBuffer.pixels[index].b = DisplayLinear(c3.z);
         }
-        g_ColorBuffer.pixels[index].a = 255;
         g_ColorBuffer.pixels[index].z = v3.z;
     }
     
@@ -919,65 +1364,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             if (g_ToggleWireframe) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                         }   
                     } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                if (zf < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zf)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];   
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));   
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                         }
                     } else {
-                        g_ColorBuffer.pixels[index].r = rf * 255;
-                        g_ColorBuffer.pixels[index].g = gf * 255;
-                        g_ColorBuffer.pixels[index].b = bf * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zf;
                 }
             } else {
                 for (; xini <= xf; xini++) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     zini += zstep;
@@ -1037,65 +1479,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v1.y) )) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1151,65 +1590,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1269,65 +1705,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v1.y))) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1383,65 +1816,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1488,23 +1918,22 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             for (; xini <= xf; xini++) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 zini += zstep;
@@ -1585,65 +2014,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             if (g_ToggleWireframe) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                         }   
                     } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                if (zf < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zf)) {
                    if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                         }
                     } else {
-                        g_ColorBuffer.pixels[index].r = rf * 255;
-                        g_ColorBuffer.pixels[index].g = gf * 255;
-                        g_ColorBuffer.pixels[index].b = bf * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zf;
                 }
             } else {
                 for (; xini <= xf; xini++) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     zini += zstep;
@@ -1703,65 +2129,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v2.y))) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1817,65 +2240,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -1936,65 +2356,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v2.y))) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2050,65 +2467,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2155,23 +2569,22 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             for (; xini <= xf; xini++) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                         }   
                     } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 zini += zstep;
@@ -2253,65 +2666,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             if (g_ToggleWireframe) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                         }   
                     } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                if (zf < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zf)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                         }
                     } else {
-                        g_ColorBuffer.pixels[index].r = rf * 255;
-                        g_ColorBuffer.pixels[index].g = gf * 255;
-                        g_ColorBuffer.pixels[index].b = bf * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zf;
                 }
             } else {
                 for (; xini <= xf; xini++) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     zini += zstep;
@@ -2371,65 +2781,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v3.y))) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2485,65 +2892,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2603,65 +3007,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe && !(floor(y0) == floor(v3.y))) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2717,65 +3118,62 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
                 float tystep = (float)(tyf - tyini)/(float)pxTotal;
                 if (g_ToggleWireframe) {
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                    if (zini < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zini)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                             }   
                         } else {
-                            g_ColorBuffer.pixels[index].r = rini * 255;
-                            g_ColorBuffer.pixels[index].g = gini * 255;
-                            g_ColorBuffer.pixels[index].b = bini * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zini;
                     }
                     index = getIndexColorBuffer(g_ColorBuffer, floor(xf), floor(y0));
-                    if (zf < g_ColorBuffer.pixels[index].z) {
+                    if (DepthTest(index, zf)) {
                         if (g_ToggleTexture) {
                             if (g_ToggleNearest) {
-                                g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_R)];
-                                g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_G)];
-                                g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txf, tyf, CH_B)];
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txf, tyf, CH_B));
                             } else if (g_ToggleLinear) {
-                                g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txf, tyf, CH_R);
-                                g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txf, tyf, CH_G);
-                                g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txf, tyf, CH_B);
+                                g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_R));
+                                g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_G));
+                                g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txf, tyf, CH_B));
                             }
                         } else {
-                            g_ColorBuffer.pixels[index].r = rf * 255;
-                            g_ColorBuffer.pixels[index].g = gf * 255;
-                            g_ColorBuffer.pixels[index].b = bf * 255;
+                            g_ColorBuffer.pixels[index].r = DisplayLinear(rf);
+                            g_ColorBuffer.pixels[index].g = DisplayLinear(gf);
+                            g_ColorBuffer.pixels[index].b = DisplayLinear(bf);
                         }
-                        g_ColorBuffer.pixels[index].a = 255;
                         g_ColorBuffer.pixels[index].z = zf;
                     }
                 } else {
                     for (; xini <= xf; xini++) {
                         index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                        if (zini < g_ColorBuffer.pixels[index].z) {
+                        if (DepthTest(index, zini)) {
                             if (g_ToggleTexture) {
                                 if (g_ToggleNearest) {
-                                    g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                                    g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                                    g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                                 } else if (g_ToggleLinear) {
-                                    g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                                    g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                                    g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                                    g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                                    g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                                    g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                                 }   
                             } else {
-                                g_ColorBuffer.pixels[index].r = rini * 255;
-                                g_ColorBuffer.pixels[index].g = gini * 255;
-                                g_ColorBuffer.pixels[index].b = bini * 255;
+                                g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                                g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                                g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                             }
-                            g_ColorBuffer.pixels[index].a = 255;
                             g_ColorBuffer.pixels[index].z = zini;
                         }
                         zini += zstep;
@@ -2822,23 +3220,22 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
             float tystep = (float)(tyf - tyini)/(float)pxTotal;
             for (; xini <= xf; xini++) {
                 index = getIndexColorBuffer(g_ColorBuffer, floor(xini), floor(y0));
-                if (zini < g_ColorBuffer.pixels[index].z) {
+                if (DepthTest(index, zini)) {
                     if (g_ToggleTexture) {
                         if (g_ToggleNearest) {
-                            g_ColorBuffer.pixels[index].r = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_R)];
-                            g_ColorBuffer.pixels[index].g = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_G)];
-                            g_ColorBuffer.pixels[index].b = g_Texture.textureData[getIndexTexture(g_Texture, txini, tyini, CH_B)];
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourNearest(g_Texture, txini, tyini, CH_B));
                         } else if (g_ToggleLinear) {
-                            g_ColorBuffer.pixels[index].r = getTextureColourBilinear(g_Texture, txini, tyini, CH_R);
-                            g_ColorBuffer.pixels[index].g = getTextureColourBilinear(g_Texture, txini, tyini, CH_G);
-                            g_ColorBuffer.pixels[index].b = getTextureColourBilinear(g_Texture, txini, tyini, CH_B);
+                            g_ColorBuffer.pixels[index].r = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_R));
+                            g_ColorBuffer.pixels[index].g = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_G));
+                            g_ColorBuffer.pixels[index].b = DisplayDecode(getTextureColourBilinear(g_Texture, txini, tyini, CH_B));
                         }   
                     } else {
-                        g_ColorBuffer.pixels[index].r = rini * 255;
-                        g_ColorBuffer.pixels[index].g = gini * 255;
-                        g_ColorBuffer.pixels[index].b = bini * 255;
+                        g_ColorBuffer.pixels[index].r = DisplayLinear(rini);
+                        g_ColorBuffer.pixels[index].g = DisplayLinear(gini);
+                        g_ColorBuffer.pixels[index].b = DisplayLinear(bini);
                     }
-                    g_ColorBuffer.pixels[index].a = 255;
                     g_ColorBuffer.pixels[index].z = zini;
                 }
                 zini += zstep;
@@ -2854,464 +3251,1644 @@ void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::v
     }
 }
 
-GLuint BuildTriangles(ModelObject model)
+// True when the triangle a, b, c of signed area area (times two) surely
+// writes every pixel of tile i, j. The spans of the rasterizer are rounded, so
+// the tile must be inside the triangle with one pixel of margin.
+bool TileCovered(glm::vec2 a, glm::vec2 b, glm::vec2 c, float area, int i, int j)
 {
-    glm::vec3 min_coord = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-    glm::vec3 max_coord = glm::vec3(FLT_MIN, FLT_MIN, FLT_MIN);
-    int num_vertices = model.num_triangles * 3;
-    std::vector<float> normal_coefficients;
-    std::vector<float> model_coefficients;
-    std::vector<float> texture_coefficients;
-    for (int i = 0; i < model.num_triangles; i++) {
-        Triangle triangle = model.triangles[i];
-        // v0
-        model_coefficients.push_back(triangle.v0.pos.x); // X
-        model_coefficients.push_back(triangle.v0.pos.y); // Y
-        model_coefficients.push_back(triangle.v0.pos.z); // Z
-        model_coefficients.push_back(1.0f); // W
-        normal_coefficients.push_back(triangle.v0.normal.x);
-        normal_coefficients.push_back(triangle.v0.normal.y);
-        normal_coefficients.push_back(triangle.v0.normal.z);
-        normal_coefficients.push_back(0.f);
-        texture_coefficients.push_back(triangle.v0.texture.x);
-        texture_coefficients.push_back(triangle.v0.texture.y);
-        
-        // v1
-        model_coefficients.push_back(triangle.v1.pos.x); // X
-        model_coefficients.push_back(triangle.v1.pos.y); // Y
-        model_coefficients.push_back(triangle.v1.pos.z); // Z
-        model_coefficients.push_back(1.0f); // W
-        normal_coefficients.push_back(triangle.v1.normal.x);
-        normal_coefficients.push_back(triangle.v1.normal.y);
-        normal_coefficients.push_back(triangle.v1.normal.z);
-        normal_coefficients.push_back(0.f);
-        texture_coefficients.push_back(triangle.v1.texture.x);
-        texture_coefficients.push_back(triangle.v1.texture.y);
-        
-        // v2
-        model_coefficients.push_back(triangle.v2.pos.x); // X
-        model_coefficients.push_back(triangle.v2.pos.y); // Y
-        model_coefficients.push_back(triangle.v2.pos.z); // Z
-        model_coefficients.push_back(1.0f); // W
-        normal_coefficients.push_back(triangle.v2.normal.x);
-        normal_coefficients.push_back(triangle.v2.normal.y);
-        normal_coefficients.push_back(triangle.v2.normal.z);
-        normal_coefficients.push_back(0.f);
-        texture_coefficients.push_back(triangle.v2.texture.x);
-        texture_coefficients.push_back(triangle.v2.texture.y);
-
-        min_coord.x = (triangle.v0.pos.x < min_coord.x) ? triangle.v0.pos.x : min_coord.x;
-        max_coord.x = (triangle.v0.pos.x > max_coord.x) ? triangle.v0.pos.x : max_coord.x;
-        min_coord.x = (triangle.v1.pos.x < min_coord.x) ? triangle.v1.pos.x : min_coord.x;
-        max_coord.x = (triangle.v1.pos.x > max_coord.x) ? triangle.v1.pos.x : max_coord.x;
-        min_coord.x = (triangle.v2.pos.x < min_coord.x) ? triangle.v2.pos.x : min_coord.x;
-        max_coord.x = (triangle.v2.pos.x > max_coord.x) ? triangle.v2.pos.x : max_coord.x;
-        
-        min_coord.y = (triangle.v0.pos.y < min_coord.y) ? triangle.v0.pos.y : min_coord.y;
-        max_coord.y = (triangle.v0.pos.y > max_coord.y) ? triangle.v0.pos.y : max_coord.y;
-        min_coord.y = (triangle.v1.pos.y < min_coord.y) ? triangle.v1.pos.y : min_coord.y;
-        max_coord.y = (triangle.v1.pos.y > max_coord.y) ? triangle.v1.pos.y : max_coord.y;
-        min_coord.y = (triangle.v2.pos.y < min_coord.y) ? triangle.v2.pos.y : min_coord.y;
-        max_coord.y = (triangle.v2.pos.y > max_coord.y) ? triangle.v2.pos.y : max_coord.y;
-        
-        min_coord.z = (triangle.v0.pos.z < min_coord.z) ? triangle.v0.pos.z : min_coord.z;
-        max_coord.z = (triangle.v0.pos.z > max_coord.z) ? triangle.v0.pos.z : max_coord.z;
-        min_coord.z = (triangle.v1.pos.z < min_coord.z) ? triangle.v1.pos.z : min_coord.z;
-        max_coord.z = (triangle.v1.pos.z > max_coord.z) ? triangle.v1.pos.z : max_coord.z;
-        min_coord.z = (triangle.v2.pos.z < min_coord.z) ? triangle.v2.pos.z : min_coord.z;
-        max_coord.z = (triangle.v2.pos.z > max_coord.z) ? triangle.v2.pos.z : max_coord.z;    
-    }
-    if (g_UseClose2GL) {
-        free(g_ColorBuffer.pixels);
-        g_ColorBuffer.width  = g_ScreenWidth;
-        g_ColorBuffer.height = g_ScreenHeight;
-        g_ColorBuffer.pixels = (ScreenPixel*)calloc(g_ScreenHeight * g_ScreenWidth, sizeof(ScreenPixel));
-        for (int i = 0; i < g_ScreenWidth; i++) {
-            for (int j = 0; j < g_ScreenHeight; j++) {
-                int index = getIndexColorBuffer(g_ColorBuffer, i, j);
-                g_ColorBuffer.pixels[index].r = 255;
-                g_ColorBuffer.pixels[index].g = 255;
-                g_ColorBuffer.pixels[index].b = 255;
-                g_ColorBuffer.pixels[index].a = 255;
-                g_ColorBuffer.pixels[index].z = FLT_MAX;
-            }
+    glm::vec2 v[3] = { a, b, c };
+    float sign = (area > 0.0f) ? 1.0f : -1.0f;
+    float x = (float)(i * DEPTH_TILE_SIZE - 1);
+    float y = (float)(j * DEPTH_TILE_SIZE - 1);
+    float size = (float)(DEPTH_TILE_SIZE + 2);
+    for (int k = 0; k < 3; k++) {
+        glm::vec2 p = v[k];
+        glm::vec2 q = v[(k + 1) % 3];
+        // edge function, positive inside, at the corner of the tile nearest to the edge
+        float dx = -sign * (q.y - p.y);
+        float dy =  sign * (q.x - p.x);
+        float e  = dx * (x - p.x) + dy * (y - p.y) + glm::min(0.0f, size * dx) + glm::min(0.0f, size * dy);
+        if (e <= 0.0f) {
+            return false;
         }
-        
-        GLfloat close2gl_coefficients[num_vertices * 4];
-        int clipped_vertices = 0;
-        for (int i = 0, j = 0; i < num_vertices*4; i+=12, j+=6) {
-            bool clip_vertices = false;
-            // three triangles vertices
-            glm::vec4 coords1 = glm::vec4(model_coefficients[i   ],
-                                          model_coefficients[i+1 ],
-                                          model_coefficients[i+2 ],
-                                          model_coefficients[i+3 ]);
-            glm::vec4 coords2 = glm::vec4(model_coefficients[i+4 ],
-                                          model_coefficients[i+5 ],
-                                          model_coefficients[i+6 ],
-                                          model_coefficients[i+7 ]);
-            glm::vec4 coords3 = glm::vec4(model_coefficients[i+8 ],
-                                          model_coefficients[i+9 ],
-                                          model_coefficients[i+10],
-                                          model_coefficients[i+11]);  
-            glm::vec4 coords1world = g_ModelMatrix * coords1;
-            glm::vec4 coords2world = g_ModelMatrix * coords2;
-            glm::vec4 coords3world = g_ModelMatrix * coords3;
-            
-            glm::vec4 normalCoords1 = glm::vec4(normal_coefficients[i   ],
-                                                normal_coefficients[i+1 ],
-                                                normal_coefficients[i+2 ],
-                                                normal_coefficients[i+3 ]);
-            glm::vec4 normalCoords2 = glm::vec4(normal_coefficients[i+4 ],
-                                                normal_coefficients[i+5 ],
-                                                normal_coefficients[i+6 ],
-                                                normal_coefficients[i+7 ]);
-            glm::vec4 normalCoords3 = glm::vec4(normal_coefficients[i+8 ],
-                                                normal_coefficients[i+9 ],
-                                                normal_coefficients[i+10],
-                                                normal_coefficients[i+11]);
-            
-            glm::vec2 textureCoords1;
-            glm::vec2 textureCoords2;
-            glm::vec2 textureCoords3;
-            if (g_ToggleTexture) {
-                textureCoords1 = glm::vec2(texture_coefficients[j  ],
-                                           texture_coefficients[j+1]);
-                textureCoords2 = glm::vec2(texture_coefficients[j+2],
-                                           texture_coefficients[j+3]);
-                textureCoords3 = glm::vec2(texture_coefficients[j+4],
-                                           texture_coefficients[j+5]);
-            }
-            
-            coords1 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords1;
-            coords2 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords2;
-            coords3 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords3;
-            
-            // clip if w <=  0
-            if (coords1.w <= 0 || coords2.w <= 0 || coords3.w <= 0) {
-                clipped_vertices += 3;
-            } else {
-                // division by w
-                coords1.x /= coords1.w;
-                coords1.y /= coords1.w;
-                coords1.z /= coords1.w;
-                coords1.w /= coords1.w;
-                coords2.x /= coords2.w;
-                coords2.y /= coords2.w;
-                coords2.z /= coords2.w;
-                coords2.w /= coords2.w;
-                coords3.x /= coords3.w;
-                coords3.y /= coords3.w;
-                coords3.z /= coords3.w;
-                coords3.w /= coords3.w;
-                // clip if z outside (-1, 1)
-                if ( coords1.z < -1 || coords1.z > 1 ||
-                     coords2.z < -1 || coords2.z > 1 ||
-                     coords3.z < -1 || coords3.z > 1 ) {
-                    clipped_vertices += 3;
-                } else {
-                   
-                    // calculate screen coordinates for backface culling
-                    glm::mat4 viewport = Matrix_Viewport(0.0f, (float)g_ScreenWidth, (float)g_ScreenHeight, 0.0f);
-                    glm::vec4 coords1sc = viewport * coords1;
-                    glm::vec4 coords2sc = viewport * coords2;
-                    glm::vec4 coords3sc = viewport * coords3;
-         
-                    // backface culling
-                    float area = 0;
-                    float sum  = 0;
-                    sum += (coords1sc.x*coords2sc.y - coords2sc.x*coords1sc.y);
-                    sum += (coords2sc.x*coords3sc.y - coords3sc.x*coords2sc.y);
-                    sum += (coords3sc.x*coords1sc.y - coords1sc.x*coords3sc.y);
-                    area = 0.5f * sum;
-
-                    // phong illumination model
-                    glm::vec4 origin = glm::vec4(0.f,0.f,0.f,1.f);
-                    glm::vec4 cameraPosition = glm::inverse(g_ViewMatrix) * origin;
-                    glm::vec3 Kd = glm::vec3(1.f,1.f,1.f);
-                    glm::vec3 Ks = glm::vec3(1.f,1.f,1.f);
-                    glm::vec3 Ka = glm::vec3(.2f,.2f,.2f);
-                    glm::vec3 Ia = glm::vec3(.2f,.2f,.2f);
-                    float q = 32.f;
-                    glm::vec4 lightDirection = glm::normalize(glm::vec4(1.f,1.f,0.f,0.f));
-                    glm::vec3 ambientTerm = Ka * Ia;
-                    glm::vec3 colorVector = glm::vec3(g_Red, g_Blue, g_Green);
-                    
-                    normalCoords1 = glm::normalize(normalCoords1);
-                    normalCoords2 = glm::normalize(normalCoords2);
-                    normalCoords3 = glm::normalize(normalCoords3);
-                    
-                    glm::vec4 viewDirectionV1 = glm::normalize(cameraPosition - coords1world);
-                    glm::vec4 viewDirectionV2 = glm::normalize(cameraPosition - coords2world);
-                    glm::vec4 viewDirectionV3 = glm::normalize(cameraPosition - coords3world);
-                    
-                    glm::vec4 reflectionDirectionV1 = -lightDirection + 2.f*normalCoords1*glm::dot(normalCoords1,lightDirection);
-                    glm::vec4 reflectionDirectionV2 = -lightDirection + 2.f*normalCoords2*glm::dot(normalCoords2,lightDirection);
-                    glm::vec4 reflectionDirectionV3 = -lightDirection + 2.f*normalCoords3*glm::dot(normalCoords3,lightDirection);
-                    
-                    glm::vec3 lambertDiffuseTermV1 = Kd*glm::max(0.f,glm::dot(normalCoords1,lightDirection));
-                    glm::vec3 lambertDiffuseTermV2 = Kd*glm::max(0.f,glm::dot(normalCoords2,lightDirection));
-                    glm::vec3 lambertDiffuseTermV3 = Kd*glm::max(0.f,glm::dot(normalCoords3,lightDirection));
-
-                    glm::vec3 phongSpecularTermV1 = Ks*glm::pow(glm::max(0.f,dot(reflectionDirectionV1,viewDirectionV1)),q);
-                    glm::vec3 phongSpecularTermV2 = Ks*glm::pow(glm::max(0.f,dot(reflectionDirectionV2,viewDirectionV2)),q);
-                    glm::vec3 phongSpecularTermV3 = Ks*glm::pow(glm::max(0.f,dot(reflectionDirectionV3,viewDirectionV3)),q);
-                    
-                    glm::vec3 outputColorV1 = colorVector;
-                    glm::vec3 outputColorV2 = colorVector;
-                    glm::vec3 outputColorV3 = colorVector;
-                    if (g_ToggleGouraud && g_TogglePhong) {
-                        outputColorV1 = (ambientTerm+lambertDiffuseTermV1+phongSpecularTermV1)*colorVector;
-                        outputColorV1 = glm::pow(outputColorV1, glm::vec3(1.f,1.f,1.f)/2.2f);
-                        outputColorV2 = (ambientTerm+lambertDiffuseTermV2+phongSpecularTermV2)*colorVector;
-                        outputColorV2 = glm::pow(outputColorV2, glm::vec3(1.f,1.f,1.f)/2.2f);
-                        outputColorV3 = (ambientTerm+lambertDiffuseTermV3+phongSpecularTermV3)*colorVector;
-                        outputColorV3 = glm::pow(outputColorV3, glm::vec3(1.f,1.f,1.f)/2.2f);
-                    } else if (g_ToggleGouraud) {
-                        outputColorV1 = (ambientTerm+lambertDiffuseTermV1)*colorVector;
-                        outputColorV1 = glm::pow(outputColorV1, glm::vec3(1.f,1.f,1.f)/2.2f);
-                        outputColorV2 = (ambientTerm+lambertDiffuseTermV2)*colorVector;
-                        outputColorV2 = glm::pow(outputColorV2, glm::vec3(1.f,1.f,1.f)/2.2f);
-                        outputColorV3 = (ambientTerm+lambertDiffuseTermV3)*colorVector;
-                        outputColorV3 = glm::pow(outputColorV3, glm::vec3(1.f,1.f,1.f)/2.2f);
-                    }
+    }
+    return true;
+}
 
+// Draws a triangle in screen space. With g_ToggleTileDepth its depth range is
+// tested against the depth bounds of the tiles it overlaps first: it is
+// dropped when it is behind the farthest depth of all of them, and drawn
+// without reading the depth of its pixels when it is in front of the nearest.
+// Afterwards the bounds of the tiles are moved to the triangle. Off by
+// default: it rarely rejects anything outside of large occluders and costs a
+// few percent on the usual models.
+void DrawTriangle(glm::vec4 v1, glm::vec4 v2, glm::vec4 v3, glm::vec3 c1, glm::vec3 c2, glm::vec3 c3, glm::vec2 t1, glm::vec2 t2, glm::vec2 t3)
+{
+    // verificar se os três vertices estão dentro da tela
+    if (! (v1.x > 0 && v1.x < g_ScreenWidth && v1.y > 0 && v1.y < g_ScreenHeight &&
+           v2.x > 0 && v2.x < g_ScreenWidth && v2.y > 0 && v2.y < g_ScreenHeight &&
+           v3.x > 0 && v3.x < g_ScreenWidth && v3.y > 0 && v3.y < g_ScreenHeight)  ) {
+        return;
+    }
+    if (!g_ToggleTileDepth) {
+        DrawTriangleSpans(v1, v2, v3, c1, c2, c3, t1, t2, t3);
+        return;
+    }
 
-                    if (g_ToggleCW) { // clockwise
-                        if (area < 0) {
-                            // cull
-                            clipped_vertices += 3;
-                        } else {
-                            DrawTriangle(coords1sc     , coords2sc     , coords3sc     , 
-                                         outputColorV1 , outputColorV2 , outputColorV3 , 
-                                         textureCoords1, textureCoords2, textureCoords3);
-                        }
-                    } else { // counterclockwise
-                        if (area > 0) {
-                            // cull
-                            clipped_vertices += 3;
-                        } else {
-                            DrawTriangle(coords1sc     , coords2sc     , coords3sc     , 
-                                         outputColorV1 , outputColorV2 , outputColorV3 , 
-                                         textureCoords1, textureCoords2, textureCoords3);
-                        }
-                    }
-                }
+    float z_min = glm::min(v1.z, glm::min(v2.z, v3.z));
+    float z_max = glm::max(v1.z, glm::max(v2.z, v3.z));
+    // one pixel of margin for the rounding of the rasterizer
+    int x0 = glm::max((int)floor(glm::min(v1.x, glm::min(v2.x, v3.x))) - 1, 0) >> DEPTH_TILE_SHIFT;
+    int y0 = glm::max((int)floor(glm::min(v1.y, glm::min(v2.y, v3.y))) - 1, 0) >> DEPTH_TILE_SHIFT;
+    int x1 = glm::min((int)floor(glm::max(v1.x, glm::max(v2.x, v3.x))) + 1, g_ColorBuffer.width  - 1) >> DEPTH_TILE_SHIFT;
+    int y1 = glm::min((int)floor(glm::max(v1.y, glm::max(v2.y, v3.y))) + 1, g_ColorBuffer.height - 1) >> DEPTH_TILE_SHIFT;
+
+    bool hidden = true;
+    bool front  = z_max + DEPTH_TILE_EPSILON < g_DepthTiles.floor;
+    for (int j = y0; j <= y1 && (hidden || front); j++) {
+        for (int i = x0; i <= x1; i++) {
+            const DepthTile &tile = g_DepthTiles.tiles[j * g_DepthTiles.width + i];
+            hidden = hidden && z_min > tile.max + DEPTH_TILE_EPSILON;
+            front  = front  && z_max + DEPTH_TILE_EPSILON < tile.min;
+        }
+    }
+    if (hidden) {
+        g_TileHiddenTriangles += 1;
+        return;
+    }
+    g_TileFrontTriangles += front ? 1 : 0;
+    g_DepthTilePass = front;
+    DrawTriangleSpans(v1, v2, v3, c1, c2, c3, t1, t2, t3);
+    g_DepthTilePass = false;
+
+    // updating every tile under a long thin triangle costs more than drawing it
+    glm::vec2 a = glm::vec2(v1), b = glm::vec2(v2), c = glm::vec2(v3);
+    float area  = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    int   tiles = (x1 - x0 + 1) * (y1 - y0 + 1);
+    if (tiles > 4 && tiles * DEPTH_TILE_SIZE * DEPTH_TILE_SIZE > DEPTH_TILE_SPARSE * 0.5f * fabsf(area)) {
+        g_DepthTiles.floor = glm::min(g_DepthTiles.floor, z_min - DEPTH_TILE_EPSILON);
+        return;
+    }
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            DepthTile &tile = g_DepthTiles.tiles[j * g_DepthTiles.width + i];
+            tile.min = glm::min(tile.min, z_min - DEPTH_TILE_EPSILON);
+        }
+    }
+
+    // every pixel of a covered tile now holds at most the farthest depth of
+    // the triangle; points and lines cover nothing
+    glm::vec2 extent = glm::max(a, glm::max(b, c)) - glm::min(a, glm::min(b, c));
+    if (!g_ToggleSolid || g_TogglePoints || g_ToggleWireframe || area == 0.0f ||
+        extent.x < DEPTH_TILE_SIZE + 2 || extent.y < DEPTH_TILE_SIZE + 2) {
+        return;
+    }
+    float z_far = z_max + DEPTH_TILE_EPSILON;
+    for (int j = y0; j <= y1; j++) {
+        for (int i = x0; i <= x1; i++) {
+            DepthTile &tile = g_DepthTiles.tiles[j * g_DepthTiles.width + i];
+            if (z_far < tile.max && TileCovered(a, b, c, area, i, j)) {
+                tile.max = z_far;
             }
         }
-        
-        
-        std::vector<unsigned char> textureData;
-        for (int i = 0; i < g_ScreenHeight; i++) {
-            for (int j = 0; j < g_ScreenWidth; j++) {
-                textureData.push_back(g_ColorBuffer.pixels[getIndexColorBuffer(g_ColorBuffer, j, i)].r);
-                textureData.push_back(g_ColorBuffer.pixels[getIndexColorBuffer(g_ColorBuffer, j, i)].g);
-                textureData.push_back(g_ColorBuffer.pixels[getIndexColorBuffer(g_ColorBuffer, j, i)].b);
-                textureData.push_back(g_ColorBuffer.pixels[getIndexColorBuffer(g_ColorBuffer, j, i)].a);
+    }
+}
+
+// Groups the model triangles into meshlets, builds the hierarchy over them and
+// reorders the triangles so that every meshlet covers a contiguous range of
+// model->triangles.
+void BuildModelBvh(ModelObject *model)
+{
+    model->bvh_nodes     = NULL;
+    model->num_bvh_nodes = 0;
+    model->meshlets      = NULL;
+    model->num_meshlets  = 0;
+    if (model->num_triangles <= 0) {
+        return;
+    }
+    // The cones use the normal given by the winding, which is what decides
+    // culling in RasterizeClose2GL() and in OpenGL: the face_normal of the
+    // files does not always agree with it (it does for about two thirds of the
+    // cow). The normal points to the side from which the triangle is drawn
+    // when clockwise triangles are front facing.
+    std::vector<glm::vec3> positions(3 * model->num_triangles);
+    std::vector<glm::vec3> normals(model->num_triangles);
+    for (int i = 0; i < model->num_triangles; i++) {
+        Triangle triangle = model->triangles[i];
+        positions[3*i+0] = triangle.v0.pos;
+        positions[3*i+1] = triangle.v1.pos;
+        positions[3*i+2] = triangle.v2.pos;
+        glm::vec3 normal = glm::cross(triangle.v2.pos - triangle.v0.pos, triangle.v1.pos - triangle.v0.pos);
+        float length = glm::length(normal);
+        normals[i] = (length > 0.0f) ? normal / length : glm::vec3(0.0f);
+    }
+    std::vector<unsigned> order(model->num_triangles);
+    std::vector<Meshlet>  meshlets;
+    model->bvh_nodes = MeshletBuild(positions.data(), normals.data(), model->num_triangles, order.data(),
+                                    &meshlets, &model->num_bvh_nodes);
+    model->meshlets = (Meshlet*)malloc(meshlets.size() * sizeof(Meshlet));
+    memcpy(model->meshlets, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+    model->num_meshlets = meshlets.size();
+
+    Triangle *triangles = (Triangle*)malloc(model->num_triangles * sizeof(Triangle));
+    for (int i = 0; i < model->num_triangles; i++) {
+        triangles[i] = model->triangles[order[i]];
+    }
+    free(model->triangles);
+    model->triangles = triangles;
+}
+
+// Fills g_VisibleRanges with the triangles of the model that may be inside the
+// frustum, leaving out the meshlets that face away from the camera. Both tests
+// are done in model space, before any vertex is transformed.
+void CullModel(ModelObject model, glm::mat4 projection, glm::mat4 view_model)
+{
+    if (!model.bvh_nodes) {
+        BvhRange all = { 0, (unsigned)model.num_triangles };
+        g_VisibleRanges.assign(1, all);
+        g_VisibleTriangles = model.num_triangles;
+        g_FrustumMeshlets  = 0;
+        g_BackfaceMeshlets = 0;
+        g_CandidateMeshlets.clear();
+        return;
+    }
+    glm::vec3 camera_position = glm::vec3(glm::inverse(view_model)[3]);
+    g_FrustumMeshlets  = BvhCullFrustum(model.bvh_nodes, projection * view_model, &g_VisibleMeshlets);
+    g_BackfaceMeshlets = 0;
+    g_VisibleTriangles = 0;
+    g_VisibleRanges.clear();
+    g_CandidateMeshlets.clear();
+    float facing = g_ToggleCW ? 1.0f : -1.0f;
+    for (size_t r = 0; r < g_VisibleMeshlets.size(); r++) {
+        for (unsigned m = g_VisibleMeshlets[r].first; m < g_VisibleMeshlets[r].first + g_VisibleMeshlets[r].count; m++) {
+            const Meshlet &meshlet = model.meshlets[m];
+            if (MeshletBackfacing(meshlet, camera_position, facing)) {
+                g_BackfaceMeshlets += 1;
+                continue;
             }
+            BvhAppendRange(&g_VisibleRanges, meshlet.first, meshlet.count);
+            g_CandidateMeshlets.push_back(m);
+            g_VisibleTriangles += meshlet.count;
         }
-        LoadTexture(textureData.data(), g_ScreenWidth, g_ScreenHeight);
+    }
+}
+
+void ComputeModelBounds(ModelObject model, glm::vec3 *min_coord, glm::vec3 *max_coord)
+{
+    *min_coord = glm::vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    *max_coord = glm::vec3(FLT_MIN, FLT_MIN, FLT_MIN);
+    for (int i = 0; i < model.num_triangles; i++) {
+        Triangle triangle = model.triangles[i];
+        min_coord->x = (triangle.v0.pos.x < min_coord->x) ? triangle.v0.pos.x : min_coord->x;
+        max_coord->x = (triangle.v0.pos.x > max_coord->x) ? triangle.v0.pos.x : max_coord->x;
+        min_coord->x = (triangle.v1.pos.x < min_coord->x) ? triangle.v1.pos.x : min_coord->x;
+        max_coord->x = (triangle.v1.pos.x > max_coord->x) ? triangle.v1.pos.x : max_coord->x;
+        min_coord->x = (triangle.v2.pos.x < min_coord->x) ? triangle.v2.pos.x : min_coord->x;
+        max_coord->x = (triangle.v2.pos.x > max_coord->x) ? triangle.v2.pos.x : max_coord->x;
         
-        GLfloat vertex_data[] = {
-            -1.f, -1.f, 1.f, 1.f, // bottom left
-             1.f,  1.f, 1.f, 1.f, // top right
-            -1.f,  1.f,-1.f, 1.f, // top left
-             1.f,  1.f, 1.f, 1.f, // top left
-            -1.f, -1.f, 1.f, 1.f, // bottom left
-             1.f, -1.f, -1.f, 1.f // bottom right
-        };
-        GLfloat texture_coefficients[] = {
-            1.f, 0.f, // bottom left
-            0.f, 1.f, // top right
-            1.f, 1.f, // top left
-            0.f, 1.f, // top left
-            1.f, 0.f, // bottom left
-            0.f, 0.f  // bottom right
-        };
-        num_vertices = 6;
+        min_coord->y = (triangle.v0.pos.y < min_coord->y) ? triangle.v0.pos.y : min_coord->y;
+        max_coord->y = (triangle.v0.pos.y > max_coord->y) ? triangle.v0.pos.y : max_coord->y;
+        min_coord->y = (triangle.v1.pos.y < min_coord->y) ? triangle.v1.pos.y : min_coord->y;
+        max_coord->y = (triangle.v1.pos.y > max_coord->y) ? triangle.v1.pos.y : max_coord->y;
+        min_coord->y = (triangle.v2.pos.y < min_coord->y) ? triangle.v2.pos.y : min_coord->y;
+        max_coord->y = (triangle.v2.pos.y > max_coord->y) ? triangle.v2.pos.y : max_coord->y;
         
-        for (int i = 0; i < 24; i++) {
-            close2gl_coefficients[i] = vertex_data[i];
-        }
-
-
-        GLuint VBO_model_coefficients_id;
-        glGenBuffers(1, &VBO_model_coefficients_id);
+        min_coord->z = (triangle.v0.pos.z < min_coord->z) ? triangle.v0.pos.z : min_coord->z;
+        max_coord->z = (triangle.v0.pos.z > max_coord->z) ? triangle.v0.pos.z : max_coord->z;
+        min_coord->z = (triangle.v1.pos.z < min_coord->z) ? triangle.v1.pos.z : min_coord->z;
+        max_coord->z = (triangle.v1.pos.z > max_coord->z) ? triangle.v1.pos.z : max_coord->z;
+        min_coord->z = (triangle.v2.pos.z < min_coord->z) ? triangle.v2.pos.z : min_coord->z;
+        max_coord->z = (triangle.v2.pos.z > max_coord->z) ? triangle.v2.pos.z : max_coord->z;
+    }
+}
 
-        GLuint vertex_array_object_id;
-        glGenVertexArrays(1, &vertex_array_object_id);
-        glBindVertexArray(vertex_array_object_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_model_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertex_data), vertex_data);
+glm::mat4 ComputeModelMatrix(glm::vec3 min_coord, glm::vec3 max_coord)
+{
+    // centers the model at the origin and scales its largest side to 4
+    glm::vec3 translate = (min_coord + max_coord) / 2.0f;
+    glm::vec3 size      = max_coord - min_coord;
+    float scaling_factor = size.x;
+    scaling_factor = (size.y > scaling_factor) ? size.y : scaling_factor;
+    scaling_factor = (size.z > scaling_factor) ? size.z : scaling_factor;
+
+    glm::mat4 model_matrix = glm::mat4(1.0f);
+    model_matrix = glm::scale(model_matrix, glm::vec3(4.0f / scaling_factor, 4.0f / scaling_factor, 4.0f / scaling_factor));
+    model_matrix = glm::translate(model_matrix, -translate);
+    return model_matrix;
+}
 
-        GLuint location = 0;
-        GLuint number_of_dimensions = 4;
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        
-        GLuint indices[num_vertices];
-        for (int i = 0; i < num_vertices; i++) {
-            indices[i] = i;
+GLuint BuildTriangles(ModelObject model)
+{
+    if (g_UseClose2GL) {
+        if (g_Resident.bounds_triangles != model.triangles) {
+            ComputeModelBounds(model, &g_Resident.min_coord, &g_Resident.max_coord);
+            g_Resident.bounds_triangles = model.triangles;
+        }
+        g_ModelMatrix = ComputeModelMatrix(g_Resident.min_coord, g_Resident.max_coord);
+        ClearColorBuffer();
+        RasterizeClose2GL(model);
+        if (g_ToggleOverdraw) {
+            ResolveOverdraw();
         }
 
-        SceneObject sceneModel;
-        sceneModel.name           = "model";
-        sceneModel.first_index    = (void*)0; 
-      //  sceneModel.num_indices    =  12;
-        sceneModel.num_indices    = model.num_triangles * 3;
-        sceneModel.rendering_mode = GL_TRIANGLES; 
-        sceneModel.min_coord      = min_coord;
-        sceneModel.max_coord      = max_coord;
-        g_VirtualScene["model"] = sceneModel;
-
-        GLuint indices_id;
-        glGenBuffers(1, &indices_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(indices), indices);
-
-        GLuint VBO_texture_coefficients_id;
-        glGenBuffers(1, &VBO_texture_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_texture_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(texture_coefficients), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(texture_coefficients), texture_coefficients);
-        location = 3;
-        number_of_dimensions = 2;
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        glBindVertexArray(0);
-        return vertex_array_object_id;
+        std::vector<unsigned char> textureData((size_t)g_ScreenWidth * g_ScreenHeight * 4);
+        EncodeColorBuffer(g_ColorBuffer, textureData.data());
+        UploadFrameTexture(textureData.data(), g_ScreenWidth, g_ScreenHeight);
+
+        if (!g_Resident.quad_vertex_array) {
+            // position and texture coordinates of the 6 vertices
+            GLfloat vertex_data[] = {
+                -1.f, -1.f, 1.f, 1.f,   1.f, 0.f, // bottom left
+                 1.f,  1.f, 1.f, 1.f,   0.f, 1.f, // top right
+                -1.f,  1.f,-1.f, 1.f,   1.f, 1.f, // top left
+                 1.f,  1.f, 1.f, 1.f,   0.f, 1.f, // top left
+                -1.f, -1.f, 1.f, 1.f,   1.f, 0.f, // bottom left
+                 1.f, -1.f, -1.f, 1.f,  0.f, 0.f  // bottom right
+            };
+            GLuint vertex_array_object_id;
+            glCreateBuffers(1, &g_Resident.quad_buffer);
+            glNamedBufferStorage(g_Resident.quad_buffer, sizeof(vertex_data), vertex_data, 0);
+            glCreateVertexArrays(1, &vertex_array_object_id);
+            glVertexArrayVertexBuffer(vertex_array_object_id, 0, g_Resident.quad_buffer, 0, 6 * sizeof(GLfloat));
+            glVertexArrayAttribFormat(vertex_array_object_id, GPU_VERTEX_POSITION, 4, GL_FLOAT, GL_FALSE, 0);
+            glVertexArrayAttribFormat(vertex_array_object_id, GPU_VERTEX_UV,       2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat));
+            glVertexArrayAttribBinding(vertex_array_object_id, GPU_VERTEX_POSITION, 0);
+            glVertexArrayAttribBinding(vertex_array_object_id, GPU_VERTEX_UV,       0);
+            glEnableVertexArrayAttrib(vertex_array_object_id, GPU_VERTEX_POSITION);
+            glEnableVertexArrayAttrib(vertex_array_object_id, GPU_VERTEX_UV);
+            g_Resident.quad_vertex_array = vertex_array_object_id;
+        }
+        return g_Resident.quad_vertex_array;
     } 
     else {
-        GLuint VBO_model_coefficients_id;
-        glGenBuffers(1, &VBO_model_coefficients_id);
-
-        GLuint vertex_array_object_id;
-        glGenVertexArrays(1, &vertex_array_object_id);
-        glBindVertexArray(vertex_array_object_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_model_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, model_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, model_coefficients.size() * sizeof(float), model_coefficients.data());
-
-        GLuint location = 0;
-        GLint number_of_dimensions = 4;
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        
-        GLuint indices[num_vertices];
-        for (int i = 0; i < num_vertices; i++) {
-            indices[i] = i;
-        }
-
-        SceneObject sceneModel;
-        sceneModel.name           = "model";
-        sceneModel.first_index    = (void*)0; 
-        sceneModel.num_indices    =  model.num_triangles * 3;
+        GLuint vertex_array_object_id = ResidentModel(model);
         if (g_TogglePoints) {
-            sceneModel.rendering_mode = GL_POINTS;
+            g_Scene.rendering_mode = GL_POINTS;
         } else if (g_ToggleWireframe) {
-            sceneModel.rendering_mode = GL_TRIANGLES;
+            g_Scene.rendering_mode = GL_TRIANGLES;
             glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
         } else if (g_ToggleSolid) {
-            sceneModel.rendering_mode = GL_TRIANGLES;
+            g_Scene.rendering_mode = GL_TRIANGLES;
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
         }
-        sceneModel.min_coord      = min_coord;
-        sceneModel.max_coord      = max_coord;
-        g_VirtualScene["model"] = sceneModel;
-
-        GLuint indices_id;
-        glGenBuffers(1, &indices_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices_id);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(indices), indices);
-
- 
-        GLuint VBO_normal_coefficients_id;
-        glGenBuffers(1, &VBO_normal_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_normal_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, normal_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, normal_coefficients.size() * sizeof(float), normal_coefficients.data());
-        location = 2;
-        number_of_dimensions = 4;
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        
-        GLuint VBO_texture_coefficients_id;
-        glGenBuffers(1, &VBO_texture_coefficients_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_texture_coefficients_id);
-        glBufferData(GL_ARRAY_BUFFER, texture_coefficients.size() * sizeof(float), NULL, GL_STATIC_DRAW);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, texture_coefficients.size() * sizeof(float), texture_coefficients.data());
-        location = 3;
-        number_of_dimensions = 2;
-        glVertexAttribPointer(location, number_of_dimensions, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(location);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-
-        glBindVertexArray(0);
         return vertex_array_object_id;
     }
 }
 
-void ErrorCallback(int error, const char *description)
+// Makes model mesh 0 of the scene, alone with one instance, unless it is
+// already. Returns the vertex array of the scene.
+GLuint ResidentModel(const ModelObject &model)
 {
-    fprintf(stderr, "ERROR: GLFW %s\n", description);
+    if (g_Scene.meshes.empty() || g_Scene.meshes[0].model.triangles != model.triangles) {
+        SceneClear();
+        SceneAddInstance(SceneAddMesh(model), glm::mat4(1.0f), glm::vec4(0.0f));
+    }
+    return g_Scene.vertex_array;
 }
 
-void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mod)
+// Frees the arrays allocated by ReadModelFile() and leaves model empty.
+void FreeModel(ModelObject *model)
 {
-    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-        glfwSetWindowShouldClose(window, GL_TRUE);
-    }
-    if (key == GLFW_KEY_W) {
-        if (action == GLFW_PRESS) {
-            g_W_pressed = true;
-        } else if (action == GLFW_RELEASE) {
-            g_W_pressed = false;
-        }
-    }
+    free(model->ambient_color);
+    free(model->diffuse_color);
+    free(model->specular_color);
+    free(model->material_shine);
+    free(model->triangles);
+    free(model->bvh_nodes);
+    free(model->meshlets);
+    *model = ModelObject();
+}
 
-    if (key == GLFW_KEY_A) {
-        if (action == GLFW_PRESS) {
-            g_A_pressed = true;
-        } else if (action == GLFW_RELEASE) {
-            g_A_pressed = false;
-        }
+// Drops the scene, the bounds of g_Model and g_Model itself, before a new
+// model is read.
+void EvictModel()
+{
+    SceneClear();
+    g_Resident.bounds_triangles = NULL;
+    FreeModel(&g_Model);
+}
+
+// Creates the vertex array of the scene, its arena still empty.
+void SceneInit()
+{
+    g_Scene.rendering_mode = GL_TRIANGLES;
+    glCreateVertexArrays(1, &g_Scene.vertex_array);
+    GpuVertexFormat(g_Scene.vertex_array, 0);
+
+    std::vector<unsigned> ids(SCENE_MAX_INSTANCES);
+    for (unsigned i = 0; i < SCENE_MAX_INSTANCES; i++) {
+        ids[i] = i;
     }
+    glCreateBuffers(1, &g_Scene.instance_buffer);
+    glNamedBufferStorage(g_Scene.instance_buffer, ids.size() * sizeof(unsigned), ids.data(), 0);
+    glVertexArrayVertexBuffer(g_Scene.vertex_array, 1, g_Scene.instance_buffer, 0, sizeof(unsigned));
+    glVertexArrayBindingDivisor(g_Scene.vertex_array, 1, 1);
+    glVertexArrayAttribIFormat(g_Scene.vertex_array, GPU_VERTEX_INSTANCE, 1, GL_UNSIGNED_INT, 0);
+    glVertexArrayAttribBinding(g_Scene.vertex_array, GPU_VERTEX_INSTANCE, 1);
+    glEnableVertexArrayAttrib(g_Scene.vertex_array, GPU_VERTEX_INSTANCE);
+}
 
-    if (key == GLFW_KEY_S) {
-        if (action == GLFW_PRESS) {
-            g_S_pressed = true;
-        } else if (action == GLFW_RELEASE) {
-            g_S_pressed = false;
+// Removes every mesh and instance, keeping the arena buffers for the next
+// ones. The models of the meshes other than g_Model are freed.
+void SceneClear()
+{
+    for (size_t m = 1; m < g_Scene.meshes.size(); m++) {
+        ModelObject *model = &g_Scene.meshes[m].model;
+        if (model->triangles != g_Model.triangles) {
+            FreeModel(model);
         }
     }
+    g_Scene.meshes.clear();
+    g_Scene.instances.clear();
+    g_Scene.vertex_count = 0;
+    g_Scene.index_count  = 0;
+}
 
-    if (key == GLFW_KEY_D) {
-        if (action == GLFW_PRESS) {
-            g_D_pressed = true;
-        } else if (action == GLFW_RELEASE) {
-            g_D_pressed = false;
-        }
+// Makes room for needed bytes in an arena buffer holding used bytes, copying
+// them into a buffer twice as large when it is full.
+static void SceneReserve(GLuint *buffer, size_t *capacity, size_t used, size_t needed)
+{
+    if (needed <= *capacity) {
+        return;
     }
+    size_t grown = glm::max(needed, 2 * *capacity);
+    GLuint larger;
+    glCreateBuffers(1, &larger);
+    glNamedBufferStorage(larger, grown, NULL, GL_DYNAMIC_STORAGE_BIT);
+    if (*buffer) {
+        glCopyNamedBufferSubData(*buffer, larger, 0, 0, used);
+        glDeleteBuffers(1, buffer);
+    }
+    *buffer   = larger;
+    *capacity = grown;
+}
 
-    if (key == GLFW_KEY_Q) {
-        if (action == GLFW_PRESS) {
-            g_Q_pressed = true;
-        } else if (action == GLFW_RELEASE) {
-            g_Q_pressed = false;
+// Welds the vertices of model into the arena. Returns the index of its mesh.
+unsigned SceneAddMesh(const ModelObject &model)
+{
+    // triangle i keeps indices 3i to 3i+2, the ranges CullModel() draws
+    std::vector<GpuVertex> corners((size_t)model.num_triangles * 3);
+    for (int i = 0; i < model.num_triangles; i++) {
+        const Triangle &triangle = model.triangles[i];
+        const TriangleVertex *v[3] = { &triangle.v0, &triangle.v1, &triangle.v2 };
+        for (int k = 0; k < 3; k++) {
+            corners[3 * (size_t)i + k] = GpuVertexPack(v[k]->pos, v[k]->normal, v[k]->texture, triangle.material);
         }
     }
+    std::vector<GpuVertex> vertices;
+    std::vector<unsigned>  indices;
+    GpuVertexWeld(corners.data(), corners.size(), &vertices, &indices);
+
+    size_t vertex_bytes = g_Scene.vertex_count * sizeof(GpuVertex);
+    size_t index_bytes  = g_Scene.index_count  * sizeof(unsigned);
+    SceneReserve(&g_Scene.vertex_buffer, &g_Scene.vertex_capacity, vertex_bytes, vertex_bytes + vertices.size() * sizeof(GpuVertex));
+    SceneReserve(&g_Scene.index_buffer,  &g_Scene.index_capacity,  index_bytes,  index_bytes  + indices.size()  * sizeof(unsigned));
+    glNamedBufferSubData(g_Scene.vertex_buffer, vertex_bytes, vertices.size() * sizeof(GpuVertex), vertices.data());
+    glNamedBufferSubData(g_Scene.index_buffer,  index_bytes,  indices.size()  * sizeof(unsigned),  indices.data());
+    glVertexArrayVertexBuffer(g_Scene.vertex_array, 0, g_Scene.vertex_buffer, 0, sizeof(GpuVertex));
+    glVertexArrayElementBuffer(g_Scene.vertex_array, g_Scene.index_buffer);
+
+    SceneMesh mesh;
+    mesh.model       = model;
+    mesh.first_index = (unsigned)g_Scene.index_count;
+    mesh.base_vertex = (unsigned)g_Scene.vertex_count;
+    ComputeModelBounds(model, &mesh.min_coord, &mesh.max_coord);
+    mesh.center_matrix = ComputeModelMatrix(mesh.min_coord, mesh.max_coord);
+    g_Scene.meshes.push_back(mesh);
+    g_Scene.vertex_count += vertices.size();
+    g_Scene.index_count  += indices.size();
+    return (unsigned)g_Scene.meshes.size() - 1;
+}
 
-    if (key == GLFW_KEY_Z) {
-        if (action == GLFW_PRESS) {
+// Places mesh with transform, after the centering and scaling of the mesh.
+void SceneAddInstance(unsigned mesh, glm::mat4 transform, glm::vec4 color)
+{
+    SceneInstance instance;
+    instance.mesh          = mesh;
+    instance.model_matrix  = transform * g_Scene.meshes[mesh].center_matrix;
+    instance.normal_matrix = glm::inverse(glm::transpose(instance.model_matrix));
+    instance.color         = color;
+    g_Scene.instances.push_back(instance);
+}
+
+// Reads a scene file into g_Scene, one command per line:
+//   model <file.in>                         a mesh, numbered from 0 in order
+//   instance <mesh> <x> <y> <z> [s [r g b]] the mesh at x y z scaled by s
+//   grid <mesh> <count> <spacing>           count instances in a square on y = 0
+// The first model becomes g_Model. An instance without color takes the one of
+// the interface. Returns false, with a message, on the first bad line.
+bool LoadScene(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "ERROR: cannot open scene \"%s\".\n", filename);
+        return false;
+    }
+    EvictModel();
+    bool ok = true;
+    int  number = 0;
+    char line[1024];
+    while (ok && fgets(line, sizeof(line), file)) {
+        char *words[16];
+        int   num_words = 0;
+        number += 1;
+        for (char *word = strtok(line, " \t\r\n"); word && num_words < 16; word = strtok(NULL, " \t\r\n")) {
+            words[num_words++] = word;
+        }
+        if (num_words == 0 || words[0][0] == '#') {
+            continue;
+        }
+        unsigned mesh = num_words > 1 ? (unsigned)atoi(words[1]) : 0;
+        if (strcmp(words[0], "model") == 0 && num_words == 2) {
+            if (g_Scene.meshes.empty()) {
+                snprintf(g_ModelFilename, FILENAME_MAX, "%s", words[1]);
+                g_Model = ReadModelFile(g_ModelFilename);
+                SceneAddMesh(g_Model);
+            } else {
+                SceneAddMesh(ReadModelFile(words[1]));
+            }
+        } else if (strcmp(words[0], "instance") == 0 && (num_words == 5 || num_words == 6 || num_words == 9) &&
+                   mesh < g_Scene.meshes.size()) {
+            glm::vec3 position = glm::vec3(atof(words[2]), atof(words[3]), atof(words[4]));
+            float     scale    = num_words > 5 ? (float)atof(words[5]) : 1.0f;
+            glm::vec4 color    = num_words > 6 ? glm::vec4(atof(words[6]), atof(words[7]), atof(words[8]), 1.0f) : glm::vec4(0.0f);
+            SceneAddInstance(mesh, glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(scale)), color);
+        } else if (strcmp(words[0], "grid") == 0 && num_words == 4 && mesh < g_Scene.meshes.size()) {
+            int   count   = atoi(words[2]);
+            float spacing = (float)atof(words[3]);
+            int   side    = (int)ceilf(sqrtf((float)count));
+            float origin  = -0.5f * spacing * (side - 1);
+            for (int i = 0; i < count; i++) {
+                glm::vec3 position = glm::vec3(origin + spacing * (i % side), 0.0f, origin + spacing * (i / side));
+                SceneAddInstance(mesh, glm::translate(glm::mat4(1.0f), position), glm::vec4(0.0f));
+            }
+        } else {
+            fprintf(stderr, "ERROR: %s:%d: bad scene line.\n", filename, number);
+            ok = false;
+        }
+    }
+    fclose(file);
+    if (g_Scene.meshes.empty()) {
+        fprintf(stderr, "ERROR: scene \"%s\" has no model.\n", filename);
+        return false;
+    }
+    if (ok && g_Scene.instances.empty()) {
+        SceneAddInstance(0, glm::mat4(1.0f), glm::vec4(0.0f));
+    }
+    printf("%s: %zu meshes, %zu instances\n", filename, g_Scene.meshes.size(), g_Scene.instances.size());
+    return ok;
+}
+
+// Draws the instances inside the frustum with one indirect multi-draw: one
+// command per mesh for all its visible instances, whose data goes to the
+// shader storage in mesh order. A mesh seen once is drawn by the visible
+// ranges of its hierarchy instead, as the single model used to be.
+void DrawScene(glm::mat4 projection, glm::mat4 view)
+{
+    Scene &scene = g_Scene;
+    glm::mat4 view_projection = projection * view;
+    scene.visible.resize(scene.meshes.size());
+    for (size_t m = 0; m < scene.visible.size(); m++) {
+        scene.visible[m].clear();
+    }
+    scene.triangles = 0;
+    for (size_t i = 0; i < scene.instances.size(); i++) {
+        scene.triangles += scene.meshes[scene.instances[i].mesh].model.num_triangles;
+    }
+    size_t drawn = 0;
+    for (size_t i = 0; i < scene.instances.size() && drawn < SCENE_MAX_INSTANCES; i++) {
+        const SceneInstance &instance = scene.instances[i];
+        const SceneMesh     &mesh     = scene.meshes[instance.mesh];
+        glm::vec4 planes[6];
+        BvhFrustumPlanes(view_projection * instance.model_matrix, planes);
+        if (!BvhBoxOutside(planes, mesh.min_coord, mesh.max_coord)) {
+            scene.visible[instance.mesh].push_back((unsigned)i);
+            drawn += 1;
+        }
+    }
+
+    GLintptr      instances_offset;
+    InstanceData *instances = (InstanceData*)UniformRingAlloc(&g_UniformRing, drawn * sizeof(InstanceData), &instances_offset);
+    if (drawn == 0 || !instances) {
+        g_VisibleTriangles = 0;
+        return;
+    }
+    glm::vec4 interface_color = glm::vec4(g_Red, g_Green, g_Blue, 1.0f);
+    scene.commands.clear();
+    unsigned visible_triangles = 0;
+    unsigned first_instance = 0;
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        const SceneMesh             &mesh    = scene.meshes[m];
+        const std::vector<unsigned> &visible = scene.visible[m];
+        if (visible.empty()) {
+            continue;
+        }
+        for (size_t v = 0; v < visible.size(); v++) {
+            const SceneInstance &instance = scene.instances[visible[v]];
+            InstanceData        &data     = instances[first_instance + v];
+            data.model_matrix  = instance.model_matrix;
+            data.normal_matrix = instance.normal_matrix;
+            data.color_vector  = instance.color.w > 0.0f ? instance.color : interface_color;
+        }
+        DrawElementsCommand command = { 3 * (GLuint)mesh.model.num_triangles, (GLuint)visible.size(),
+                                        mesh.first_index, (GLint)mesh.base_vertex, first_instance };
+        if (visible.size() == 1) {
+            CullModel(mesh.model, projection, view * scene.instances[visible[0]].model_matrix);
+        }
+        if (visible.size() == 1 && scene.commands.size() + g_VisibleRanges.size() <= SCENE_MAX_DRAWS) {
+            // triangle i uses indices 3i to 3i+2 of the mesh
+            for (size_t r = 0; r < g_VisibleRanges.size(); r++) {
+                command.count       = 3 * g_VisibleRanges[r].count;
+                command.first_index = mesh.first_index + 3 * g_VisibleRanges[r].first;
+                scene.commands.push_back(command);
+                visible_triangles += g_VisibleRanges[r].count;
+            }
+        } else if (scene.commands.size() < SCENE_MAX_DRAWS) {
+            scene.commands.push_back(command);
+            visible_triangles += mesh.model.num_triangles * (unsigned)visible.size();
+        }
+        first_instance += (unsigned)visible.size();
+    }
+    g_VisibleTriangles = visible_triangles;
+
+    GLintptr commands_offset;
+    void    *commands = UniformRingAlloc(&g_UniformRing, scene.commands.size() * sizeof(DrawElementsCommand), &commands_offset);
+    if (scene.commands.empty() || !commands) {
+        return;
+    }
+    memcpy(commands, scene.commands.data(), scene.commands.size() * sizeof(DrawElementsCommand));
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, INSTANCE_DATA_BINDING, g_UniformRing.buffer, instances_offset,
+                      drawn * sizeof(InstanceData));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g_UniformRing.buffer);
+    glBindVertexArray(scene.vertex_array);
+    glMultiDrawElementsIndirect(scene.rendering_mode, GL_UNSIGNED_INT, (const void*)commands_offset,
+                                (GLsizei)scene.commands.size(), 0);
+}
+
+// Transforms, culls and rasterizes one triangle of the model into g_ColorBuffer.
+void RasterizeTriangle(const Triangle &triangle)
+{
+    if (g_Deferred) {
+        RasterizeTriangleDeferred(triangle);
+        return;
+    }
+    int clipped_vertices = 0;
+    // three triangles vertices
+    glm::vec4 coords1 = glm::vec4(triangle.v0.pos, 1.0f);
+    glm::vec4 coords2 = glm::vec4(triangle.v1.pos, 1.0f);
+    glm::vec4 coords3 = glm::vec4(triangle.v2.pos, 1.0f);
+    glm::vec4 coords1world = g_ModelMatrix * coords1;
+    glm::vec4 coords2world = g_ModelMatrix * coords2;
+    glm::vec4 coords3world = g_ModelMatrix * coords3;
+
+    glm::vec4 normalCoords1 = glm::vec4(triangle.v0.normal, 0.0f);
+    glm::vec4 normalCoords2 = glm::vec4(triangle.v1.normal, 0.0f);
+    glm::vec4 normalCoords3 = glm::vec4(triangle.v2.normal, 0.0f);
+
+    glm::vec2 textureCoords1 = glm::vec2(0.0f, 0.0f);
+    glm::vec2 textureCoords2 = glm::vec2(0.0f, 0.0f);
+    glm::vec2 textureCoords3 = glm::vec2(0.0f, 0.0f);
+    if (g_ToggleTexture) {
+        textureCoords1 = triangle.v0.texture;
+        textureCoords2 = triangle.v1.texture;
+        textureCoords3 = triangle.v2.texture;
+    }
+
+    coords1 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords1;
+    coords2 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords2;
+    coords3 = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix * coords3;
+
+    // clip if w <=  0
+    if (coords1.w <= 0 || coords2.w <= 0 || coords3.w <= 0) {
+        clipped_vertices += 3;
+    } else {
+        // division by w
+        coords1.x /= coords1.w;
+        coords1.y /= coords1.w;
+        coords1.z /= coords1.w;
+        coords1.w /= coords1.w;
+        coords2.x /= coords2.w;
+        coords2.y /= coords2.w;
+        coords2.z /= coords2.w;
+        coords2.w /= coords2.w;
+        coords3.x /= coords3.w;
+        coords3.y /= coords3.w;
+        coords3.z /= coords3.w;
+        coords3.w /= coords3.w;
+        // clip if z outside (-1, 1)
+        if ( coords1.z < -1 || coords1.z > 1 ||
+             coords2.z < -1 || coords2.z > 1 ||
+             coords3.z < -1 || coords3.z > 1 ) {
+            clipped_vertices += 3;
+        } else {
+       
+            // calculate screen coordinates for backface culling
+            glm::mat4 viewport = Matrix_Viewport(0.0f, (float)g_ScreenWidth, (float)g_ScreenHeight, 0.0f);
+            glm::vec4 coords1sc = viewport * coords1;
+            glm::vec4 coords2sc = viewport * coords2;
+            glm::vec4 coords3sc = viewport * coords3;
+
+            // backface culling
+            float area = 0;
+            float sum  = 0;
+            sum += (coords1sc.x*coords2sc.y - coords2sc.x*coords1sc.y);
+            sum += (coords2sc.x*coords3sc.y - coords3sc.x*coords2sc.y);
+            sum += (coords3sc.x*coords1sc.y - coords1sc.x*coords3sc.y);
+            area = 0.5f * sum;
+
+            if (g_ToggleCW ? area < 0 : area > 0) {
+                // cull
+                clipped_vertices += 3;
+                return;
+            }
+
+            // phong illumination model
+            glm::vec4 origin = glm::vec4(0.f,0.f,0.f,1.f);
+            glm::vec4 cameraPosition = glm::inverse(g_ViewMatrix) * origin;
+            float Kd = 1.f;
+            float Ks = 1.f;
+            float Ka = .2f;
+            float Ia = .2f;
+            glm::vec4 lightDirection = glm::normalize(glm::vec4(1.f,1.f,0.f,0.f));
+            float ambientTerm = Ka * Ia;
+            glm::vec3 colorVector = glm::vec3(g_Red, g_Blue, g_Green);
+
+            // unlit the color is shown as it is, a display value
+            glm::vec3 outputColorV1 = glm::vec3(DisplayDecode(g_Red * 255), DisplayDecode(g_Blue * 255), DisplayDecode(g_Green * 255)) / (float)DISPLAY_LINEAR_MAX;
+            glm::vec3 outputColorV2 = outputColorV1;
+            glm::vec3 outputColorV3 = outputColorV1;
+            if (g_ToggleGouraud) {
+                normalCoords1 = glm::normalize(normalCoords1);
+                normalCoords2 = glm::normalize(normalCoords2);
+                normalCoords3 = glm::normalize(normalCoords3);
+
+                float intensityV1 = ambientTerm + Kd*glm::max(0.f,glm::dot(normalCoords1,lightDirection));
+                float intensityV2 = ambientTerm + Kd*glm::max(0.f,glm::dot(normalCoords2,lightDirection));
+                float intensityV3 = ambientTerm + Kd*glm::max(0.f,glm::dot(normalCoords3,lightDirection));
+                if (g_TogglePhong) {
+                    glm::vec4 viewDirectionV1 = glm::normalize(cameraPosition - coords1world);
+                    glm::vec4 viewDirectionV2 = glm::normalize(cameraPosition - coords2world);
+                    glm::vec4 viewDirectionV3 = glm::normalize(cameraPosition - coords3world);
+
+                    glm::vec4 reflectionDirectionV1 = -lightDirection + 2.f*normalCoords1*glm::dot(normalCoords1,lightDirection);
+                    glm::vec4 reflectionDirectionV2 = -lightDirection + 2.f*normalCoords2*glm::dot(normalCoords2,lightDirection);
+                    glm::vec4 reflectionDirectionV3 = -lightDirection + 2.f*normalCoords3*glm::dot(normalCoords3,lightDirection);
+
+                    // q = 32 = 2^5: five squarings instead of pow()
+                    float specularV1 = glm::max(0.f,glm::dot(reflectionDirectionV1,viewDirectionV1));
+                    float specularV2 = glm::max(0.f,glm::dot(reflectionDirectionV2,viewDirectionV2));
+                    float specularV3 = glm::max(0.f,glm::dot(reflectionDirectionV3,viewDirectionV3));
+                    for (int k = 0; k < 5; k++) {
+                        specularV1 *= specularV1;
+                        specularV2 *= specularV2;
+                        specularV3 *= specularV3;
+                    }
+                    intensityV1 += Ks*specularV1;
+                    intensityV2 += Ks*specularV2;
+                    intensityV3 += Ks*specularV3;
+                }
+                // linear light, encoded for the display with the whole frame
+                outputColorV1 = colorVector * intensityV1;
+                outputColorV2 = colorVector * intensityV2;
+                outputColorV3 = colorVector * intensityV3;
+            }
+
+            DrawTriangle(coords1sc     , coords2sc     , coords3sc     ,
+                         outputColorV1 , outputColorV2 , outputColorV3 ,
+                         textureCoords1, textureCoords2, textureCoords3);
+        }
+    }
+}
+
+// Transforms one triangle of the model into g_GBuffer, or only its depth and
+// index into g_Visibility. Triangles are dropped by the same w and z tests as
+// RasterizeTriangle(), but the ones partly off the screen are clipped by the
+// rasterizer rather than dropped.
+void RasterizeTriangleDeferred(const Triangle &triangle)
+{
+    glm::mat4 matrix   = g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix;
+    glm::mat4 viewport = Matrix_Viewport(0.0f, (float)g_ScreenWidth, (float)g_ScreenHeight, 0.0f);
+    const TriangleVertex *vertices[3] = { &triangle.v0, &triangle.v1, &triangle.v2 };
+    glm::vec3 screen[3];
+    glm::vec3 normals[3];
+    glm::vec2 uvs[3];
+    for (int k = 0; k < 3; k++) {
+        glm::vec4 clip = matrix * glm::vec4(vertices[k]->pos, 1.0f);
+        if (clip.w <= 0.0f || clip.z < -clip.w || clip.z > clip.w) {
+            return;
+        }
+        screen[k]  = glm::vec3(viewport * (clip / clip.w));
+        normals[k] = vertices[k]->normal;
+        uvs[k]     = vertices[k]->texture;
+    }
+    float facing = g_ToggleCW ? 1.0f : -1.0f;
+    if (g_ToggleVisibility) {
+        VisibilityTriangle drawn;
+        for (int k = 0; k < 3; k++) {
+            drawn.screen[k]  = glm::vec2(screen[k]);
+            drawn.normals[k] = normals[k];
+            drawn.uvs[k]     = uvs[k];
+        }
+        drawn.material = triangle.material;
+        unsigned written = VisibilityRasterTriangle(&g_Visibility, screen, g_VisibilityTriangles.size(), facing);
+        if (written > 0) {
+            g_VisibilityTriangles.push_back(drawn);
+        }
+        g_ShadedFragments += written;
+        return;
+    }
+    g_ShadedFragments += GBufferRasterTriangle(&g_GBuffer, screen, normals, uvs, triangle.material, facing);
+}
+
+// Sorts g_CandidateMeshlets front to back by the view depth of the nearest
+// point of their bounding spheres, quantized to DEPTH_SORT_BITS bits between
+// the nearest and the farthest meshlet.
+void SortMeshlets(ModelObject model, glm::mat4 view_model)
+{
+    unsigned count = g_CandidateMeshlets.size();
+    g_SortItems.resize(count);
+    g_SortScratch.resize(count);
+    std::vector<float> depth(count);
+    float near_depth =  FLT_MAX;
+    float far_depth  = -FLT_MAX;
+    for (unsigned c = 0; c < count; c++) {
+        const Meshlet &meshlet = model.meshlets[g_CandidateMeshlets[c]];
+        // the camera looks down -z
+        depth[c]   = -(view_model * glm::vec4(meshlet.center, 1.0f)).z - meshlet.radius;
+        near_depth = glm::min(near_depth, depth[c]);
+        far_depth  = glm::max(far_depth,  depth[c]);
+    }
+    float scale = (far_depth > near_depth) ? ((1 << DEPTH_SORT_BITS) - 1) / (far_depth - near_depth) : 0.0f;
+    for (unsigned c = 0; c < count; c++) {
+        g_SortItems[c].key   = (unsigned)((depth[c] - near_depth) * scale);
+        g_SortItems[c].value = g_CandidateMeshlets[c];
+    }
+    RadixSort(g_SortItems.data(), g_SortScratch.data(), count, DEPTH_SORT_BITS, std::thread::hardware_concurrency());
+    for (unsigned c = 0; c < count; c++) {
+        g_CandidateMeshlets[c] = g_SortItems[c].value;
+    }
+}
+
+// Transforms, culls and rasterizes the model into g_ColorBuffer. Does not touch
+// OpenGL, so it also runs without a window.
+void RasterizeClose2GL(ModelObject model)
+{
+    auto start = std::chrono::steady_clock::now();
+    // whole subtrees of the hierarchy outside the frustum, and meshlets facing
+    // away from the camera, are skipped here
+    CullModel(model, g_ProjectionMatrix, g_ViewMatrix * g_ModelMatrix);
+    g_OccludedMeshlets    = 0;
+    g_TileHiddenTriangles = 0;
+    g_TileFrontTriangles  = 0;
+    g_ShadedFragments     = 0;
+    g_Deferred            = UseDeferredShading();
+    if (g_Deferred && g_ToggleVisibility) {
+        VisibilityResize(&g_Visibility, g_ScreenWidth, g_ScreenHeight);
+        DepthClear(VisibilityDepth(g_Visibility));
+        g_VisibilityTriangles.clear();
+    } else if (g_Deferred) {
+        GBufferResize(&g_GBuffer, g_ScreenWidth, g_ScreenHeight);
+        DepthClear(GBufferDepth(g_GBuffer));
+    }
+
+    // the sort is checked against the unsorted order once in a while, and
+    // only kept when the fragments it saves cost more than sorting
+    bool probe = g_DepthSortProbe && g_DepthSort.frames >= DEPTH_SORT_PROBE;
+    g_DepthSort.sorted = g_ToggleSort && model.meshlets && (probe ? !g_DepthSort.enabled : g_DepthSort.enabled);
+    if (g_DepthSort.sorted) {
+        auto sort_start = std::chrono::steady_clock::now();
+        SortMeshlets(model, g_ViewMatrix * g_ModelMatrix);
+        g_DepthSort.sort_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sort_start).count();
+    }
+    RasterizeMeshlets(model);
+    if (g_Deferred) {
+        ShadeDeferred();
+    }
+
+    double frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (g_ToggleSort && probe) {
+        // raster time per shaded fragment of the unsorted frame, which also
+        // pays for the triangles, so the estimate errs towards sorting
+        unsigned sorted_fragments   = g_DepthSort.sorted ? g_ShadedFragments : g_DepthSort.last_fragments;
+        unsigned unsorted_fragments = g_DepthSort.sorted ? g_DepthSort.last_fragments : g_ShadedFragments;
+        double   unsorted_ms        = g_DepthSort.sorted ? g_DepthSort.last_ms : frame_ms;
+        g_DepthSort.saved_ms = ((double)unsorted_fragments - sorted_fragments) * unsorted_ms / glm::max(unsorted_fragments, 1u);
+        g_DepthSort.enabled  = g_DepthSort.saved_ms > g_DepthSort.sort_ms;
+        g_DepthSort.frames   = 0;
+    } else if (g_ToggleSort) {
+        g_DepthSort.frames += 1;
+    }
+    g_DepthSort.last_fragments = g_ShadedFragments;
+    g_DepthSort.last_ms        = frame_ms;
+}
+
+// Draws the meshlets left by CullModel(), in the order of g_CandidateMeshlets.
+void RasterizeMeshlets(ModelObject model)
+{
+    if (!g_ToggleOcclusion || !model.meshlets) {
+        if (g_DepthSort.sorted) {
+            for (size_t c = 0; c < g_CandidateMeshlets.size(); c++) {
+                const Meshlet &meshlet = model.meshlets[g_CandidateMeshlets[c]];
+                for (unsigned i = meshlet.first; i < meshlet.first + meshlet.count; i++) {
+                    RasterizeTriangle(model.triangles[i]);
+                }
+            }
+            return;
+        }
+        for (size_t r = 0; r < g_VisibleRanges.size(); r++) {
+            for (unsigned i = g_VisibleRanges[r].first; i < g_VisibleRanges[r].first + g_VisibleRanges[r].count; i++) {
+                RasterizeTriangle(model.triangles[i]);
+            }
+        }
+        return;
+    }
+
+    // Occlusion culling in two passes: the meshlets visible in the last frame
+    // are drawn first, then the other candidates are tested against the depth
+    // pyramid they leave. The pyramid only holds depth of the current frame,
+    // so nothing visible is ever dropped, whatever the camera did.
+    if (g_MeshletVisible.size() != (size_t)model.num_meshlets) {
+        g_MeshletVisible.assign(model.num_meshlets, 0);
+    }
+    glm::mat4 viewport = Matrix_Viewport(0.0f, (float)g_ScreenWidth, (float)g_ScreenHeight, 0.0f);
+    glm::mat4 screen   = viewport * g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix;
+    g_DrawnMeshlets.clear();
+    g_VisibleTriangles = 0;
+    for (size_t c = 0; c < g_CandidateMeshlets.size(); c++) {
+        const Meshlet &meshlet = model.meshlets[g_CandidateMeshlets[c]];
+        if (g_MeshletVisible[g_CandidateMeshlets[c]]) {
+            g_DrawnMeshlets.push_back(g_CandidateMeshlets[c]);
+            for (unsigned i = meshlet.first; i < meshlet.first + meshlet.count; i++) {
+                RasterizeTriangle(model.triangles[i]);
+            }
+            g_VisibleTriangles += meshlet.count;
+        }
+    }
+    if (g_DrawnMeshlets.size() < g_CandidateMeshlets.size()) {
+        BuildDepthPyramid();
+        // the first level has the exact farthest depth of the same tiles, as
+        // long as both grids have the same tiles over the same plane (the
+        // pyramid of a deferred frame comes from the G-buffer or the
+        // visibility buffer, not from g_ColorBuffer)
+        static_assert(HIZ_TILE_SIZE == DEPTH_TILE_SIZE, "the Hi-Z level 0 texels must be the depth tiles");
+        if (g_ToggleTileDepth && g_Hiz.width[0] == g_DepthTiles.width && g_Hiz.height[0] == g_DepthTiles.height) {
+            for (int i = 0; i < g_DepthTiles.width * g_DepthTiles.height; i++) {
+                g_DepthTiles.tiles[i].max = g_Hiz.depth[0][i];
+            }
+        }
+    }
+    for (size_t c = 0; c < g_CandidateMeshlets.size(); c++) {
+        const Meshlet &meshlet = model.meshlets[g_CandidateMeshlets[c]];
+        if (g_MeshletVisible[g_CandidateMeshlets[c]]) {
+            continue;
+        }
+        if (HizOccluded(&g_Hiz, screen, meshlet.min, meshlet.max)) {
+            g_OccludedMeshlets += 1;
+            continue;
+        }
+        g_DrawnMeshlets.push_back(g_CandidateMeshlets[c]);
+        for (unsigned i = meshlet.first; i < meshlet.first + meshlet.count; i++) {
+            RasterizeTriangle(model.triangles[i]);
+        }
+        g_VisibleTriangles += meshlet.count;
+    }
+
+    // visible set of the next frame: the drawn meshlets that are not hidden
+    // by the final depth
+    BuildDepthPyramid();
+    std::fill(g_MeshletVisible.begin(), g_MeshletVisible.end(), 0);
+    for (size_t c = 0; c < g_DrawnMeshlets.size(); c++) {
+        const Meshlet &meshlet = model.meshlets[g_DrawnMeshlets[c]];
+        g_MeshletVisible[g_DrawnMeshlets[c]] = !HizOccluded(&g_Hiz, screen, meshlet.min, meshlet.max);
+    }
+}
+
+// Per pixel Phong shading of Close2GL goes through the G-buffer, so each
+// covered pixel is lit once. The overdraw view and points and lines keep the
+// forward path, which counts the depth tests and draws them.
+bool UseDeferredShading()
+{
+    return g_FragmentShaderType == 1 && g_ToggleSolid && !g_TogglePoints && !g_ToggleWireframe && !g_ToggleOverdraw;
+}
+
+// Builds g_Hiz from the depth of the current frame.
+void BuildDepthPyramid()
+{
+    if (g_Deferred && g_ToggleVisibility) {
+        HizBuild(&g_Hiz, g_Visibility.depth, 1, g_Visibility.width, g_Visibility.height);
+    } else if (g_Deferred) {
+        HizBuild(&g_Hiz, g_GBuffer.depth, 1, g_GBuffer.width, g_GBuffer.height);
+    } else {
+        HizBuild(&g_Hiz, &g_ColorBuffer.pixels[0].z, sizeof(ScreenPixel) / sizeof(float), g_ColorBuffer.width, g_ColorBuffer.height);
+    }
+}
+
+// Lighting pass of the deferred mode: the Phong model of triangles.frag at
+// every covered pixel of g_GBuffer, or the resolve of g_Visibility, written
+// into g_ColorBuffer.
+void ShadeDeferred()
+{
+    auto start = std::chrono::steady_clock::now();
+    glm::mat4 viewport = Matrix_Viewport(0.0f, (float)g_ScreenWidth, (float)g_ScreenHeight, 0.0f);
+    // the viewer colors every material with the color of the interface, as
+    // the OpenGL path does
+    g_Materials.assign(glm::max(g_Model.material_count, 1), glm::vec3(g_Red, g_Green, g_Blue));
+
+    GBufferLighting lighting;
+    lighting.screen_to_world  = glm::inverse(viewport * g_ProjectionMatrix * g_ViewMatrix);
+    lighting.camera           = glm::vec3(glm::inverse(g_ViewMatrix) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    lighting.light            = glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f));
+    lighting.ambient          = 0.2f * 0.2f;
+    lighting.materials        = g_Materials.data();
+    lighting.texture.data     = g_ToggleTexture ? g_Texture.textureData : NULL;
+    lighting.texture.blocks   = g_ToggleTexture ? g_Texture.blocks : BlockTexture();
+    lighting.texture.width    = g_Texture.width;
+    lighting.texture.height   = g_Texture.height;
+    lighting.texture.channels = g_Texture.channels;
+    lighting.texture.bilinear = !g_ToggleNearest;
+    lighting.rgb              = &g_ColorBuffer.pixels[0].r;
+    lighting.rgb_stride       = sizeof(ScreenPixel) / sizeof(unsigned short);
+    if (g_ToggleVisibility) {
+        VisibilityResolve(g_Visibility, g_VisibilityTriangles.data(), lighting, std::thread::hardware_concurrency());
+    } else {
+        GBufferLight(g_GBuffer, lighting, std::thread::hardware_concurrency());
+    }
+    g_LightingMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Renders only the depth of the model into target, a plane of the caller,
+// placed by matrix (projection * view * model) the way Close2GL places it, so
+// it can hold occluders or a shadow map. facing 1 drops the back faces of
+// clockwise models, -1 those of counterclockwise ones and 0 none. Meshlets
+// outside the frustum of matrix are skipped.
+void RasterizeDepth(ModelObject model, glm::mat4 matrix, DepthTarget target, float facing)
+{
+    glm::mat4 viewport = Matrix_Viewport(0.0f, (float)target.width, (float)target.height, 0.0f);
+    std::vector<BvhRange> ranges;
+    if (model.meshlets) {
+        std::vector<BvhRange> meshlets;
+        BvhCullFrustum(model.bvh_nodes, matrix, &meshlets);
+        for (size_t r = 0; r < meshlets.size(); r++) {
+            for (unsigned m = meshlets[r].first; m < meshlets[r].first + meshlets[r].count; m++) {
+                BvhAppendRange(&ranges, model.meshlets[m].first, model.meshlets[m].count);
+            }
+        }
+    } else {
+        BvhAppendRange(&ranges, 0, model.num_triangles);
+    }
+    for (size_t r = 0; r < ranges.size(); r++) {
+        for (unsigned i = ranges[r].first; i < ranges[r].first + ranges[r].count; i++) {
+            const Triangle &triangle = model.triangles[i];
+            DepthRasterClipTriangle(target, viewport,
+                                    matrix * glm::vec4(triangle.v0.pos, 1.0f),
+                                    matrix * glm::vec4(triangle.v1.pos, 1.0f),
+                                    matrix * glm::vec4(triangle.v2.pos, 1.0f), facing);
+        }
+    }
+}
+
+// Shows a depth plane of the size of the screen in g_ColorBuffer: the nearest
+// depth white, the farthest dark grey and empty pixels black.
+void ShowDepthPlane(DepthTarget target)
+{
+    float near_depth =  FLT_MAX;
+    float far_depth  = -FLT_MAX;
+    for (int i = 0; i < target.width * target.height; i++) {
+        if (target.depth[i] != FLT_MAX) {
+            near_depth = glm::min(near_depth, target.depth[i]);
+            far_depth  = glm::max(far_depth,  target.depth[i]);
+        }
+    }
+    float scale = (far_depth > near_depth) ? 1.0f / (far_depth - near_depth) : 0.0f;
+    for (int i = 0; i < target.width * target.height; i++) {
+        float z = target.depth[i];
+        unsigned char grey = (z == FLT_MAX) ? 0 : (unsigned char)(255.0f - 191.0f * (z - near_depth) * scale);
+        g_ColorBuffer.pixels[i].r = DisplayDecode(grey);
+        g_ColorBuffer.pixels[i].g = DisplayDecode(grey);
+        g_ColorBuffer.pixels[i].b = DisplayDecode(grey);
+        g_ColorBuffer.pixels[i].z = z;
+    }
+}
+
+void ClearColorBuffer()
+{
+    if (g_ColorBuffer.width != g_ScreenWidth || g_ColorBuffer.height != g_ScreenHeight || !g_ColorBuffer.pixels) {
+        free(g_ColorBuffer.pixels);
+        g_ColorBuffer.width  = g_ScreenWidth;
+        g_ColorBuffer.height = g_ScreenHeight;
+        g_ColorBuffer.pixels = (ScreenPixel*)calloc(g_ScreenHeight * g_ScreenWidth, sizeof(ScreenPixel));
+    }
+    // in memory order: walking the columns cost a cache miss per pixel
+    ScreenPixel clear = { DISPLAY_LINEAR_MAX, DISPLAY_LINEAR_MAX, DISPLAY_LINEAR_MAX, FLT_MAX };
+    std::fill(g_ColorBuffer.pixels, g_ColorBuffer.pixels + (size_t)g_ScreenWidth * g_ScreenHeight, clear);
+    if (g_ToggleTileDepth) {
+        int tiles_width  = (g_ScreenWidth  + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        int tiles_height = (g_ScreenHeight + DEPTH_TILE_SIZE - 1) >> DEPTH_TILE_SHIFT;
+        if (g_DepthTiles.width != tiles_width || g_DepthTiles.height != tiles_height || !g_DepthTiles.tiles) {
+            free(g_DepthTiles.tiles);
+            g_DepthTiles.width  = tiles_width;
+            g_DepthTiles.height = tiles_height;
+            g_DepthTiles.tiles  = (DepthTile*)malloc(tiles_width * tiles_height * sizeof(DepthTile));
+        }
+        g_DepthTiles.floor = FLT_MAX;
+        for (int i = 0; i < tiles_width * tiles_height; i++) {
+            g_DepthTiles.tiles[i].min = FLT_MAX;
+            g_DepthTiles.tiles[i].max = FLT_MAX;
+        }
+    }
+
+    if (g_ToggleOverdraw) {
+        if (g_Overdraw.width != g_ScreenWidth || g_Overdraw.height != g_ScreenHeight || !g_Overdraw.tests) {
+            free(g_Overdraw.tests);
+            free(g_Overdraw.passes);
+            g_Overdraw.width  = g_ScreenWidth;
+            g_Overdraw.height = g_ScreenHeight;
+            g_Overdraw.tests  = (unsigned*)calloc(g_ScreenHeight * g_ScreenWidth, sizeof(unsigned));
+            g_Overdraw.passes = (unsigned*)calloc(g_ScreenHeight * g_ScreenWidth, sizeof(unsigned));
+        }
+        memset(g_Overdraw.tests,  0, g_ScreenHeight * g_ScreenWidth * sizeof(unsigned));
+        memset(g_Overdraw.passes, 0, g_ScreenHeight * g_ScreenWidth * sizeof(unsigned));
+    }
+}
+
+// Ramp used by the overdraw heat map: blue, cyan, green, yellow, red.
+glm::vec3 HeatMapColour(float t)
+{
+    static const glm::vec3 ramp[] = {
+        glm::vec3(0.0f, 0.0f, 1.0f),
+        glm::vec3(0.0f, 1.0f, 1.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f),
+        glm::vec3(1.0f, 1.0f, 0.0f),
+        glm::vec3(1.0f, 0.0f, 0.0f)
+    };
+    t = glm::clamp(t, 0.0f, 1.0f) * 4.0f;
+    int   i = (t >= 4.0f) ? 3 : (int)t;
+    return glm::mix(ramp[i], ramp[i+1], t - i);
+}
+
+// Computes the overdraw statistics of the last rasterized frame and replaces
+// the colour of every covered pixel by its depth complexity, on a fixed scale
+// so frames can be compared with each other.
+void ResolveOverdraw()
+{
+    int       num_pixels  = g_Overdraw.width * g_Overdraw.height;
+    long long tests       = 0;
+    long long passes      = 0;
+    unsigned  max_tests   = 0;
+    int       covered     = 0;
+    for (int i = 0; i < num_pixels; i++) {
+        if (g_Overdraw.tests[i] == 0) {
+            continue;
+        }
+        tests  += g_Overdraw.tests[i];
+        passes += g_Overdraw.passes[i];
+        max_tests = (g_Overdraw.tests[i] > max_tests) ? g_Overdraw.tests[i] : max_tests;
+        covered += 1;
+    }
+    g_OverdrawStats.covered_pixels = covered;
+    g_OverdrawStats.max_tests      = max_tests;
+    g_OverdrawStats.average_tests  = covered ? (float)tests  / covered : 0.0f;
+    g_OverdrawStats.average_passes = covered ? (float)passes / covered : 0.0f;
+    // every covered pixel keeps exactly one of its shaded fragments
+    g_OverdrawStats.overwritten    = passes ? (float)(passes - covered) / passes : 0.0f;
+
+    for (int i = 0; i < num_pixels; i++) {
+        if (g_Overdraw.tests[i] == 0) {
+            continue;
+        }
+        float t = (float)(g_Overdraw.tests[i] - 1) / (OVERDRAW_HEAT_SCALE - 1);
+        glm::vec3 colour = HeatMapColour(t);
+        g_ColorBuffer.pixels[i].r = DisplayDecode(colour.x * 255);
+        g_ColorBuffer.pixels[i].g = DisplayDecode(colour.y * 255);
+        g_ColorBuffer.pixels[i].b = DisplayDecode(colour.z * 255);
+    }
+}
+
+// The output stage: the linear colors of buffer as display RGBA bytes, one
+// pixel after the other, through the table of display_encode.h.
+void EncodeColorBuffer(ColorBuffer buffer, unsigned char *rgba)
+{
+    const unsigned char *encode = DisplayTable().encode;
+    size_t pixels = (size_t)buffer.width * buffer.height;
+    for (size_t i = 0; i < pixels; i++) {
+        const ScreenPixel &pixel = buffer.pixels[i];
+        rgba[4 * i + 0] = encode[pixel.r];
+        rgba[4 * i + 1] = encode[pixel.g];
+        rgba[4 * i + 2] = encode[pixel.b];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+void WritePPM(const char *filename, ColorBuffer buffer)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("ERROR: unable to open file [%s]!\n", filename);
+        return;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", buffer.width, buffer.height);
+    // the color buffer starts at the bottom row
+    for (int j = buffer.height - 1; j >= 0; j--) {
+        for (int i = 0; i < buffer.width; i++) {
+            ScreenPixel pixel = buffer.pixels[getIndexColorBuffer(buffer, i, j)];
+            fputc(DisplayEncode(pixel.r), fp);
+            fputc(DisplayEncode(pixel.g), fp);
+            fputc(DisplayEncode(pixel.b), fp);
+        }
+    }
+    fclose(fp);
+}
+
+void SetupCamera(float theta, float phi, float distance)
+{
+    glm::vec4 camera_position_c = glm::vec4(distance*cos(phi)*sin(theta),
+                                            distance*sin(phi),
+                                            distance*cos(phi)*cos(theta),
+                                            1.0f);
+    glm::vec4 cameraView = glm::vec4(0.0f,0.0f,0.0f,1.0f) - camera_position_c;
+    glm::vec4 cameraUp   = glm::vec4(0.0f,1.0f,0.0f,0.0f);
+    g_ViewMatrix       = Matrix_Camera_View(camera_position_c, cameraView, cameraUp);
+    g_ProjectionMatrix = Matrix_Perspective(g_vFov, g_hFov, g_ScreenRatio, g_NearPlane, g_FarPlane);
+}
+
+// Restores the rendering options changed by ParseRenderOptions() to the
+// values the program starts with.
+void ResetRenderOptions()
+{
+    g_TogglePoints     = false;
+    g_ToggleSolid      = true;
+    g_ToggleWireframe  = false;
+    g_ToggleCW         = true;
+    g_ToggleGouraud    = false;
+    g_TogglePhong      = false;
+    g_ToggleTexture    = false;
+    g_ToggleNearest    = true;
+    g_ToggleLinear     = false;
+    g_ToggleOverdraw   = false;
+    g_ToggleOcclusion  = true;
+    g_ToggleTileDepth  = false;
+    g_ToggleSort       = false;
+    g_ToggleDepthOnly  = false;
+    g_ToggleVisibility = false;
+    g_TextureFormat    = BLOCK_FORMAT_NONE;
+    g_FragmentShaderType = 0;
+    g_ScreenWidth      = 800;
+    g_ScreenHeight     = 600;
+    // state carried from frame to frame, which would make a scene depend on the ones before it
+    g_DepthSort = DepthSortBudget();
+    g_DepthSort.enabled = true;
+    g_MeshletVisible.clear();
+}
+
+// Options shared by --render and the scenes of --regress. Returns false on an
+// unknown option.
+bool ParseRenderOptions(int argc, char **argv, int first, HeadlessCamera *camera)
+{
+    camera->theta    = 0.0f;
+    camera->phi      = 0.0f;
+    camera->distance = 5.0f;
+    for (int i = first; i < argc; i++) {
+        if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+            i++;
+            // the image is only decoded again when it changes
+            if (!g_Texture.textureData || strcmp(g_TextureFilename, argv[i]) != 0) {
+                stbi_image_free(g_Texture.textureData);
+                snprintf(g_TextureFilename, FILENAME_MAX, "%s", argv[i]);
+                ReadTextureImage(g_TextureFilename);
+            }
+            g_ToggleTexture = true;
+        } else if (strcmp(argv[i], "--bilinear") == 0) {
+            g_ToggleNearest = false;
+            g_ToggleLinear  = true;
+        } else if (strcmp(argv[i], "--shading") == 0 && i + 1 < argc) {
+            i++;
+            g_ToggleGouraud      = (strcmp(argv[i], "ad") == 0 || strcmp(argv[i], "ads") == 0);
+            g_TogglePhong        = (strcmp(argv[i], "ads") == 0);
+            g_FragmentShaderType = (strcmp(argv[i], "phong") == 0) ? 1 : 0;
+        } else if (strcmp(argv[i], "--points") == 0) {
+            g_TogglePoints = true;
+        } else if (strcmp(argv[i], "--wireframe") == 0) {
+            g_ToggleWireframe = true;
+            g_ToggleSolid     = false;
+        } else if (strcmp(argv[i], "--ccw") == 0) {
+            g_ToggleCW = false;
+        } else if (strcmp(argv[i], "--camera") == 0 && i + 3 < argc) {
+            camera->theta    = atof(argv[++i]);
+            camera->phi      = atof(argv[++i]);
+            camera->distance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            sscanf(argv[++i], "%dx%d", &g_ScreenWidth, &g_ScreenHeight);
+        } else if (strcmp(argv[i], "--overdraw") == 0) {
+            g_ToggleOverdraw = true;
+        } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+            g_ToggleOcclusion = false;
+        } else if (strcmp(argv[i], "--tile-depth") == 0) {
+            g_ToggleTileDepth = true;
+        } else if (strcmp(argv[i], "--sort") == 0) {
+            g_ToggleSort = true;
+        } else if (strcmp(argv[i], "--depth-only") == 0) {
+            g_ToggleDepthOnly = true;
+        } else if (strcmp(argv[i], "--visibility") == 0) {
+            g_ToggleVisibility = true;
+        } else if (strcmp(argv[i], "--texture-format") == 0 && i + 1 < argc) {
+            g_TextureFormat = ParseTextureFormat(argv[++i]);
+            if (g_TextureFormat < 0) {
+                fprintf(stderr, "ERROR: unknown texture format \"%s\".\n", argv[i]);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "ERROR: unknown option \"%s\".\n", argv[i]);
+            return false;
+        }
+    }
+    // the decoded image stays in textureData, so changing format only compresses it again
+    if (g_Texture.textureData && g_Texture.blocks.format != g_TextureFormat) {
+        g_Texture.blocks = BlockTexture();
+        if (g_TextureFormat != BLOCK_FORMAT_NONE) {
+            g_TextureBlocks.resize(BlockImageBytes(g_TextureFormat, g_Texture.width, g_Texture.height));
+            BlockCompressImage(g_Texture.textureData, g_Texture.width, g_Texture.height, g_TextureFormat,
+                               g_TextureBlocks.data(), std::thread::hardware_concurrency());
+            g_Texture.blocks.format = g_TextureFormat;
+            g_Texture.blocks.width  = g_Texture.width;
+            g_Texture.blocks.height = g_Texture.height;
+            g_Texture.blocks.data   = g_TextureBlocks.data();
+            g_Texture.blocks.id     = BlockTextureId();
+        }
+    }
+    g_ScreenRatio = (float)g_ScreenWidth / g_ScreenHeight;
+    return true;
+}
+
+// Loads a model and places it like the interactive viewer does.
+void LoadHeadlessModel(const char *filename)
+{
+    FreeModel(&g_Model);
+    snprintf(g_ModelFilename, FILENAME_MAX, "%s", filename);
+    g_Model = ReadModelFile(g_ModelFilename);
+
+    glm::vec3 min_coord;
+    glm::vec3 max_coord;
+    ComputeModelBounds(g_Model, &min_coord, &max_coord);
+    g_ModelMatrix = ComputeModelMatrix(min_coord, max_coord);
+}
+
+// Rasterizes the current model into g_ColorBuffer and returns the time taken in milliseconds.
+double RenderHeadlessFrame()
+{
+    if (g_ToggleDepthOnly) {
+        ClearColorBuffer();
+        g_DepthPlane.resize((size_t)g_ScreenWidth * g_ScreenHeight);
+        DepthTarget target = { g_ScreenWidth, g_ScreenHeight, g_DepthPlane.data() };
+        auto start = std::chrono::steady_clock::now();
+        DepthClear(target);
+        RasterizeDepth(g_Model, g_ProjectionMatrix * g_ViewMatrix * g_ModelMatrix, target, g_ToggleCW ? 1.0f : -1.0f);
+        double raster_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        ShowDepthPlane(target);
+        return raster_ms;
+    }
+    auto start = std::chrono::steady_clock::now();
+    ClearColorBuffer();
+    RasterizeClose2GL(g_Model);
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Renders a single Close2GL frame without creating any window:
+//   CMP143 --render <model.in> <output.ppm> [options]
+int RenderHeadless(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s --render <model.in> <output.ppm> [--texture <image>] [--bilinear]\n"
+                        "       [--shading none|ad|ads|phong] [--points|--wireframe] [--ccw] [--camera <theta> <phi> <distance>]\n"
+                        "       [--size <width>x<height>] [--overdraw] [--no-occlusion] [--tile-depth] [--sort] [--depth-only]\n"
+                        "       [--visibility] [--texture-format rgb|bc1|bc7]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *output = argv[3];
+    HeadlessCamera camera;
+    ResetRenderOptions(); // the headless renders sample rgb textures unless --texture-format says otherwise
+    if (!ParseRenderOptions(argc, argv, 4, &camera)) {
+        return EXIT_FAILURE;
+    }
+    g_UseClose2GL    = true;
+    g_DepthSortProbe = false;
+    LoadHeadlessModel(argv[2]);
+    SetupCamera(camera.theta, camera.phi, camera.distance);
+
+    double raster_ms = RenderHeadlessFrame();
+    printf("%s: %d triangles, %.3f ms\n", g_ModelFilename, g_Model.num_triangles, raster_ms);
+    if (g_ToggleDepthOnly) {
+        // nothing but the depth plane was drawn
+        WritePPM(output, g_ColorBuffer);
+        return EXIT_SUCCESS;
+    }
+    printf("meshlets: %d, %u in the frustum, %u facing away, %u occluded, %u triangles drawn\n",
+           g_Model.num_meshlets, g_FrustumMeshlets, g_BackfaceMeshlets, g_OccludedMeshlets, g_VisibleTriangles);
+    if (g_ToggleTileDepth) {
+        printf("depth tiles: %u triangles hidden, %u in front\n", g_TileHiddenTriangles, g_TileFrontTriangles);
+    }
+    if (g_DepthSort.sorted) {
+        printf("shaded fragments: %u, sorted front to back in %.3f ms\n", g_ShadedFragments, g_DepthSort.sort_ms);
+    } else {
+        printf("shaded fragments: %u, unsorted\n", g_ShadedFragments);
+    }
+    if (g_Deferred && g_ToggleVisibility) {
+        printf("deferred: visibility buffer of %u triangles, resolved in %.3f ms\n",
+               (unsigned)g_VisibilityTriangles.size(), g_LightingMs);
+    } else if (g_Deferred) {
+        printf("deferred: lighting pass %.3f ms\n", g_LightingMs);
+    }
+
+    if (g_ToggleOverdraw) {
+        ResolveOverdraw();
+        printf("overdraw: %d pixels covered, depth complexity avg %.2f max %u, shaded avg %.2f, overwritten %.1f%%\n",
+               g_OverdrawStats.covered_pixels, g_OverdrawStats.average_tests, g_OverdrawStats.max_tests,
+               g_OverdrawStats.average_passes, 100.0f * g_OverdrawStats.overwritten);
+    }
+    WritePPM(output, g_ColorBuffer);
+    return EXIT_SUCCESS;
+}
+
+// Reads a binary PPM written by WritePPM(). Returns false if the file is
+// missing or is not a P6 image with 8 bit channels.
+bool ReadPPM(const char *filename, int *width, int *height, std::vector<unsigned char> *rgb)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        return false;
+    }
+    int max_value = 0;
+    if (fscanf(fp, "P6 %d %d %d", width, height, &max_value) != 3 || max_value != 255) {
+        fclose(fp);
+        return false;
+    }
+    fgetc(fp); // single whitespace after the header
+    rgb->resize((size_t)*width * *height * 3);
+    bool complete = (fread(rgb->data(), 1, rgb->size(), fp) == rgb->size());
+    fclose(fp);
+    return complete;
+}
+
+// Golden-image and frame time regression gate for the Close2GL rasterizer:
+//   CMP143 --regress <scenes.txt> [--golden <dir>] [--baseline <file>] [--update]
+//          [--tolerance <n>] [--max-pixels <n>] [--min-psnr <dB>] [--threshold <percent>] [--repeat <n>]
+// Every line of the scene file is "<name> <model.in> [render options]", with
+// the options of --render. A scene fails when more than max-pixels pixels
+// differ from <golden>/<name>.ppm by more than tolerance in some channel, when
+// the PSNR falls below min-psnr, or when the best of repeat frame times is more
+// than threshold percent slower than the one stored in the baseline file.
+// A missing golden fails the scene, and a missing baseline entry skips its
+// time check; --update writes all of them from the current build. Returns
+// EXIT_FAILURE if any scene fails, else REGRESS_SKIPPED if any time check was
+// skipped (the baseline depends on the machine and is not versioned).
+int RunRegression(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s --regress <scenes.txt> [--golden <dir>] [--baseline <file>] [--update]\n"
+                        "       [--tolerance <n>] [--max-pixels <n>] [--min-psnr <dB>] [--threshold <percent>] [--repeat <n>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *scenes_filename   = argv[2];
+    const char *golden_dir        = "regress/golden";
+    const char *baseline_filename = "regress/baseline.txt";
+    bool   update     = false;
+    int    tolerance  = 2;      // per channel, absorbs rounding differences between compilers
+    int    max_pixels = 0;
+    double min_psnr   = 40.0;
+    double threshold  = 25.0;
+    int    repeat     = 10;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            golden_dir = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_filename = argv[++i];
+        } else if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-pixels") == 0 && i + 1 < argc) {
+            max_pixels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--min-psnr") == 0 && i + 1 < argc) {
+            min_psnr = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = glm::max(1, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "ERROR: unknown option \"%s\".\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *scenes = fopen(scenes_filename, "r");
+    if (!scenes) {
+        fprintf(stderr, "ERROR: unable to open file [%s]!\n", scenes_filename);
+        return EXIT_FAILURE;
+    }
+
+    // baseline file: one "<name> <milliseconds>" line per scene
+    std::map<std::string, double> baseline;
+    FILE *fp = fopen(baseline_filename, "r");
+    if (fp) {
+        char   name[256];
+        double ms;
+        while (fscanf(fp, "%255s %lf", name, &ms) == 2) {
+            baseline[name] = ms;
+        }
+        fclose(fp);
+    }
+    bool baseline_changed = false;
+
+    g_UseClose2GL    = true;
+    g_DepthSortProbe = false;
+    int  num_scenes = 0;
+    int  num_failed = 0;
+    int  num_skipped = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), scenes)) {
+        // split the line into words, skipping blank lines and comments
+        char *words[64];
+        int   num_words = 0;
+        for (char *word = strtok(line, " \t\r\n"); word && num_words < 64; word = strtok(NULL, " \t\r\n")) {
+            words[num_words++] = word;
+        }
+        if (num_words == 0 || words[0][0] == '#') {
+            continue;
+        }
+        if (num_words < 2) {
+            fprintf(stderr, "ERROR: scene \"%s\" has no model.\n", words[0]);
+            num_failed += 1;
+            continue;
+        }
+        const char *name = words[0];
+        num_scenes += 1;
+
+        ResetRenderOptions();
+        HeadlessCamera camera;
+        if (!ParseRenderOptions(num_words, words, 2, &camera)) {
+            num_failed += 1;
+            continue;
+        }
+        if (strcmp(g_ModelFilename, words[1]) != 0 || !g_Model.triangles) {
+            LoadHeadlessModel(words[1]);
+        }
+        SetupCamera(camera.theta, camera.phi, camera.distance);
+
+        // the first frame has no visible set from the last one to draw
+        // first, and its depth tests would differ from the frames after it
+        RenderHeadlessFrame();
+        double best_ms = DBL_MAX;
+        for (int r = 0; r < repeat; r++) {
+            best_ms = glm::min(best_ms, RenderHeadlessFrame());
+        }
+        if (g_ToggleOverdraw && !g_ToggleDepthOnly) {
+            ResolveOverdraw();
+        }
+
+        bool passed = true;
+        char golden_filename[FILENAME_MAX];
+        snprintf(golden_filename, FILENAME_MAX, "%s/%s.ppm", golden_dir, name);
+        int golden_width;
+        int golden_height;
+        std::vector<unsigned char> golden;
+        if (update) {
+            WritePPM(golden_filename, g_ColorBuffer);
+            printf("%-20s golden written to %s\n", name, golden_filename);
+        } else if (!ReadPPM(golden_filename, &golden_width, &golden_height, &golden)) {
+            printf("%-20s FAILED: no golden %s (--update writes it)\n", name, golden_filename);
+            passed = false;
+        } else if (golden_width != g_ColorBuffer.width || golden_height != g_ColorBuffer.height) {
+            printf("%-20s FAILED: golden is %dx%d, rendered %dx%d\n", name,
+                   golden_width, golden_height, g_ColorBuffer.width, g_ColorBuffer.height);
+            passed = false;
+        } else {
+            // the golden is stored top row first, as written by WritePPM()
+            int    bad_pixels  = 0;
+            double squared_sum = 0.0;
+            for (int j = 0; j < golden_height; j++) {
+                for (int i = 0; i < golden_width; i++) {
+                    ScreenPixel pixel  = g_ColorBuffer.pixels[getIndexColorBuffer(g_ColorBuffer, i, golden_height - 1 - j)];
+                    unsigned char *ref = &golden[3 * (i + j * golden_width)];
+                    int dr = abs(DisplayEncode(pixel.r) - ref[0]);
+                    int dg = abs(DisplayEncode(pixel.g) - ref[1]);
+                    int db = abs(DisplayEncode(pixel.b) - ref[2]);
+                    if (dr > tolerance || dg > tolerance || db > tolerance) {
+                        bad_pixels += 1;
+                    }
+                    squared_sum += dr * dr + dg * dg + db * db;
+                }
+            }
+            double mse  = squared_sum / (3.0 * golden_width * golden_height);
+            double psnr = (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+            if (bad_pixels > max_pixels || psnr < min_psnr) {
+                char actual_filename[FILENAME_MAX];
+                snprintf(actual_filename, FILENAME_MAX, "%s/%s.actual.ppm", golden_dir, name);
+                WritePPM(actual_filename, g_ColorBuffer);
+                printf("%-20s FAILED: %d pixels differ, PSNR %.2f dB (see %s)\n", name, bad_pixels, psnr, actual_filename);
+                passed = false;
+            } else {
+                printf("%-20s image ok: %d pixels differ, PSNR %.2f dB\n", name, bad_pixels, psnr);
+            }
+        }
+
+        auto stored = baseline.find(name);
+        if (update) {
+            baseline[name]   = best_ms;
+            baseline_changed = true;
+            printf("%-20s %.3f ms stored as baseline\n", name, best_ms);
+        } else if (stored == baseline.end()) {
+            printf("%-20s time SKIPPED: %.3f ms, no baseline in %s (--update stores it)\n", name, best_ms, baseline_filename);
+            num_skipped += 1;
+        } else {
+            double change = 100.0 * (best_ms - stored->second) / stored->second;
+            if (change > threshold) {
+                printf("%-20s FAILED: %.3f ms, baseline %.3f ms (%+.1f%%)\n", name, best_ms, stored->second, change);
+                passed = false;
+            } else {
+                printf("%-20s time ok: %.3f ms, baseline %.3f ms (%+.1f%%)\n", name, best_ms, stored->second, change);
+            }
+        }
+        num_failed += passed ? 0 : 1;
+    }
+    fclose(scenes);
+
+    if (baseline_changed) {
+        fp = fopen(baseline_filename, "w");
+        if (fp) {
+            for (auto &entry : baseline) {
+                fprintf(fp, "%s %.3f\n", entry.first.c_str(), entry.second);
+            }
+            fclose(fp);
+        } else {
+            printf("ERROR: unable to open file [%s]!\n", baseline_filename);
+        }
+    }
+    printf("%d scenes, %d failed, %d time checks skipped\n", num_scenes, num_failed, num_skipped);
+    if (num_failed > 0) {
+        return EXIT_FAILURE;
+    }
+    return (num_skipped == 0) ? EXIT_SUCCESS : REGRESS_SKIPPED;
+}
+
+void ErrorCallback(int error, const char *description)
+{
+    fprintf(stderr, "ERROR: GLFW %s\n", description);
+}
+
+void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mod)
+{
+    if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+        glfwSetWindowShouldClose(window, GL_TRUE);
+    }
+    // live input is ignored while a session is replayed
+    if (g_InputLog.mode == INPUT_LOG_REPLAY && !g_InputLog.dispatching) {
+        return;
+    }
+    InputKeyEvent event = { key, action, mod };
+    InputLogWrite(&g_InputLog, INPUT_EVENT_KEY, &event, sizeof(event), InputLogTime());
+    g_Redraw = true;
+
+    if (key == GLFW_KEY_W) {
+        if (action == GLFW_PRESS) {
+            g_W_pressed = true;
+        } else if (action == GLFW_RELEASE) {
+            g_W_pressed = false;
+        }
+    }
+
+    if (key == GLFW_KEY_A) {
+        if (action == GLFW_PRESS) {
+            g_A_pressed = true;
+        } else if (action == GLFW_RELEASE) {
+            g_A_pressed = false;
+        }
+    }
+
+    if (key == GLFW_KEY_S) {
+        if (action == GLFW_PRESS) {
+            g_S_pressed = true;
+        } else if (action == GLFW_RELEASE) {
+            g_S_pressed = false;
+        }
+    }
+
+    if (key == GLFW_KEY_D) {
+        if (action == GLFW_PRESS) {
+            g_D_pressed = true;
+        } else if (action == GLFW_RELEASE) {
+            g_D_pressed = false;
+        }
+    }
+
+    if (key == GLFW_KEY_Q) {
+        if (action == GLFW_PRESS) {
+            g_Q_pressed = true;
+        } else if (action == GLFW_RELEASE) {
+            g_Q_pressed = false;
+        }
+    }
+
+    if (key == GLFW_KEY_Z) {
+        if (action == GLFW_PRESS) {
             g_Z_pressed = true;
         } else if (action == GLFW_RELEASE) {
             g_Z_pressed = false;
@@ -3334,12 +4911,40 @@ void KeyCallback(GLFWwindow *window, int key, int scancode, int action, int mod)
             SetWindowTextW(w_VerticalFOV, L"37.5");
         }
     }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        g_PrintTimings = !g_PrintTimings;
+    }
+
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        g_ToggleVisibility = !g_ToggleVisibility;
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        g_ToggleSort = !g_ToggleSort;
+        g_DepthSort  = DepthSortBudget();
+        g_DepthSort.enabled = true;
+    }
 }
 
 void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
+{
+    if (g_InputLog.mode == INPUT_LOG_REPLAY && !g_InputLog.dispatching) {
+        return;
+    }
+    double xpos;
+    double ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+    InputButtonEvent event = { button, action, mods, (float)xpos, (float)ypos };
+    InputLogWrite(&g_InputLog, INPUT_EVENT_MOUSE_BUTTON, &event, sizeof(event), InputLogTime());
+    HandleMouseButton(button, action, xpos, ypos);
+}
+
+void HandleMouseButton(int button, int action, double xpos, double ypos)
 {
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-        glfwGetCursorPos(window, &g_LastCursorPosX, &g_LastCursorPosY);
+        g_LastCursorPosX = xpos;
+        g_LastCursorPosY = ypos;
         g_LeftMouseButtonPressed = true;
     }
     if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
@@ -3349,9 +4954,14 @@ void MouseButtonCallback(GLFWwindow *window, int button, int action, int mods)
 
 void CursorPosCallback(GLFWwindow *window, double xpos, double ypos)
 {
+    if (g_InputLog.mode == INPUT_LOG_REPLAY && !g_InputLog.dispatching) {
+        return;
+    }
     if (!g_LeftMouseButtonPressed) {
         return;
     }
+    InputCursorEvent event = { (float)xpos, (float)ypos };
+    InputLogWrite(&g_InputLog, INPUT_EVENT_CURSOR, &event, sizeof(event), InputLogTime());
     float dx = xpos - g_LastCursorPosX;
     float dy = ypos - g_LastCursorPosY;
 
@@ -3369,17 +4979,28 @@ void CursorPosCallback(GLFWwindow *window, double xpos, double ypos)
 
     g_LastCursorPosX = xpos;
     g_LastCursorPosY = ypos;
+    g_Redraw = true;
 }
 
 void FramebufferSizeCallback(GLFWwindow *window, int width, int height)
 {
+    InputResizeEvent event = { width, height };
+    InputLogWrite(&g_InputLog, INPUT_EVENT_RESIZE, &event, sizeof(event), InputLogTime());
     glViewport(0, 0, width, height);
     g_ScreenRatio  = (float)width / height;
     g_ScreenWidth  = width;
     g_ScreenHeight = height;
+    g_Redraw       = true;
 }
 
-void LoadShader(const char *filename, GLuint shader_id)
+// The window was uncovered or resized: its contents are lost, not the frame.
+void WindowRefreshCallback(GLFWwindow *window)
+{
+    g_Present = true;
+}
+
+// defines, one "#define NAME" line each, go right after the #version line
+std::string ReadShader(const char *filename, const char *defines)
 {
     std::ifstream file;
     try {
@@ -3392,8 +5013,16 @@ void LoadShader(const char *filename, GLuint shader_id)
     std::stringstream shader;
     shader << file.rdbuf();
     std::string str = shader.str();
-    const GLchar *shader_string = str.c_str();
-    const GLint   shader_string_length = static_cast<GLint>( str.length() );
+    size_t version_end = str.find('\n') + 1; // the first line, 0 without one
+    str.insert(version_end, std::string(defines) + "#line 2\n");
+    return str;
+}
+
+// Compiles source, read from filename by ReadShader().
+void LoadShader(const char *filename, GLuint shader_id, const std::string &source)
+{
+    const GLchar *shader_string = source.c_str();
+    const GLint   shader_string_length = static_cast<GLint>( source.length() );
 
     glShaderSource(shader_id, 1, &shader_string, &shader_string_length);
     glCompileShader(shader_id);
@@ -3428,17 +5057,17 @@ void LoadShader(const char *filename, GLuint shader_id)
     delete [] log;
 }
 
-GLuint LoadShader_Fragment(const char *filename)
+GLuint LoadShader_Fragment(const char *filename, const std::string &source)
 {
     GLuint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
-    LoadShader(filename, fragment_shader_id);
+    LoadShader(filename, fragment_shader_id, source);
     return fragment_shader_id;
 }
 
-GLuint LoadShader_Vertex(const char *filename)
+GLuint LoadShader_Vertex(const char *filename, const std::string &source)
 {
     GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
-    LoadShader(filename, vertex_shader_id);
+    LoadShader(filename, vertex_shader_id, source);
     return vertex_shader_id;
 }
 
@@ -3448,6 +5077,7 @@ GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id)
 
     glAttachShader(program_id, vertex_shader_id);
     glAttachShader(program_id, fragment_shader_id);
+    glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program_id);
 
     GLint linked_ok = GL_FALSE;
@@ -3469,6 +5099,64 @@ GLuint CreateGpuProgram(GLuint vertex_shader_id, GLuint fragment_shader_id)
     return program_id;
 }
 
+GpuProgram *LoadGpuProgram(unsigned key)
+{
+    std::map<unsigned, GpuProgram>::iterator found = g_GpuPrograms.find(key);
+    if (found != g_GpuPrograms.end()) {
+        return &found->second;
+    }
+    std::string defines;
+    if (key & GPU_PROGRAM_CLOSE2GL_BLIT) {
+        defines += "#define CLOSE2GL_BLIT\n";
+    }
+    switch (key & GPU_PROGRAM_SHADING_MASK) {
+      case GPU_PROGRAM_GOURAUD_AD:  defines += "#define GOURAUD_AD\n";  break;
+      case GPU_PROGRAM_GOURAUD_ADS: defines += "#define GOURAUD_ADS\n"; break;
+      case GPU_PROGRAM_PHONG:       defines += "#define PHONG\n";       break;
+    }
+    if (key & GPU_PROGRAM_TEXTURE) {
+        defines += "#define USE_TEXTURE\n";
+    }
+    std::string vertex_source   = ReadShader("../triangles.vert", defines.c_str());
+    std::string fragment_source = ReadShader("../triangles.frag", defines.c_str());
+    unsigned long long binary_key = ProgramCacheKey(g_ProgramCache, vertex_source, fragment_source);
+
+    GpuProgram program;
+    program.program_id = ProgramCacheLoad(&g_ProgramCache, binary_key);
+    if (!program.program_id) {
+        GLuint vertex_shader_id   = LoadShader_Vertex("../triangles.vert", vertex_source);
+        GLuint fragment_shader_id = LoadShader_Fragment("../triangles.frag", fragment_source);
+        program.program_id = CreateGpuProgram(vertex_shader_id, fragment_shader_id);
+        glDeleteShader(vertex_shader_id);
+        glDeleteShader(fragment_shader_id);
+        ProgramCacheStore(&g_ProgramCache, binary_key, program.program_id);
+    }
+    return &(g_GpuPrograms[key] = program);
+}
+
+// Makes g_GpuProgram the program of the current toggles; the next frame binds it.
+void SelectGpuProgram()
+{
+    unsigned key;
+    if (g_UseClose2GL) {
+        key = GPU_PROGRAM_CLOSE2GL_BLIT;
+    } else {
+        if (g_FragmentShaderType == 1) {
+            key = GPU_PROGRAM_PHONG;
+        } else if (g_VertexShaderType == 1) {
+            key = GPU_PROGRAM_GOURAUD_AD;
+        } else if (g_VertexShaderType == 2) {
+            key = GPU_PROGRAM_GOURAUD_ADS;
+        } else {
+            key = 0;
+        }
+        if (g_ToggleTexture) {
+            key |= GPU_PROGRAM_TEXTURE;
+        }
+    }
+    g_GpuProgram = LoadGpuProgram(key);
+}
+
 int OpenFile(HWND hWnd, char type)
 {
     OPENFILENAME ofn;
@@ -3510,6 +5198,10 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
 {
     switch (msg) {
       case WM_COMMAND: {
+        // the controls are driven by the log while a session is replayed
+        if (g_InputLog.mode == INPUT_LOG_REPLAY && wp != PROC_INFO_MENU && wp != PROC_EXIT_MENU) {
+            break;
+        }
         switch (wp) {
           case PROC_INFO_MENU: {
             MessageBox(NULL, "CMP143", "About", MB_OK);
@@ -3529,6 +5221,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
                     MessageBox(NULL, "Arquivo nao encontrado!", "ERRO", MB_OK);
                     return -1;
                 }
+                EvictModel();
                 g_Model = ReadModelFile(g_ModelFilename);
                 g_VertexArrayObject_id = BuildTriangles(g_Model);
             }
@@ -3667,12 +5360,12 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             } else if (checkedState == BST_UNCHECKED) {
                 g_UseClose2GL = true;
                 glFrontFace(GL_CCW);
-                g_VirtualScene["model"].rendering_mode = GL_TRIANGLES;
+                g_Scene.rendering_mode = GL_TRIANGLES;
                 glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
                 printf("usando close2GL\n");
             }
             g_VertexArrayObject_id = BuildTriangles(g_Model);
-            glUniform1i(g_UseClose2GLLocation, g_UseClose2GL);
+            SelectGpuProgram();
             break;
           }
           case PROC_TOGGLE_SOLID: {
@@ -3682,14 +5375,14 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             if (points == BST_CHECKED) {
                 g_TogglePoints = true;
                 if (!g_UseClose2GL) {
-                    g_VirtualScene["model"].rendering_mode = GL_POINTS;
+                    g_Scene.rendering_mode = GL_POINTS;
                 }
             } else if (wireframe == BST_CHECKED) {
                 g_TogglePoints = false;
                 g_ToggleWireframe = true;
                 g_ToggleSolid = false;
                 if (!g_UseClose2GL) {
-                    g_VirtualScene["model"].rendering_mode = GL_TRIANGLES;
+                    g_Scene.rendering_mode = GL_TRIANGLES;
                     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
                 }
             } else if (solid == BST_CHECKED) {
@@ -3697,7 +5390,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
                 g_ToggleWireframe = false;
                 g_ToggleSolid = true;
                 if (!g_UseClose2GL) {
-                    g_VirtualScene["model"].rendering_mode = GL_TRIANGLES;
+                    g_Scene.rendering_mode = GL_TRIANGLES;
                     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
                 }
             }
@@ -3732,8 +5425,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             g_TogglePhong = false;
             g_VertexShaderType = 0;
             g_FragmentShaderType = 0;
-            glUniform1i(g_VertexShaderTypeLocation, g_VertexShaderType);
-            glUniform1i(g_FragmentShaderTypeLocation, g_FragmentShaderType);
+            SelectGpuProgram();
             printf("No shading\n");
             break;
           }
@@ -3742,8 +5434,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             g_TogglePhong = false;
             g_VertexShaderType = 1;  
             g_FragmentShaderType = 0;
-            glUniform1i(g_VertexShaderTypeLocation, g_VertexShaderType);
-            glUniform1i(g_FragmentShaderTypeLocation, g_FragmentShaderType);
+            SelectGpuProgram();
             printf("Gouraud AD shading\n");
             break;
           }
@@ -3752,8 +5443,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             g_TogglePhong = true;
             g_VertexShaderType = 2;
             g_FragmentShaderType = 0;
-            glUniform1i(g_VertexShaderTypeLocation, g_VertexShaderType);
-            glUniform1i(g_FragmentShaderTypeLocation, g_FragmentShaderType);
+            SelectGpuProgram();
             printf("Gouraud ADS shading\n");
             break;
           }
@@ -3762,8 +5452,7 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
             g_TogglePhong = false;
             g_VertexShaderType = 0;
             g_FragmentShaderType = 1;
-            glUniform1i(g_VertexShaderTypeLocation, g_VertexShaderType);
-            glUniform1i(g_FragmentShaderTypeLocation, g_FragmentShaderType);
+            SelectGpuProgram();
             printf("Phong shading\n");
             break;
           }
@@ -3775,30 +5464,43 @@ LRESULT CALLBACK WindowProcedure(HWND hWnd, UINT msg, WPARAM wp, LPARAM lp)
               } else {
                   g_ToggleTexture = false;
               }
-              glUniform1i(g_UseTextureLocation, g_ToggleTexture);
+              SelectGpuProgram();
+              break;
           }
           case PROC_NEAREST_NEIGHBOUR: {
             g_ToggleNearest = true;
             g_ToggleLinear = false;
             g_ToggleMipMapping = false;
-            LoadTextureImage(g_TextureFilename);
+            SelectTextureFilter();
             break;
           }
           case PROC_BILINEAR: {
             g_ToggleNearest = false;
             g_ToggleLinear = true;
             g_ToggleMipMapping = false;
-            LoadTextureImage(g_TextureFilename);
+            SelectTextureFilter();
             break;
           }
           case PROC_MIPMAPPING: {
             g_ToggleNearest = false;
             g_ToggleLinear = false;
             g_ToggleMipMapping = true;
-            LoadTextureImage(g_TextureFilename);
+            SelectTextureFilter();
+            break;
+          }
+          case PROC_OVERDRAW: {
+            SendMessageW(w_ToggleOverdraw, BM_SETCHECK, !g_ToggleOverdraw, 0);
+            int checkedState = SendMessageW(w_ToggleOverdraw, BM_GETCHECK, 0, 0);
+            if (checkedState == BST_CHECKED) {
+                g_ToggleOverdraw = true;
+            } else {
+                g_ToggleOverdraw = false;
+            }
             break;
           }
         }
+        RecordUiState(false);
+        g_Redraw = true; // every control changes the frame, or may
         break;
       }
       case WM_DESTROY: {
@@ -4186,6 +5888,16 @@ void AddControls(HWND hWnd)
         (HMENU)PROC_MIPMAPPING,
         (HINSTANCE)GetWindowLongPtr(hWnd, GWLP_HINSTANCE),
         NULL);
+
+    w_ToggleOverdraw = CreateWindowW(
+        L"BUTTON", L"OVERDRAW (CLOSE2GL)",
+        WS_TABSTOP | WS_VISIBLE | WS_CHILD | BS_CHECKBOX,
+        560, 220,
+        250, 25,
+        hWnd,
+        (HMENU)PROC_OVERDRAW,
+        (HINSTANCE)GetWindowLongPtr(hWnd, GWLP_HINSTANCE),
+        NULL);
 }
 
 void ShowFramesPerSecond()
@@ -4194,7 +5906,7 @@ void ShowFramesPerSecond()
     // subsequentes da função!
     static float old_seconds = (float)glfwGetTime();
     static int   ellapsed_frames = 0;
-    static char  buffer[20] = "CMP143 - ?? fps";
+    static char  buffer[256] = "CMP143 - ?? fps";
 
     ellapsed_frames += 1;
 
@@ -4206,10 +5918,261 @@ void ShowFramesPerSecond()
 
     if ( ellapsed_seconds > 1.0f )
     {
-        snprintf(buffer, 20, "CMP143 - %.2f fps", ellapsed_frames / ellapsed_seconds);
+        // tempos de CPU medidos no laço principal e de GPU lidos do anel de queries
+        double cpu_frame_ms  = 1000.0 * g_CpuFrameSeconds  / ellapsed_frames;
+        double cpu_raster_ms = 1000.0 * g_CpuRasterSeconds / ellapsed_frames;
+        double gpu_draw_ms   = GpuTimerAverage(&g_GpuTimer, GPU_TIMER_DRAW);
+        double gpu_upload_ms = GpuTimerAverage(&g_GpuTimer, GPU_TIMER_UPLOAD);
+        double gpu_swap_ms   = GpuTimerAverage(&g_GpuTimer, GPU_TIMER_SWAP);
+
+        int length = snprintf(buffer, sizeof(buffer), "CMP143 - %.2f fps | cpu %.2f ms (close2gl %.2f) | %u/%zu tris",
+                              ellapsed_frames / ellapsed_seconds, cpu_frame_ms, cpu_raster_ms,
+                              g_VisibleTriangles, g_UseClose2GL ? (size_t)g_Model.num_triangles : g_Scene.triangles);
+        length = glm::min(length, (int)sizeof(buffer) - 1); // snprintf returns the length it wanted to write
+        if (g_GpuTimer.enabled) {
+            length += snprintf(buffer + length, sizeof(buffer) - length, " | gpu draw %.2f upload %.2f swap %.2f ms",
+                               gpu_draw_ms, gpu_upload_ms, gpu_swap_ms);
+            length = glm::min(length, (int)sizeof(buffer) - 1);
+        }
+        if (g_UseClose2GL && g_ToggleOverdraw) {
+            length += snprintf(buffer + length, sizeof(buffer) - length, " | overdraw avg %.2f max %u overwritten %.1f%%",
+                               g_OverdrawStats.average_tests, g_OverdrawStats.max_tests, 100.0f * g_OverdrawStats.overwritten);
+            length = glm::min(length, (int)sizeof(buffer) - 1);
+        }
+        if (g_UseClose2GL && g_ToggleSort) {
+            length += snprintf(buffer + length, sizeof(buffer) - length, " | sort %s: %u frags, saves %.2f ms for %.2f",
+                               g_DepthSort.enabled ? "on" : "off", g_ShadedFragments, g_DepthSort.saved_ms, g_DepthSort.sort_ms);
+            length = glm::min(length, (int)sizeof(buffer) - 1);
+        }
+        if (g_UseClose2GL && g_Deferred) {
+            snprintf(buffer + length, sizeof(buffer) - length, " | deferred %s %.2f ms",
+                     g_ToggleVisibility ? "resolve" : "lighting", g_LightingMs);
+        }
+        if (g_PrintTimings) {
+            printf("%s\n", buffer);
+        }
 
         old_seconds = seconds;
         ellapsed_frames = 0;
+        g_CpuFrameSeconds  = 0.0;
+        g_CpuRasterSeconds = 0.0;
     }
     glfwSetWindowTitle(g_GLWindow, buffer);
 }
+
+float InputLogTime()
+{
+    return (float)(glfwGetTime() - g_InputLogStart);
+}
+
+UiState CaptureUiState()
+{
+    UiState state;
+    memset(&state, 0, sizeof(state)); // the padding is compared by RecordUiState()
+    state.use_close2gl         = g_UseClose2GL;
+    state.points               = g_TogglePoints;
+    state.wireframe            = g_ToggleWireframe;
+    state.solid                = g_ToggleSolid;
+    state.cw                   = g_ToggleCW;
+    state.gouraud              = g_ToggleGouraud;
+    state.phong                = g_TogglePhong;
+    state.texture              = g_ToggleTexture;
+    state.nearest              = g_ToggleNearest;
+    state.linear               = g_ToggleLinear;
+    state.mipmapping           = g_ToggleMipMapping;
+    state.overdraw             = g_ToggleOverdraw;
+    state.look_at              = g_LookAtCamera;
+    state.reset_camera         = g_ResetCamera;
+    state.vertex_shader_type   = g_VertexShaderType;
+    state.fragment_shader_type = g_FragmentShaderType;
+    state.near_plane           = g_NearPlane;
+    state.far_plane            = g_FarPlane;
+    state.hfov                 = g_hFov;
+    state.vfov                 = g_vFov;
+    state.red                  = g_Red;
+    state.green                = g_Green;
+    state.blue                 = g_Blue;
+    state.camera_theta         = g_CameraTheta;
+    state.camera_phi           = g_CameraPhi;
+    state.camera_distance      = g_CameraDistance;
+    return state;
+}
+
+void SetCheck(HWND control, bool checked)
+{
+    SendMessageW(control, BM_SETCHECK, checked ? BST_CHECKED : BST_UNCHECKED, 0);
+}
+
+void SetNumberText(HWND control, float value)
+{
+    wchar_t text[BUFFER_SIZE];
+    swprintf(text, BUFFER_SIZE, L"%g", value);
+    SetWindowTextW(control, text);
+}
+
+// Sets the state saved by CaptureUiState() together with the OpenGL state and
+// the controls the window procedure changes along with it.
+void ApplyUiState(UiState state)
+{
+    UiState previous = CaptureUiState();
+    g_UseClose2GL      = state.use_close2gl;
+    g_TogglePoints     = state.points;
+    g_ToggleWireframe  = state.wireframe;
+    g_ToggleSolid      = state.solid;
+    g_ToggleCW         = state.cw;
+    g_ToggleGouraud    = state.gouraud;
+    g_TogglePhong      = state.phong;
+    g_ToggleTexture    = state.texture;
+    g_ToggleNearest    = state.nearest;
+    g_ToggleLinear     = state.linear;
+    g_ToggleMipMapping = state.mipmapping;
+    g_ToggleOverdraw   = state.overdraw;
+    g_LookAtCamera     = state.look_at;
+    g_ResetCamera      = g_ResetCamera || state.reset_camera;
+    g_VertexShaderType   = state.vertex_shader_type;
+    g_FragmentShaderType = state.fragment_shader_type;
+    g_NearPlane      = state.near_plane;
+    g_FarPlane       = state.far_plane;
+    g_hFov           = state.hfov;
+    g_vFov           = state.vfov;
+    g_Red            = state.red;
+    g_Green          = state.green;
+    g_Blue           = state.blue;
+    g_CameraTheta    = state.camera_theta;
+    g_CameraPhi      = state.camera_phi;
+    g_CameraDistance = state.camera_distance;
+
+    if (g_UseClose2GL) {
+        glFrontFace(GL_CCW);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    } else {
+        glFrontFace(g_ToggleCW ? GL_CW : GL_CCW);
+        glPolygonMode(GL_FRONT_AND_BACK, g_ToggleWireframe ? GL_LINE : GL_FILL);
+    }
+    SelectGpuProgram();
+    if (g_VertexArrayObject_id != -1) {
+        if (previous.use_close2gl != state.use_close2gl) {
+            g_VertexArrayObject_id = BuildTriangles(g_Model);
+        }
+        g_Scene.rendering_mode = (!g_UseClose2GL && g_TogglePoints) ? GL_POINTS : GL_TRIANGLES;
+    }
+    if (previous.nearest != state.nearest || previous.linear != state.linear || previous.mipmapping != state.mipmapping) {
+        SelectTextureFilter();
+    }
+
+    SetCheck(w_ToggleGL,         !g_UseClose2GL);
+    SetCheck(w_ToggleCW,         g_ToggleCW);
+    SetCheck(w_ToggleCCW,        !g_ToggleCW);
+    SetCheck(w_TogglePoints,     g_TogglePoints);
+    SetCheck(w_ToggleWireframe,  !g_TogglePoints && g_ToggleWireframe);
+    SetCheck(w_ToggleSolid,      !g_TogglePoints && g_ToggleSolid);
+    SetCheck(w_ToggleNoShading,  g_VertexShaderType == 0 && g_FragmentShaderType == 0);
+    SetCheck(w_ToggleGouraudAD,  g_VertexShaderType == 1);
+    SetCheck(w_ToggleGouraudADS, g_VertexShaderType == 2);
+    SetCheck(w_TogglePhong,      g_FragmentShaderType == 1);
+    SetCheck(w_ToggleTexture,    g_ToggleTexture);
+    SetCheck(w_ToggleNearest,    g_ToggleNearest);
+    SetCheck(w_ToggleBilinear,   g_ToggleLinear);
+    SetCheck(w_ToggleMipMapping, g_ToggleMipMapping);
+    SetCheck(w_ToggleOverdraw,   g_ToggleOverdraw);
+    SetCheck(w_LookAtCheckbox,   g_LookAtCamera);
+    SetNumberText(w_NearPlaneBox,  -g_NearPlane);
+    SetNumberText(w_FarPlaneBox,   -g_FarPlane);
+    SetNumberText(w_HorizontalFOV, glm::degrees(g_hFov));
+    SetNumberText(w_VerticalFOV,   glm::degrees(g_vFov));
+    SetNumberText(w_RedBox,        glm::round(g_Red   * 255));
+    SetNumberText(w_GreenBox,      glm::round(g_Green * 255));
+    SetNumberText(w_BlueBox,       glm::round(g_Blue  * 255));
+}
+
+// Writes the files opened and the UI state to the log when they changed since
+// the last call, or always when force is set.
+void RecordUiState(bool force)
+{
+    if (g_InputLog.mode != INPUT_LOG_RECORD) {
+        return;
+    }
+    // a cancelled file dialog leaves the name empty and the old file loaded
+    if (g_ModelFilename[0] && strcmp(g_ModelFilename, g_RecordedModelFilename) != 0) {
+        snprintf(g_RecordedModelFilename, FILENAME_MAX, "%s", g_ModelFilename);
+        InputLogWrite(&g_InputLog, INPUT_EVENT_MODEL, g_ModelFilename, strlen(g_ModelFilename), InputLogTime());
+    }
+    if (g_TextureFilename[0] && strcmp(g_TextureFilename, g_RecordedTextureFilename) != 0) {
+        snprintf(g_RecordedTextureFilename, FILENAME_MAX, "%s", g_TextureFilename);
+        InputLogWrite(&g_InputLog, INPUT_EVENT_TEXTURE, g_TextureFilename, strlen(g_TextureFilename), InputLogTime());
+    }
+    UiState state = CaptureUiState();
+    if (force || memcmp(&state, &g_RecordedUiState, sizeof(UiState)) != 0) {
+        g_RecordedUiState = state;
+        InputLogWrite(&g_InputLog, INPUT_EVENT_UI_STATE, &state, sizeof(state), InputLogTime());
+    }
+}
+
+// Dispatches the logged events of the current frame through the same handlers
+// as the live input. The window is closed after the last frame of the session.
+void ReplayInputEvents()
+{
+    static double replay_start = glfwGetTime();
+    InputEvent event;
+    g_InputLog.dispatching = true;
+    while (InputLogNext(&g_InputLog, &event)) {
+        unsigned short size = (event.type == INPUT_EVENT_UI_STATE) ? sizeof(UiState) : InputEventSize(event.type);
+        if (size && event.size != size) {
+            fprintf(stderr, "WARNING: skipping input event of type %d in frame %u, %d bytes instead of %d.\n",
+                    event.type, event.frame, event.size, size);
+            continue;
+        }
+        switch (event.type) {
+          case INPUT_EVENT_KEY: {
+            InputKeyEvent *key = (InputKeyEvent*)event.payload;
+            KeyCallback(g_GLWindow, key->key, 0, key->action, key->mods);
+            break;
+          }
+          case INPUT_EVENT_MOUSE_BUTTON: {
+            InputButtonEvent *button = (InputButtonEvent*)event.payload;
+            HandleMouseButton(button->button, button->action, button->x, button->y);
+            break;
+          }
+          case INPUT_EVENT_CURSOR: {
+            InputCursorEvent *cursor = (InputCursorEvent*)event.payload;
+            CursorPosCallback(g_GLWindow, cursor->x, cursor->y);
+            break;
+          }
+          case INPUT_EVENT_RESIZE: {
+            InputResizeEvent *resize = (InputResizeEvent*)event.payload;
+            glfwSetWindowSize(g_GLWindow, resize->width, resize->height);
+            FramebufferSizeCallback(g_GLWindow, resize->width, resize->height);
+            break;
+          }
+          case INPUT_EVENT_UI_STATE: {
+            UiState state;
+            memcpy(&state, event.payload, sizeof(UiState));
+            ApplyUiState(state);
+            break;
+          }
+          case INPUT_EVENT_MODEL: {
+            event.payload[event.size] = '\0';
+            snprintf(g_ModelFilename, FILENAME_MAX, "%s", (char*)event.payload);
+            EvictModel();
+            g_Model = ReadModelFile(g_ModelFilename);
+            g_VertexArrayObject_id = BuildTriangles(g_Model);
+            break;
+          }
+          case INPUT_EVENT_TEXTURE: {
+            event.payload[event.size] = '\0';
+            snprintf(g_TextureFilename, FILENAME_MAX, "%s", (char*)event.payload);
+            LoadTextureImage(g_TextureFilename);
+            break;
+          }
+        }
+    }
+    g_InputLog.dispatching = false;
+
+    if (!g_InputLog.has_next) {
+        double seconds = glfwGetTime() - replay_start;
+        printf("replayed %u frames in %.2f s (%.3f ms/frame)\n", g_InputLog.frame, seconds,
+               1000.0 * seconds / glm::max(1u, g_InputLog.frame));
+        InputLogClose(&g_InputLog);
+        glfwSetWindowShouldClose(g_GLWindow, GL_TRUE);
+    }
+}
@@ -0,0 +1,316 @@
+// Synthetic mesh generator for scaling tests. Writes models in the same .in
+// format read by ReadModelFile():
+//
+//   meshgen <sphere|torus|terrain|soup> <triangles> <output.in> [--uv] [--materials <n>] [--seed <n>]
+//
+// The requested triangle count is approximate for the parametric shapes (the
+// tessellation is rounded to whole rows) and exact for the triangle soup.
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/geometric.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#define SHAPE_SPHERE  0
+#define SHAPE_TORUS   1
+#define SHAPE_TERRAIN 2
+#define SHAPE_SOUP    3
+
+#define PI 3.14159265358979f
+
+struct MeshVertex {
+    glm::vec3 pos;
+    glm::vec3 normal;
+    glm::vec2 texture;
+};
+
+struct MeshWriter {
+    FILE     *fp;
+    bool      texture;
+    int       material_count;
+    long long total;
+    long long written;
+};
+
+// xorshift, so the output only depends on the seed and not on the C library
+static unsigned int g_Seed = 1;
+
+float RandomFloat()
+{
+    g_Seed ^= g_Seed << 13;
+    g_Seed ^= g_Seed >> 17;
+    g_Seed ^= g_Seed << 5;
+    return (g_Seed & 0xFFFFFF) / (float)0x1000000;
+}
+
+void WriteHeader(MeshWriter *writer, const char *name, long long num_triangles)
+{
+    writer->total = num_triangles;
+    fprintf(writer->fp, "Object name = %s\n", name);
+    fprintf(writer->fp, "# triangles = %lld\n", num_triangles);
+    fprintf(writer->fp, "Material count = %d\n", writer->material_count);
+    for (int i = 0; i < writer->material_count; i++) {
+        // spread the diffuse colours so the materials can be told apart
+        float t = (writer->material_count > 1) ? (float)i / (writer->material_count - 1) : 0.5f;
+        fprintf(writer->fp, "ambient color %.3f %.3f %.3f\n", 0.2f, 0.2f, 0.2f);
+        fprintf(writer->fp, "diffuse color %.3f %.3f %.3f\n", 0.2f + 0.8f * t, 0.6f, 1.0f - 0.8f * t);
+        fprintf(writer->fp, "specular color %.3f %.3f %.3f\n", 1.0f, 1.0f, 1.0f);
+        fprintf(writer->fp, "material shine %.3f\n", 32.0f);
+    }
+    fprintf(writer->fp, "Texture = %s\n", writer->texture ? "YES" : "NO");
+    if (writer->texture) {
+        fprintf(writer->fp, "-- 3*[pos(x,y,z) normal(x,y,z) color_index text_coord] face_normal(x,y,z)\n");
+    } else {
+        fprintf(writer->fp, "-- 3*[pos(x,y,z) normal(x,y,z) color_index] face_normal(x,y,z)\n");
+    }
+}
+
+void WriteVertex(MeshWriter *writer, const char *label, MeshVertex v, int material)
+{
+    if (writer->texture) {
+        fprintf(writer->fp, "%s %.5f %.5f %.5f %.4f %.4f %.4f %d %.4f %.4f\n", label,
+                v.pos.x, v.pos.y, v.pos.z, v.normal.x, v.normal.y, v.normal.z, material,
+                v.texture.x, v.texture.y);
+    } else {
+        fprintf(writer->fp, "%s %.5f %.5f %.5f %.4f %.4f %.4f %d\n", label,
+                v.pos.x, v.pos.y, v.pos.z, v.normal.x, v.normal.y, v.normal.z, material);
+    }
+}
+
+// Triangles are written clockwise when seen from the side their normal points
+// to, which is the default front face of the viewer.
+void WriteTriangle(MeshWriter *writer, MeshVertex v0, MeshVertex v1, MeshVertex v2)
+{
+    glm::vec3 face_normal = glm::cross(v2.pos - v0.pos, v1.pos - v0.pos);
+    float     length      = glm::length(face_normal);
+    face_normal = (length > 0.0f) ? face_normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+    // materials are assigned in contiguous bands so each one is a large region
+    int material = 0;
+    if (writer->material_count > 1) {
+        material = (int)(writer->written * writer->material_count / writer->total);
+    }
+
+    WriteVertex(writer, "v0", v0, material);
+    WriteVertex(writer, "v1", v1, material);
+    WriteVertex(writer, "v2", v2, material);
+    fprintf(writer->fp, "face normal %.4f %.4f %.4f\n", face_normal.x, face_normal.y, face_normal.z);
+    writer->written += 1;
+}
+
+void WriteQuad(MeshWriter *writer, MeshVertex a, MeshVertex b, MeshVertex c, MeshVertex d)
+{
+    WriteTriangle(writer, a, b, c);
+    WriteTriangle(writer, a, c, d);
+}
+
+MeshVertex SphereVertex(float u, float v)
+{
+    float theta = 2.0f * PI * u;
+    float phi   = PI * v - PI / 2.0f;
+    MeshVertex vertex;
+    vertex.normal  = glm::vec3(cos(phi) * sin(theta), sin(phi), cos(phi) * cos(theta));
+    vertex.pos     = vertex.normal;
+    vertex.texture = glm::vec2(u, v);
+    return vertex;
+}
+
+void GenerateSphere(MeshWriter *writer, long long num_triangles)
+{
+    // slices = 2 * stacks gives roughly square quads
+    int stacks = (int)sqrt(num_triangles / 4.0);
+    stacks = (stacks < 2) ? 2 : stacks;
+    int slices = 2 * stacks;
+    WriteHeader(writer, "SPHERE", 2LL * stacks * slices);
+    for (int j = 0; j < stacks; j++) {
+        for (int i = 0; i < slices; i++) {
+            float u0 = (float)i / slices, u1 = (float)(i + 1) / slices;
+            float v0 = (float)j / stacks, v1 = (float)(j + 1) / stacks;
+            WriteQuad(writer, SphereVertex(u0, v0), SphereVertex(u0, v1), SphereVertex(u1, v1), SphereVertex(u1, v0));
+        }
+    }
+}
+
+MeshVertex TorusVertex(float u, float v)
+{
+    const float R = 1.0f;  // distance from the center to the tube
+    const float r = 0.35f; // radius of the tube
+    float theta = 2.0f * PI * u;
+    float phi   = 2.0f * PI * v;
+    glm::vec3 ring = glm::vec3(sin(theta), 0.0f, cos(theta));
+    MeshVertex vertex;
+    vertex.normal  = cos(phi) * ring + glm::vec3(0.0f, sin(phi), 0.0f);
+    vertex.pos     = R * ring + r * vertex.normal;
+    vertex.texture = glm::vec2(u, v);
+    return vertex;
+}
+
+void GenerateTorus(MeshWriter *writer, long long num_triangles)
+{
+    // the ring is about three times longer than the tube
+    int tube = (int)sqrt(num_triangles / 6.0);
+    tube = (tube < 3) ? 3 : tube;
+    int ring = 3 * tube;
+    WriteHeader(writer, "TORUS", 2LL * ring * tube);
+    for (int j = 0; j < tube; j++) {
+        for (int i = 0; i < ring; i++) {
+            float u0 = (float)i / ring, u1 = (float)(i + 1) / ring;
+            float v0 = (float)j / tube, v1 = (float)(j + 1) / tube;
+            WriteQuad(writer, TorusVertex(u0, v0), TorusVertex(u0, v1), TorusVertex(u1, v1), TorusVertex(u1, v0));
+        }
+    }
+}
+
+// Value noise over an integer lattice, summed over a few octaves.
+float LatticeValue(int x, int y)
+{
+    unsigned int h = (unsigned int)x * 374761393u + (unsigned int)y * 668265263u + g_Seed * 2246822519u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    return ((h ^ (h >> 16)) & 0xFFFF) / 65535.0f;
+}
+
+float SmoothNoise(float x, float y)
+{
+    int   xi = (int)floor(x), yi = (int)floor(y);
+    float fx = x - xi,        fy = y - yi;
+    fx = fx * fx * (3.0f - 2.0f * fx);
+    fy = fy * fy * (3.0f - 2.0f * fy);
+    float a = LatticeValue(xi, yi),     b = LatticeValue(xi + 1, yi);
+    float c = LatticeValue(xi, yi + 1), d = LatticeValue(xi + 1, yi + 1);
+    return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+float TerrainHeight(float x, float z)
+{
+    float height    = 0.0f;
+    float amplitude = 0.5f;
+    float frequency = 2.0f;
+    for (int octave = 0; octave < 6; octave++) {
+        height    += amplitude * SmoothNoise(x * frequency, z * frequency);
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return height;
+}
+
+MeshVertex TerrainVertex(float u, float v, float step)
+{
+    float x = 4.0f * u - 2.0f;
+    float z = 4.0f * v - 2.0f;
+    float d = 4.0f * step;
+    MeshVertex vertex;
+    vertex.pos     = glm::vec3(x, TerrainHeight(x, z), z);
+    // central differences over one grid cell
+    float dx = TerrainHeight(x + d, z) - TerrainHeight(x - d, z);
+    float dz = TerrainHeight(x, z + d) - TerrainHeight(x, z - d);
+    vertex.normal  = glm::normalize(glm::vec3(-dx, 2.0f * d, -dz));
+    vertex.texture = glm::vec2(u, v);
+    return vertex;
+}
+
+void GenerateTerrain(MeshWriter *writer, long long num_triangles)
+{
+    int cells = (int)sqrt(num_triangles / 2.0);
+    cells = (cells < 1) ? 1 : cells;
+    float step = 1.0f / cells;
+    WriteHeader(writer, "TERRAIN", 2LL * cells * cells);
+    for (int j = 0; j < cells; j++) {
+        for (int i = 0; i < cells; i++) {
+            float u0 = i * step, u1 = (i + 1) * step;
+            float v0 = j * step, v1 = (j + 1) * step;
+            WriteQuad(writer, TerrainVertex(u0, v0, step), TerrainVertex(u1, v0, step),
+                              TerrainVertex(u1, v1, step), TerrainVertex(u0, v1, step));
+        }
+    }
+}
+
+void GenerateSoup(MeshWriter *writer, long long num_triangles)
+{
+    // small triangles scattered in a cube, so the depth complexity grows with the count
+    float size = 0.2f / cbrt(num_triangles / 10000.0 + 1.0);
+    WriteHeader(writer, "SOUP", num_triangles);
+    for (long long t = 0; t < num_triangles; t++) {
+        glm::vec3 center = glm::vec3(RandomFloat(), RandomFloat(), RandomFloat()) * 4.0f - 2.0f;
+        MeshVertex v[3];
+        for (int k = 0; k < 3; k++) {
+            v[k].pos     = center + (glm::vec3(RandomFloat(), RandomFloat(), RandomFloat()) - 0.5f) * size;
+            v[k].texture = glm::vec2(RandomFloat(), RandomFloat());
+        }
+        glm::vec3 normal = glm::cross(v[2].pos - v[0].pos, v[1].pos - v[0].pos);
+        float     length = glm::length(normal);
+        normal = (length > 0.0f) ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+        v[0].normal = v[1].normal = v[2].normal = normal;
+        WriteTriangle(writer, v[0], v[1], v[2]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <sphere|torus|terrain|soup> <triangles> <output.in> [--uv] [--materials <n>] [--seed <n>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int shape;
+    if (strcmp(argv[1], "sphere") == 0) {
+        shape = SHAPE_SPHERE;
+    } else if (strcmp(argv[1], "torus") == 0) {
+        shape = SHAPE_TORUS;
+    } else if (strcmp(argv[1], "terrain") == 0) {
+        shape = SHAPE_TERRAIN;
+    } else if (strcmp(argv[1], "soup") == 0) {
+        shape = SHAPE_SOUP;
+    } else {
+        fprintf(stderr, "ERROR: unknown shape \"%s\".\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    long long num_triangles = atoll(argv[2]);
+    if (num_triangles < 1) {
+        fprintf(stderr, "ERROR: invalid triangle count \"%s\".\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    MeshWriter writer;
+    writer.texture        = false;
+    writer.material_count = 1;
+    writer.total          = 0;
+    writer.written        = 0;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--uv") == 0) {
+            writer.texture = true;
+        } else if (strcmp(argv[i], "--materials") == 0 && i + 1 < argc) {
+            writer.material_count = atoi(argv[++i]);
+            writer.material_count = (writer.material_count < 1) ? 1 : writer.material_count;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            g_Seed = (unsigned int)atoi(argv[++i]);
+            g_Seed = (g_Seed == 0) ? 1 : g_Seed;
+        } else {
+            fprintf(stderr, "ERROR: unknown option \"%s\".\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    writer.fp = fopen(argv[3], "w");
+    if (!writer.fp) {
+        fprintf(stderr, "ERROR: unable to open file [%s]!\n", argv[3]);
+        return EXIT_FAILURE;
+    }
+    static char buffer[1 << 20];
+    setvbuf(writer.fp, buffer, _IOFBF, sizeof(buffer));
+
+    switch (shape) {
+      case SHAPE_SPHERE:  GenerateSphere (&writer, num_triangles); break;
+      case SHAPE_TORUS:   GenerateTorus  (&writer, num_triangles); break;
+      case SHAPE_TERRAIN: GenerateTerrain(&writer, num_triangles); break;
+      case SHAPE_SOUP:    GenerateSoup   (&writer, num_triangles); break;
+    }
+    fclose(writer.fp);
+    printf("%s: %lld triangles written\n", argv[3], writer.written);
+    return EXIT_SUCCESS;
+}
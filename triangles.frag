@@ -1,34 +1,27 @@
 #version 450 core
 
+// Specialized by the same #defines as triangles.vert.
+
 in vec4 fragColor;
 in vec4 worldPosition;
 in vec4 modelPosition;
 in vec4 fragNormal;
 in vec2 texCoords;
 
-uniform int fragmentShaderType;
-uniform bool useClose2GL;
-uniform bool useTexture;
-#define NO_SHADER 0
-#define PHONG     1
-
-
-uniform sampler2D textureC2GL;
-uniform sampler2D textureSampler;
+layout(binding = 0) uniform sampler2D textureC2GL;
+layout(binding = 1) uniform sampler2D textureSampler;
 
-uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
-uniform vec4 LightDir;
+// Filled by main() on the CPU, see FrameUniforms there.
+layout(std140, binding = 0) uniform FrameUniforms {
+    mat4 viewProjection;  // projection * view
+    vec4 cameraPosition;  // in world space
+    vec4 lightDirection;  // normalized, towards the light
+};
 
 out vec4 fColor;
 
-subroutine vec4 fragmentShader(vec4 baseColor);
-
-subroutine (fragmentShader) vec4 phongShader(vec4 baseColor) {
-    vec4 origin = vec4(0.0, 0.0, 0.0, 1.0);
-    vec4 cameraPosition = inverse(viewMatrix) * origin;
-    
+#ifdef PHONG
+vec4 phongShader(vec4 baseColor) {
     vec3 Kd = vec3(1.0, 1.0, 1.0);
     vec3 Ks = vec3(1.0, 1.0, 1.0);
     vec3 Ka = vec3(0.2, 0.2, 0.2);
@@ -36,7 +29,6 @@ subroutine (fragmentShader) vec4 phongShader(vec4 baseColor) {
     float q = 32.0;
 
     vec4 fragNormal = normalize(fragNormal);
-    vec4 lightDirection = normalize(vec4(1.0,1.0,0.0,0.0));
     vec4 viewDirection = normalize(cameraPosition - worldPosition);
     vec4 reflectionDirection = -lightDirection + 2 * fragNormal * dot(fragNormal, lightDirection);
 
@@ -51,34 +43,22 @@ subroutine (fragmentShader) vec4 phongShader(vec4 baseColor) {
     return outputColor;
 }
 
-subroutine (fragmentShader) vec4 noFragmentShader(vec4 baseColor) {
-    return baseColor;
-}
+#endif
 
 void main()
 {
-    if (useClose2GL) {
-        fColor = texture(textureC2GL, texCoords);
-    } else {
-        vec4 baseColor;
-        if (useTexture) {
-            baseColor = texture(textureSampler, texCoords);
-        } else {
-            baseColor = fragColor;
-        }
-        switch(fragmentShaderType) {
-          case NO_SHADER: {
-            fColor = noFragmentShader(baseColor);
-            break;
-          }
-          case PHONG: {
-            fColor = phongShader(baseColor);
-            break;
-          }
-          default: {
-            fColor = noFragmentShader(baseColor);
-            break;
-          }
-        }
-    }
+#ifdef CLOSE2GL_BLIT
+    fColor = texture(textureC2GL, texCoords);
+#else
+  #ifdef USE_TEXTURE
+    vec4 baseColor = texture(textureSampler, texCoords);
+  #else
+    vec4 baseColor = fragColor;
+  #endif
+  #ifdef PHONG
+    fColor = phongShader(baseColor);
+  #else
+    fColor = baseColor;
+  #endif
+#endif
 }
@@ -1,24 +1,40 @@
 #version 450 core
 
-layout( location = 0 ) in vec4 model_coefficients;
-layout( location = 1 ) in vec4 color_coefficients;
-layout( location = 2 ) in vec4 normal_coefficients;
+// Specialized by the #defines that LoadGpuProgram() inserts after #version:
+// CLOSE2GL_BLIT for the quad showing the Close2GL color buffer, otherwise at
+// most one of GOURAUD_AD, GOURAUD_ADS and PHONG (none is NO_SHADER) and
+// USE_TEXTURE.
+
+// GpuVertex of vertex_format.h and the instance index; the Close2GL quad only
+// sets locations 0 and 3
+layout( location = 0 ) in vec4 model_coefficients;    // w = 1 from the 3 floats of the buffer
+layout( location = 2 ) in vec2 normal_octahedral;     // GBufferPackNormal()
 layout( location = 3 ) in vec2 texture_coefficients;
-
-uniform vec4 colorVector;
-uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
-
-uniform vec4 lightPos;
-
-uniform bool useClose2GL;
-uniform bool useTexture;
-uniform int vertexShaderType;
-
-#define NO_SHADER   0
-#define GOURAUD_AD  1
-#define GOURAUD_ADS 2
+layout( location = 4 ) in uint material_index;
+layout( location = 5 ) in uint instance_index;        // baseInstance + the instance of the draw
+
+// Filled by main() on the CPU, see FrameUniforms there.
+layout(std140, binding = 0) uniform FrameUniforms {
+    mat4 viewProjection;  // projection * view
+    vec4 cameraPosition;  // in world space
+    vec4 lightDirection;  // normalized, towards the light
+};
+
+// the instances drawn in the frame, see InstanceData in main()
+struct Instance {
+    mat4 modelMatrix;
+    mat4 normalMatrix;    // inverse(transpose(modelMatrix))
+    vec4 colorVector;
+};
+
+layout(std430, binding = 0) readonly buffer Instances {
+    Instance instances[];
+};
+
+// of the instance of this vertex, set at the start of main()
+mat4 modelMatrix;
+mat4 normalMatrix;
+vec4 colorVector;
 
 out vec4 fragColor;
 out vec4 worldPosition;
@@ -26,91 +42,78 @@ out vec4 modelPosition;
 out vec4 fragNormal;
 out vec2 texCoords;
 
-subroutine vec4 vertexShader();
-
-subroutine (vertexShader) vec4 gouraudADSshader() {
-    vec4 origin = vec4(0.0, 0.0, 0.0, 1.0);
-    vec4 cameraPosition = inverse(viewMatrix) * origin;
-    
+#ifdef GOURAUD_ADS
+vec4 gouraudADSshader() {
     vec3 Kd = vec3(1.0, 1.0, 1.0);
     vec3 Ks = vec3(1.0, 1.0, 1.0);
     vec3 Ka = vec3(0.2, 0.2, 0.2);
     vec3 Ia = vec3(0.2, 0.2, 0.2);
     float q = 32.0;
 
-    vec4 lightDirection = normalize(vec4(1.0,1.0,0.0,0.0));
     vec4 viewDirection = normalize(cameraPosition - worldPosition);
     vec4 reflectionDirection = -lightDirection + 2 * fragNormal * dot(fragNormal, lightDirection);
 
     vec3 ambientTerm = Ka * Ia;
     vec3 lambertDiffuseTerm = Kd * max(0.0, dot(fragNormal, lightDirection));
     vec3 phongSpecularTerm = Ks * pow(max(0.0, dot(reflectionDirection, viewDirection)), q);
-    
+
     vec4 outputColor = vec4(0.0);
     outputColor.rgb = (ambientTerm+lambertDiffuseTerm+phongSpecularTerm) * colorVector.rgb;
     outputColor.rgb = pow(outputColor.rgb, vec3(1.0,1.0,1.0)/2.2);
     outputColor.a = 1.0;
     return outputColor;
 }
+#endif
 
-subroutine (vertexShader) vec4 gouraudADshader() {   
+#ifdef GOURAUD_AD
+vec4 gouraudADshader() {
     vec3 Kd = vec3(1.0, 1.0, 1.0);
     vec3 Ka = vec3(0.2, 0.2, 0.2);
     vec3 Ia = vec3(0.2,0.2,0.2);
 
-    vec4 lightDirection = normalize(vec4(1.0,1.0,0.0,0.0));
-
     vec3 ambientTerm = Ka * Ia;
     vec3 lambertDiffuseTerm = Kd * max(0.0, dot(fragNormal, lightDirection));
-    
+
     vec4 outputColor = vec4(0.0);
     outputColor.rgb = (ambientTerm+lambertDiffuseTerm) * colorVector.rgb;
     outputColor.rgb = pow(outputColor.rgb, vec3(1.0,1.0,1.0)/2.2);
     outputColor.a = 1.0;
     return outputColor;
 }
-
-subroutine (vertexShader) vec4 noVertexShader() {
-    return colorVector;
-}
-
-subroutine vec4 modelCoords();
-
-subroutine (modelCoords) vec4 close2GLCoords() {
-    return model_coefficients;
+#endif
+
+// the inverse of GBufferPackNormal()
+vec3 unpackNormal(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy -= mix(vec2(-t), vec2(t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
 }
 
-subroutine (modelCoords) vec4 openGLCoords() {
+vec4 openGLCoords() {
     worldPosition = modelMatrix * model_coefficients;
-    fragNormal = inverse(transpose(modelMatrix)) * normal_coefficients;
-    fragNormal.w = 0.0; 
-    fragNormal = normalize(normal_coefficients);
-    
-    return projectionMatrix * viewMatrix * modelMatrix * model_coefficients;
+    fragNormal = normalize(normalMatrix * vec4(unpackNormal(normal_octahedral), 0.0));
+
+    return viewProjection * worldPosition;
 }
 
 void main()
 {
-	if (useClose2GL) {
-		gl_Position = close2GLCoords();
-        fragColor = noVertexShader();
-        texCoords = texture_coefficients;
-	} else {
-		gl_Position = openGLCoords();
-        texCoords = texture_coefficients;
-        switch(vertexShaderType) {
-          case NO_SHADER: 
-            fragColor = noVertexShader();
-            break;
-          case GOURAUD_AD:
-            fragColor = gouraudADshader();
-            break;
-          case GOURAUD_ADS:
-            fragColor = gouraudADSshader();
-            break;
-          default:
-            fragColor = noVertexShader();
-            break;
-        }
-    }
+#ifdef CLOSE2GL_BLIT
+    gl_Position = model_coefficients;
+    texCoords = texture_coefficients;
+#else
+    modelMatrix  = instances[instance_index].modelMatrix;
+    normalMatrix = instances[instance_index].normalMatrix;
+    colorVector  = instances[instance_index].colorVector;
+    gl_Position = openGLCoords();
+    texCoords = texture_coefficients;
+  #if defined(GOURAUD_AD)
+    fragColor = gouraudADshader();
+  #elif defined(GOURAUD_ADS)
+    fragColor = gouraudADSshader();
+  #else
+    fragColor = colorVector;
+  #endif
+#endif
 }